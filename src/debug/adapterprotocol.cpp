@@ -44,6 +44,19 @@ StoppedEventBody::StoppedEventBody(std::string_view eventReason, std::string_vie
 	, threadId(eventThreadId)
 {}
 
+/* -------------------------------------------------------------------------- */
+StackTraceResponseBody StackTraceResponseBody::GetFramesPage(const StackTraceArguments& args) const {
+	const size_t start = std::min<size_t>(args.startFrame.value_or(0), stackFrames.size());
+	const size_t levels = args.levels.value_or(0);
+	const size_t end = levels == 0 ? stackFrames.size() : std::min(start + levels, stackFrames.size());
+
+	StackTraceResponseBody page;
+	page.stackFrames.assign(stackFrames.begin() + start, stackFrames.begin() + end);
+	page.totalFrames = static_cast<unsigned>(stackFrames.size());
+
+	return page;
+}
+
 /* -------------------------------------------------------------------------- */
 Source::Source(std::string_view sourcePath): path(sourcePath)
 {}
@@ -0,0 +1,79 @@
+//◦ Playrix ◦
+#pragma once
+
+#include <coroutine>
+#include <mutex>
+#include <vector>
+
+
+namespace Runtime::Debug {
+
+/**
+	Coroutines waiting for the condition guarded by the caller's mutex: condition variable that does not block the thread.
+	Waiter checks the condition under the mutex and awaits Wait(lock), notifier changes the condition under the same mutex
+	and calls NotifyAll after releasing it.
+	Wait releases the lock once the coroutine is suspended and does not acquire it again: the condition must be checked again after the resume.
+	Waiters are resumed inline by the notifying thread, the waiter that must not run on it moves to the pool scheduler itself.
+*/
+class AsyncWaitList
+{
+public:
+
+	class Awaiter
+	{
+	public:
+
+		Awaiter(AsyncWaitList& waitList, std::unique_lock<std::mutex>& lock): _waitList(waitList), _lock(lock)
+		{}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			// lock object is released before the mutex is unlocked: waiter can be resumed (and the lock object destroyed) right after that.
+			std::mutex* const mutex = _lock.release();
+			_waitList.Add(handle);
+			mutex->unlock();
+		}
+
+		void await_resume() const noexcept
+		{}
+
+	private:
+
+		AsyncWaitList& _waitList;
+		std::unique_lock<std::mutex>& _lock;
+	};
+
+
+	[[nodiscard]] Awaiter Wait(std::unique_lock<std::mutex>& lock) {
+		Assert(lock.owns_lock());
+		return {*this, lock};
+	}
+
+	void NotifyAll() {
+		std::vector<std::coroutine_handle<>> waiters;
+
+		{
+			std::lock_guard lock{_mutex};
+			waiters.swap(_waiters);
+		}
+
+		for (const std::coroutine_handle<> waiter : waiters) {
+			waiter.resume();
+		}
+	}
+
+private:
+
+	void Add(std::coroutine_handle<> handle) {
+		std::lock_guard lock{_mutex};
+		_waiters.push_back(handle);
+	}
+
+	std::mutex _mutex;
+	std::vector<std::coroutine_handle<>> _waiters;
+};
+
+} // namespace Runtime::Debug
@@ -0,0 +1,362 @@
+//◦ Playrix ◦
+#include "lua-toolkit/debug/dapjsonreader.h"
+#include <runtime/serialization/json.h>
+#include <Core/Log.h>
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+namespace Runtime::Dap {
+
+namespace {
+
+void AppendUtf8(std::string& str, unsigned codePoint) {
+	if (codePoint < 0x80) {
+		str += static_cast<char>(codePoint);
+	}
+	else if (codePoint < 0x800) {
+		str += static_cast<char>(0xC0 | (codePoint >> 6));
+		str += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000) {
+		str += static_cast<char>(0xE0 | (codePoint >> 12));
+		str += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		str += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else {
+		str += static_cast<char>(0xF0 | (codePoint >> 18));
+		str += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+		str += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		str += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+JsonReader::JsonReader(std::string_view json): _json(json)
+{}
+
+
+JsonReader::ValueType JsonReader::PeekType() {
+	SkipWhitespace();
+
+	if (_pos >= _json.size()) {
+		ThrowError("value expected");
+	}
+
+	switch (_json[_pos]) {
+	case 'n': return ValueType::Null;
+	case 't':
+	case 'f': return ValueType::Bool;
+	case '"': return ValueType::String;
+	case '[': return ValueType::Array;
+	case '{': return ValueType::Object;
+	default: return ValueType::Number;
+	}
+}
+
+
+void JsonReader::Read(bool& value) {
+	SkipWhitespace();
+
+	if (_json.substr(_pos, 4) == "true") {
+		value = true;
+		_pos += 4;
+	}
+	else if (_json.substr(_pos, 5) == "false") {
+		value = false;
+		_pos += 5;
+	}
+	else {
+		ThrowError("boolean expected");
+	}
+}
+
+
+void JsonReader::Read(double& value) {
+	const std::string_view token = ReadNumberToken();
+	if (std::from_chars(token.data(), token.data() + token.size(), value).ec != std::errc{}) {
+		ThrowError("number expected");
+	}
+}
+
+
+void JsonReader::Read(std::string& value) {
+	SkipWhitespace();
+	ReadString(value);
+}
+
+
+void JsonReader::Read(RuntimeValue::Ptr& value) {
+	if (TryReadNull()) {
+		value = nullptr;
+		return;
+	}
+
+	// Dynamic values (i.e. launch configuration) are parsed with the runtime serialization.
+	value = *Serialization::JsonParseString(SkipValue());
+}
+
+
+std::string_view JsonReader::SkipValue() {
+	SkipWhitespace();
+
+	const size_t start = _pos;
+
+	if (_pos >= _json.size()) {
+		ThrowError("value expected");
+	}
+
+	const char c = _json[_pos];
+
+	if (c == '{') {
+		ReadObject([this](std::string_view) {
+			SkipValue();
+		});
+	}
+	else if (c == '[') {
+		ReadArray([this] {
+			SkipValue();
+		});
+	}
+	else if (c == '"') {
+		// strings are skipped without unescaping
+		++_pos;
+		while (_pos < _json.size() && _json[_pos] != '"') {
+			_pos += _json[_pos] == '\\' ? 2 : 1;
+		}
+
+		if (_pos >= _json.size()) {
+			ThrowError("unterminated string");
+		}
+
+		++_pos;
+	}
+	else if (c == 't' || c == 'f') {
+		bool dummy;
+		Read(dummy);
+	}
+	else if (!TryReadNull()) {
+		ReadNumberToken();
+	}
+
+	return _json.substr(start, _pos - start);
+}
+
+
+bool JsonReader::TryReadNull() {
+	SkipWhitespace();
+
+	if (_json.substr(_pos, 4) == "null") {
+		_pos += 4;
+		return true;
+	}
+
+	return false;
+}
+
+
+long long JsonReader::ReadInteger() {
+	const std::string_view token = ReadNumberToken();
+
+	long long value = 0;
+	if (std::from_chars(token.data(), token.data() + token.size(), value).ec != std::errc{}) {
+		ThrowError("integer expected");
+	}
+
+	return value;
+}
+
+
+unsigned long long JsonReader::ReadUnsigned() {
+	const std::string_view token = ReadNumberToken();
+
+	unsigned long long value = 0;
+	if (std::from_chars(token.data(), token.data() + token.size(), value).ec != std::errc{}) {
+		ThrowError("unsigned integer expected");
+	}
+
+	return value;
+}
+
+
+std::string_view JsonReader::ReadNumberToken() {
+	SkipWhitespace();
+
+	const size_t start = _pos;
+	while (_pos < _json.size() && (isdigit(static_cast<unsigned char>(_json[_pos])) || strchr("+-.eE", _json[_pos]) != nullptr)) {
+		++_pos;
+	}
+
+	if (start == _pos) {
+		ThrowError("number expected");
+	}
+
+	return _json.substr(start, _pos - start);
+}
+
+
+std::string_view JsonReader::ReadKey() {
+	SkipWhitespace();
+
+	if (_pos >= _json.size() || _json[_pos] != '"') {
+		ThrowError("object key expected");
+	}
+
+	// Keys without escapes are referenced in place.
+	const size_t start = _pos + 1;
+	const size_t end = _json.find_first_of("\"\\", start);
+
+	if (end != std::string_view::npos && _json[end] == '"') {
+		_pos = end + 1;
+		return _json.substr(start, end - start);
+	}
+
+	ReadString(_keyBuffer);
+	return _keyBuffer;
+}
+
+
+void JsonReader::ReadString(std::string& value) {
+
+	if (_pos >= _json.size() || _json[_pos] != '"') {
+		ThrowError("string expected");
+	}
+
+	++_pos;
+	value.clear();
+
+	while (true) {
+		const size_t runEnd = _json.find_first_of("\"\\", _pos);
+		if (runEnd == std::string_view::npos) {
+			ThrowError("unterminated string");
+		}
+
+		value.append(_json.data() + _pos, runEnd - _pos);
+		_pos = runEnd + 1;
+
+		if (_json[runEnd] == '"') {
+			return;
+		}
+
+		if (_pos >= _json.size()) {
+			ThrowError("unterminated string");
+		}
+
+		const char escaped = _json[_pos++];
+
+		switch (escaped) {
+		case 'b': value += '\b'; break;
+		case 'f': value += '\f'; break;
+		case 'n': value += '\n'; break;
+		case 'r': value += '\r'; break;
+		case 't': value += '\t'; break;
+		case 'u': {
+			const auto readHex = [this]() -> unsigned {
+				unsigned code = 0;
+				const std::string_view hex = _json.substr(_pos, 4);
+				const auto [end, error] = std::from_chars(hex.data(), hex.data() + hex.size(), code, 16);
+				if (hex.size() != 4 || error != std::errc{} || end != hex.data() + 4) {
+					ThrowError("invalid unicode escape");
+				}
+
+				_pos += 4;
+				return code;
+			};
+
+			unsigned codePoint = readHex();
+			if (codePoint >= 0xD800 && codePoint <= 0xDBFF && _json.substr(_pos, 2) == "\\u") {
+				_pos += 2;
+				const unsigned low = readHex();
+				if (low < 0xDC00 || low > 0xDFFF) {
+					ThrowError("invalid unicode surrogate pair");
+				}
+
+				codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+			}
+
+			AppendUtf8(value, codePoint);
+			break;
+		}
+		default:
+			value += escaped;
+		}
+	}
+}
+
+
+void JsonReader::SkipWhitespace() {
+	while (_pos < _json.size() && (_json[_pos] == ' ' || _json[_pos] == '\t' || _json[_pos] == '\n' || _json[_pos] == '\r')) {
+		++_pos;
+	}
+}
+
+
+bool JsonReader::TryConsume(char c) {
+	SkipWhitespace();
+
+	if (_pos < _json.size() && _json[_pos] == c) {
+		++_pos;
+		return true;
+	}
+
+	return false;
+}
+
+
+void JsonReader::Expect(char c) {
+	if (!TryConsume(c)) {
+		ThrowError(std::string{"'"} + c + "' expected");
+	}
+}
+
+
+void JsonReader::ThrowError(std::string_view message) const {
+	throw std::runtime_error(Core::Format::format("Invalid DAP json ({}): {}", _pos, message));
+}
+
+/* -------------------------------------------------------------------------- */
+InboundMessage InboundMessage::Parse(std::string_view json) {
+
+	InboundMessage message;
+	JsonReader reader{json};
+
+	reader.ReadObject([&](std::string_view key) {
+		if (key == "seq") {
+			reader.Read(message.seq);
+		}
+		else if (key == "type") {
+			reader.Read(message.type);
+		}
+		else if (key == "command") {
+			reader.Read(message.command);
+		}
+		else if (key == "arguments") {
+			// "arguments": null is the same as the missing arguments.
+			const std::string_view arguments = reader.SkipValue();
+			if (arguments != "null") {
+				message.arguments = arguments;
+			}
+		}
+		else {
+			reader.SkipValue();
+		}
+	});
+
+	return message;
+}
+
+
+RuntimeValue::Ptr InboundMessage::GetArgumentsValue() const {
+	RuntimeValue::Ptr value;
+	if (!arguments.empty()) {
+		JsonReader{arguments}.Read(value);
+	}
+
+	return value;
+}
+
+} // namespace Runtime::Dap
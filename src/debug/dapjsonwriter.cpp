@@ -0,0 +1,208 @@
+//◦ Playrix ◦
+#include "lua-toolkit/debug/dapjsonwriter.h"
+#include <runtime/io/readerwriter.h>
+#include <runtime/serialization/json.h>
+
+#include <array>
+#include <charconv>
+#include <cmath>
+
+namespace Runtime::Dap {
+
+namespace {
+
+/**
+	Length of the well-formed UTF-8 sequence that starts at the given position (overlong forms and surrogates are rejected),
+	zero - ill-formed.
+*/
+size_t GetUtf8SequenceLength(std::string_view value, size_t pos) {
+	const auto byteAt = [value](size_t i) {
+		return static_cast<unsigned char>(value[i]);
+	};
+
+	const unsigned char lead = byteAt(pos);
+
+	size_t length = 0;
+	unsigned char secondMin = 0x80;
+	unsigned char secondMax = 0xBF;
+
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		length = 2;
+	}
+	else if (lead >= 0xE0 && lead <= 0xEF) {
+		length = 3;
+		secondMin = lead == 0xE0 ? 0xA0 : 0x80;
+		secondMax = lead == 0xED ? 0x9F : 0xBF;
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4) {
+		length = 4;
+		secondMin = lead == 0xF0 ? 0x90 : 0x80;
+		secondMax = lead == 0xF4 ? 0x8F : 0xBF;
+	}
+	else {
+		return 0;
+	}
+
+	if (pos + length > value.size() || byteAt(pos + 1) < secondMin || byteAt(pos + 1) > secondMax) {
+		return 0;
+	}
+
+	for (size_t i = 2; i < length; ++i) {
+		if ((byteAt(pos + i) & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+
+	return length;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+JsonWriter::JsonWriter(BytesBuffer& buffer): _buffer(buffer)
+{}
+
+
+void JsonWriter::Write(bool value) {
+	WriteRaw(value ? "true" : "false");
+}
+
+
+void JsonWriter::Write(double value) {
+	// JSON has no NaN/Infinity literals.
+	if (!std::isfinite(value)) {
+		WriteRaw("null");
+		return;
+	}
+
+	std::array<char, 32> chars;
+	const auto [end, error] = std::to_chars(chars.data(), chars.data() + chars.size(), value);
+	Assert(error == std::errc{});
+	WriteRaw({chars.data(), static_cast<size_t>(end - chars.data())});
+}
+
+
+void JsonWriter::Write(std::string_view value) {
+
+	constexpr std::string_view HexDigits {"0123456789abcdef"};
+
+	WriteRaw("\"");
+
+	// Unescaped runs are written with the single copy.
+	size_t runStart = 0;
+
+	for (size_t i = 0; i < value.size(); ++i) {
+		const unsigned char c = static_cast<unsigned char>(value[i]);
+
+		// Lua strings are arbitrary bytes: ill-formed UTF-8 is replaced (byte by byte) with U+FFFD, so the client can decode the message.
+		if (c >= 0x80) {
+			if (const size_t length = GetUtf8SequenceLength(value, i)) {
+				i += length - 1;
+			}
+			else {
+				WriteRaw(value.substr(runStart, i - runStart));
+				WriteRaw("\\ufffd");
+				runStart = i + 1;
+			}
+			continue;
+		}
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		WriteRaw(value.substr(runStart, i - runStart));
+		runStart = i + 1;
+
+		switch (c) {
+		case '"': WriteRaw("\\\""); break;
+		case '\\': WriteRaw("\\\\"); break;
+		case '\b': WriteRaw("\\b"); break;
+		case '\f': WriteRaw("\\f"); break;
+		case '\n': WriteRaw("\\n"); break;
+		case '\r': WriteRaw("\\r"); break;
+		case '\t': WriteRaw("\\t"); break;
+		default: {
+			const char escaped[] = {'\\', 'u', '0', '0', HexDigits[c >> 4], HexDigits[c & 0x0F]};
+			WriteRaw({escaped, std::size(escaped)});
+		}
+		}
+	}
+
+	WriteRaw(value.substr(runStart));
+	WriteRaw("\"");
+}
+
+
+void JsonWriter::Write(const std::string& value) {
+	Write(std::string_view{value});
+}
+
+
+void JsonWriter::Write(const char* value) {
+	Write(std::string_view{value ? value : ""});
+}
+
+
+void JsonWriter::Write(const RuntimeValue::Ptr& value) {
+	if (!value) {
+		WriteRaw("null");
+		return;
+	}
+
+	// Dynamic values (i.e. launch configuration) are still written through the runtime serialization.
+	Io::BufferWriter writer{_buffer};
+	Serialization::JsonWrite(writer, value).rethrowIfException();
+}
+
+
+void JsonWriter::Write(const AnyJsonValue& value) {
+	if (!value) {
+		WriteRaw("null");
+		return;
+	}
+
+	value.Write(*this);
+}
+
+
+void JsonWriter::WriteInteger(long long value) {
+	std::array<char, 24> chars;
+	const auto [end, error] = std::to_chars(chars.data(), chars.data() + chars.size(), value);
+	Assert(error == std::errc{});
+	WriteRaw({chars.data(), static_cast<size_t>(end - chars.data())});
+}
+
+
+void JsonWriter::WriteUnsigned(unsigned long long value) {
+	std::array<char, 24> chars;
+	const auto [end, error] = std::to_chars(chars.data(), chars.data() + chars.size(), value);
+	Assert(error == std::errc{});
+	WriteRaw({chars.data(), static_cast<size_t>(end - chars.data())});
+}
+
+
+void JsonWriter::WriteRaw(std::string_view str) {
+	if (!str.empty()) {
+		memcpy(_buffer.append(str.size()), str.data(), str.size());
+	}
+}
+
+/* -------------------------------------------------------------------------- */
+AnyJsonValue::operator bool() const {
+	return static_cast<bool>(_value);
+}
+
+
+void AnyJsonValue::Write(JsonWriter& writer) const {
+	Assert(_value && _write);
+	_write(writer, _value.get());
+}
+
+
+void AnyJsonValue::Write(MsgPackWriter& writer) const {
+	Assert(_value && _writeMsgPack);
+	_writeMsgPack(writer, _value.get());
+}
+
+} // namespace Runtime::Dap
@@ -1,9 +1,23 @@
 //◦ Playrix ◦
 #include "lua-toolkit/debug/dapmessagestream.h"
+#include "lua-toolkit/debug/debugmetrics.h"
+#include "lua-toolkit/debug/protocoltrace.h"
+#include "asyncwaitlist.h"
+#include "remoting/contentlengthstream.h"
 #include "remoting/httpstream.h"
+#include "remoting/outboundpacket.h"
+#include "remoting/stdiostream.h"
 
 #include <runtime/com/comclass.h>
+#include <runtime/io/readerwriter.h>
+#include <runtime/runtime/runtime.h>
 #include <runtime/serialization/json.h>
+#include <runtime/threading/lock.h>
+#include <runtime/utils/disposable.h>
+
+#include <deque>
+#include <mutex>
+#include <variant>
 
 namespace Runtime::Debug {
 
@@ -17,49 +31,259 @@ class CommandsStreamImpl final : public DapMessageStream
 	COMCLASS_(DapMessageStream)
 
 public:
-	CommandsStreamImpl(ComPtr<Io::AsyncReader> stream): _bytesStream(std::move(stream))
+	CommandsStreamImpl(ComPtr<Io::AsyncReader> stream, DapFraming framing, std::string path = std::string{DefaultPath})
+		: _bytesStream(std::move(stream))
+		, _path(std::move(path))
 	{
 		Assert(_bytesStream);
+
+		if (framing == DapFraming::ContentLength) {
+			_inboundStream.emplace<ContentLengthStream>();
+		}
 	}
 
 private:
 
-	Task<RuntimeReadonlyDictionary::Ptr> GetDapMessage() override {
+	static constexpr std::string_view DefaultPath {"/dap"};
 
-		HttpStream::Packet packet = co_await HttpStream::ReadHttpPacket(_httpStream, *_bytesStream);
+	/**
+		Broken framing can not be resynchronized: the stream is closed and the session ends.
+		Message that is not a valid JSON is skipped: framing is intact, the next message can be read.
+	*/
+	Task<std::optional<Dap::InboundMessage>> GetDapMessage() override {
 
-		if (!packet) {
-			co_return nothing;
-		}
+		while (true) {
+			std::optional<std::string_view> body;
+			bool isInvalid = false;
 
-		if (IsDebuggerPresent()) {
-			OutputDebugStringA("\nREQUEST:\n");
-			OutputDebugStringA(std::string(packet.body).c_str());
-			OutputDebugStringA("\n");
-		}
+			if (auto* const httpStream = std::get_if<HttpStream>(&_inboundStream)) {
+				if (HttpStream::Packet packet = co_await HttpStream::ReadHttpPacket(*httpStream, *_bytesStream)) {
+					body = packet.body;
+				}
+				isInvalid = httpStream->IsInvalid();
+			}
+			else {
+				auto& contentLengthStream = std::get<ContentLengthStream>(_inboundStream);
+				body = co_await ContentLengthStream::ReadPacket(contentLengthStream, *_bytesStream);
+				isInvalid = contentLengthStream.IsInvalid();
+			}
+
+			if (!body) {
+				if (isInvalid) {
+					LOG_WARN("Invalid DAP packet framing: stream is closed");
+					if (auto* const disposable = _bytesStream->as<Disposable*>()) {
+						disposable->dispose();
+					}
+				}
+
+				co_return std::nullopt;
+			}
+
+			ProtocolTrace::Trace(ProtocolTrace::Direction::Inbound, *body);
 
-		co_return *Serialization::JsonParseString(packet.body);
+			try {
+				co_return Dap::InboundMessage::Parse(*body);
+			}
+			catch (const std::exception& exception) {
+				LOG_WARN("Invalid DAP message skipped: {}", exception.what());
+			}
+		}
 	}
 
 	Task<> SendDapMessage(Runtime::RuntimeReadonlyDictionary::Ptr command) override {
+		return SendDapMessage(std::function<void (BytesBuffer&)>{[command = std::move(command)](BytesBuffer& buffer) {
+			Io::BufferWriter writer{buffer};
+			Serialization::JsonWrite(writer, command).rethrowIfException();
+		}}, DapBodyEncoding::Json);
+	}
+
+	DapFraming GetFraming() const override {
+		return std::holds_alternative<ContentLengthStream>(_inboundStream) ? DapFraming::ContentLength : DapFraming::Http;
+	}
+
+	DapBodyEncoding GetPayloadEncoding() const override {
+		return _payloadEncoding;
+	}
+
+	void SetPayloadEncoding(DapBodyEncoding encoding) override {
+		Assert(encoding == DapBodyEncoding::Json || std::holds_alternative<HttpStream>(_inboundStream));
+		_payloadEncoding = encoding;
+	}
+
+	/**
+		Messages are written only by the writer task: it is started when the first message is queued and ends when the queue is drained,
+		senders just enqueue their messages and return. So the order of the messages is preserved,
+		and all messages enqueued while the previous write is in progress are coalesced into the one socket write.
+		When the queue is full the sender is suspended (not blocked) until the writer takes the messages: backpressure for the high volume producers (i.e. output events).
+		Failed write means the connection is dead: the stream is disposed (so the pending read completes and the session ends),
+		queued and later messages are dropped.
+	*/
+	Task<> SendDapMessage(std::function<void (BytesBuffer&)> writeBody, DapBodyEncoding encoding) override {
 		Assert(_bytesStream);
+		Assert(encoding == DapBodyEncoding::Json || std::holds_alternative<HttpStream>(_inboundStream));
+
+		bool isWriterStarted = false;
+		bool isSuspended = false;
+
+		{
+			std::unique_lock lock{_outboundMutex};
+
+			while (_outbound.size() >= MaxQueuedMessages && !_isBroken) {
+				co_await _outboundSpaceAvailable.Wait(lock);
+				isSuspended = true;
+				lock = std::unique_lock{_outboundMutex};
+			}
+
+			if (_isBroken) {
+				co_return;
+			}
+
+			_outbound.emplace_back(std::move(writeBody), encoding);
+			DebugMetrics::AddQueuedMessages(1);
 
-		if (Io::AsyncWriter* const asyncWriter = _bytesStream->as<Io::AsyncWriter*>()) {
-			co_await HttpStream::SendHttpJsonPacket(std::move(command), "/dap", *asyncWriter);
+			if (!_isWriting) {
+				_isWriting = true;
+				isWriterStarted = true;
+			}
 		}
-		else {
+
+		if (isWriterStarted) {
+			WriteOutboundMessages(Com::Acquire{static_cast<DapMessageStream*>(this)}).detach();
+		}
+
+		// resumed by the writer: the sender's continuation must not delay the writes.
+		if (isSuspended) {
+			co_await RuntimeCore::instance().poolScheduler();
+		}
+	}
+
+	/**
+		Writer task keeps the stream alive until the queue is drained.
+	*/
+	Task<> WriteOutboundMessages(DapMessageStream::Ptr self) {
+		// messages are serialized and written on the pool, not on the sender's thread (i.e. the lua thread that sends the 'stopped' event).
+		co_await RuntimeCore::instance().poolScheduler();
+
+		Io::AsyncWriter* const asyncWriter = _bytesStream->as<Io::AsyncWriter*>();
+		if (!asyncWriter) {
 			Halt("Currently can send commands only throug Io::AsyncWriter API");
+			co_return;
+		}
+
+		std::vector<OutboundMessage> messages;
+
+		while (true) {
+			messages.clear();
+			{
+				lock_(_outboundMutex);
+				if (_outbound.empty()) {
+					_isWriting = false;
+					break;
+				}
+
+				const size_t count = std::min(_outbound.size(), MaxCoalescedMessages);
+				std::move(_outbound.begin(), _outbound.begin() + count, std::back_inserter(messages));
+				_outbound.erase(_outbound.begin(), _outbound.begin() + count);
+				DebugMetrics::AddQueuedMessages(-static_cast<int64_t>(count));
+			}
+
+			_outboundSpaceAvailable.NotifyAll();
+
+			PooledBytesBuffer packetsBytes;
+
+			for (const OutboundMessage& message : messages) {
+				const size_t packetStart = packetsBytes->size();
+
+				try {
+					if (std::holds_alternative<HttpStream>(_inboundStream)) {
+						const std::string_view contentType = message.encoding == DapBodyEncoding::MsgPack ? HttpStream::MsgPackContentType : HttpStream::JsonContentType;
+						HttpStream::AppendHttpPacket(*packetsBytes, message.writeBody, _path, contentType);
+					}
+					else {
+						ContentLengthStream::AppendJsonPacket(*packetsBytes, message.writeBody);
+					}
+				}
+				catch (const std::exception& exception) {
+					// the message that can not be serialized is dropped (its partial packet is cut off), the session goes on.
+					packetsBytes->resize(packetStart);
+					LOG_WARN("DAP message is not sent, serialization failed: {}", exception.what());
+				}
+			}
+
+			if (packetsBytes->size() == 0) {
+				continue;
+			}
+
+			bool isFailed = false;
+
+			try {
+				co_await asyncWriter->write(packetsBytes->toReadOnly());
+			}
+			catch (const std::exception&) {
+				isFailed = true;
+			}
+
+			if (isFailed) {
+				OnWriteFailed();
+				break;
+			}
 		}
 	}
 
+	void OnWriteFailed() {
+		{
+			lock_(_outboundMutex);
+			_isBroken = true;
+			_isWriting = false;
+			DebugMetrics::AddQueuedMessages(-static_cast<int64_t>(_outbound.size()));
+			_outbound.clear();
+		}
+
+		_outboundSpaceAvailable.NotifyAll();
+
+		if (auto* const disposable = _bytesStream->as<Disposable*>()) {
+			disposable->dispose();
+		}
+	}
+
+	struct OutboundMessage
+	{
+		std::function<void (BytesBuffer&)> writeBody;
+		DapBodyEncoding encoding;
+
+		OutboundMessage(std::function<void (BytesBuffer&)> writeBody_, DapBodyEncoding encoding_): writeBody(std::move(writeBody_)), encoding(encoding_)
+		{}
+	};
+
+	static constexpr size_t MaxQueuedMessages = 256;
+	static constexpr size_t MaxCoalescedMessages = 32;
+
 	ComPtr<Io::AsyncReader> _bytesStream;
-	HttpStream _httpStream;
+	const std::string _path;
+	std::variant<HttpStream, ContentLengthStream> _inboundStream;
+
+	std::deque<OutboundMessage> _outbound;
+	std::mutex _outboundMutex;
+	AsyncWaitList _outboundSpaceAvailable;
+	bool _isWriting = false;
+	bool _isBroken = false;
+	DapBodyEncoding _payloadEncoding = DapBodyEncoding::Json;
 };
 
 
 /* -------------------------------------------------------------------------- */
-DapMessageStream::Ptr DapMessageStream::Create(ComPtr<Io::AsyncReader> stream) {
-	return Com::createInstance<CommandsStreamImpl, DapMessageStream>(std::move(stream));
+DapMessageStream::Ptr DapMessageStream::Create(ComPtr<Io::AsyncReader> stream, DapFraming framing) {
+	return Com::createInstance<CommandsStreamImpl, DapMessageStream>(std::move(stream), framing);
+}
+
+
+DapMessageStream::Ptr DapMessageStream::CreateChannel(ComPtr<Io::AsyncReader> stream, std::string path) {
+	return Com::createInstance<CommandsStreamImpl, DapMessageStream>(std::move(stream), DapFraming::Http, std::move(path));
+}
+
+
+DapMessageStream::Ptr DapMessageStream::CreateStdio() {
+	return Create(Com::createInstance<StdioStream, Io::AsyncReader>(), DapFraming::ContentLength);
 }
 
 } // namespace Runtime::Debug
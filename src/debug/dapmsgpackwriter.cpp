@@ -0,0 +1,270 @@
+//◦ Playrix ◦
+#include "lua-toolkit/debug/dapmsgpackwriter.h"
+#include "lua-toolkit/debug/dapjsonreader.h"
+#include "lua-toolkit/debug/dapjsonwriter.h"
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace Runtime::Dap {
+
+namespace {
+
+// MessagePack format bytes.
+constexpr uint8_t Nil = 0xc0;
+constexpr uint8_t False = 0xc2;
+constexpr uint8_t True = 0xc3;
+constexpr uint8_t Float64 = 0xcb;
+constexpr uint8_t UInt8 = 0xcc;
+constexpr uint8_t UInt16 = 0xcd;
+constexpr uint8_t UInt32 = 0xce;
+constexpr uint8_t UInt64 = 0xcf;
+constexpr uint8_t Int8 = 0xd0;
+constexpr uint8_t Int16 = 0xd1;
+constexpr uint8_t Int32 = 0xd2;
+constexpr uint8_t Int64 = 0xd3;
+constexpr uint8_t Str8 = 0xd9;
+constexpr uint8_t Str16 = 0xda;
+constexpr uint8_t Str32 = 0xdb;
+constexpr uint8_t Array16 = 0xdc;
+constexpr uint8_t Array32 = 0xdd;
+constexpr uint8_t Map16 = 0xde;
+constexpr uint8_t Map32 = 0xdf;
+constexpr uint8_t FixMap = 0x80;
+constexpr uint8_t FixArray = 0x90;
+constexpr uint8_t FixStr = 0xa0;
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+MsgPackWriter::MsgPackWriter(BytesBuffer& buffer): _buffer(buffer)
+{}
+
+
+void MsgPackWriter::WriteNil() {
+	WriteRaw(&Nil, 1);
+}
+
+
+void MsgPackWriter::Write(bool value) {
+	WriteRaw(value ? &True : &False, 1);
+}
+
+
+void MsgPackWriter::Write(double value) {
+	WriteHeader(Float64, std::bit_cast<uint64_t>(value), 8);
+}
+
+
+void MsgPackWriter::Write(std::string_view value) {
+	const size_t size = value.size();
+
+	if (size < 32) {
+		const uint8_t header = FixStr | static_cast<uint8_t>(size);
+		WriteRaw(&header, 1);
+	}
+	else if (size <= std::numeric_limits<uint8_t>::max()) {
+		WriteHeader(Str8, size, 1);
+	}
+	else if (size <= std::numeric_limits<uint16_t>::max()) {
+		WriteHeader(Str16, size, 2);
+	}
+	else {
+		WriteHeader(Str32, size, 4);
+	}
+
+	WriteRaw(value.data(), size);
+}
+
+
+void MsgPackWriter::Write(const std::string& value) {
+	Write(std::string_view{value});
+}
+
+
+void MsgPackWriter::Write(const char* value) {
+	Write(std::string_view{value ? value : ""});
+}
+
+
+void MsgPackWriter::Write(const RuntimeValue::Ptr& value) {
+	if (!value) {
+		WriteNil();
+		return;
+	}
+
+	// Dynamic values are rare and small (i.e. adapter data): they are transcoded from JSON.
+	BytesBuffer json;
+	JsonWriter{json}.Write(value);
+
+	JsonReader reader{asStringView(json)};
+	WriteJsonValue(reader);
+}
+
+
+void MsgPackWriter::Write(const AnyJsonValue& value) {
+	if (!value) {
+		WriteNil();
+		return;
+	}
+
+	value.Write(*this);
+}
+
+
+void MsgPackWriter::WriteJsonValue(JsonReader& reader) {
+	switch (reader.PeekType()) {
+	case JsonReader::ValueType::Null: {
+		reader.TryReadNull();
+		WriteNil();
+		break;
+	}
+	case JsonReader::ValueType::Bool: {
+		bool value = false;
+		reader.Read(value);
+		Write(value);
+		break;
+	}
+	case JsonReader::ValueType::Number: {
+		double value = 0;
+		reader.Read(value);
+		if (std::trunc(value) == value && std::abs(value) < 0x1p63) {
+			WriteInteger(static_cast<long long>(value));
+		}
+		else {
+			Write(value);
+		}
+		break;
+	}
+	case JsonReader::ValueType::String: {
+		std::string value;
+		reader.Read(value);
+		Write(value);
+		break;
+	}
+	case JsonReader::ValueType::Array:
+	case JsonReader::ValueType::Object: {
+		// Elements count is not known up front: 32 bit header is written and patched afterward.
+		const bool isObject = reader.PeekType() == JsonReader::ValueType::Object;
+		const size_t headerOffset = _buffer.size();
+		WriteHeader(isObject ? Map32 : Array32, 0, 4);
+
+		uint32_t count = 0;
+
+		if (isObject) {
+			reader.ReadObject([&](std::string_view key) {
+				Write(key);
+				WriteJsonValue(reader);
+				++count;
+			});
+		}
+		else {
+			reader.ReadArray([&] {
+				WriteJsonValue(reader);
+				++count;
+			});
+		}
+
+		uint8_t* const countBytes = reinterpret_cast<uint8_t*>(_buffer.data()) + headerOffset + 1;
+		for (size_t i = 0; i < 4; ++i) {
+			countBytes[i] = static_cast<uint8_t>(count >> (8 * (3 - i)));
+		}
+		break;
+	}
+	}
+}
+
+
+void MsgPackWriter::WriteInteger(long long value) {
+	if (value >= 0) {
+		WriteUnsigned(static_cast<unsigned long long>(value));
+	}
+	else if (value >= -32) {
+		const uint8_t negativeFixInt = static_cast<uint8_t>(static_cast<int8_t>(value));
+		WriteRaw(&negativeFixInt, 1);
+	}
+	else if (value >= std::numeric_limits<int8_t>::min()) {
+		WriteHeader(Int8, static_cast<uint8_t>(value), 1);
+	}
+	else if (value >= std::numeric_limits<int16_t>::min()) {
+		WriteHeader(Int16, static_cast<uint16_t>(value), 2);
+	}
+	else if (value >= std::numeric_limits<int32_t>::min()) {
+		WriteHeader(Int32, static_cast<uint32_t>(value), 4);
+	}
+	else {
+		WriteHeader(Int64, static_cast<uint64_t>(value), 8);
+	}
+}
+
+
+void MsgPackWriter::WriteUnsigned(unsigned long long value) {
+	if (value < 128) {
+		const uint8_t positiveFixInt = static_cast<uint8_t>(value);
+		WriteRaw(&positiveFixInt, 1);
+	}
+	else if (value <= std::numeric_limits<uint8_t>::max()) {
+		WriteHeader(UInt8, value, 1);
+	}
+	else if (value <= std::numeric_limits<uint16_t>::max()) {
+		WriteHeader(UInt16, value, 2);
+	}
+	else if (value <= std::numeric_limits<uint32_t>::max()) {
+		WriteHeader(UInt32, value, 4);
+	}
+	else {
+		WriteHeader(UInt64, value, 8);
+	}
+}
+
+
+void MsgPackWriter::WriteArrayHeader(size_t size) {
+	if (size < 16) {
+		const uint8_t header = FixArray | static_cast<uint8_t>(size);
+		WriteRaw(&header, 1);
+	}
+	else if (size <= std::numeric_limits<uint16_t>::max()) {
+		WriteHeader(Array16, size, 2);
+	}
+	else {
+		WriteHeader(Array32, size, 4);
+	}
+}
+
+
+void MsgPackWriter::WriteMapHeader(size_t size) {
+	if (size < 16) {
+		const uint8_t header = FixMap | static_cast<uint8_t>(size);
+		WriteRaw(&header, 1);
+	}
+	else if (size <= std::numeric_limits<uint16_t>::max()) {
+		WriteHeader(Map16, size, 2);
+	}
+	else {
+		WriteHeader(Map32, size, 4);
+	}
+}
+
+
+void MsgPackWriter::WriteHeader(uint8_t type, uint64_t value, size_t valueSize) {
+	// Multi byte values are big endian.
+	std::array<uint8_t, 9> bytes;
+	bytes[0] = type;
+	for (size_t i = 0; i < valueSize; ++i) {
+		bytes[1 + i] = static_cast<uint8_t>(value >> (8 * (valueSize - 1 - i)));
+	}
+
+	WriteRaw(bytes.data(), 1 + valueSize);
+}
+
+
+void MsgPackWriter::WriteRaw(const void* data, size_t size) {
+	if (size > 0) {
+		memcpy(_buffer.append(size), data, size);
+	}
+}
+
+} // namespace Runtime::Dap
@@ -0,0 +1,195 @@
+//◦ Playrix ◦
+#include "lua-toolkit/debug/debugmetrics.h"
+#include <runtime/threading/lock.h>
+
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace Runtime::Debug {
+
+namespace {
+
+struct StopDurations
+{
+	/* Last bucket is '+Inf'. */
+	std::array<std::atomic<uint64_t>, DebugMetrics::StopDurationBuckets.size() + 1> buckets {};
+	std::atomic<uint64_t> count {0};
+	std::atomic<uint64_t> nanoseconds {0};
+
+	void Add(std::chrono::nanoseconds duration) {
+		const double seconds = std::chrono::duration<double>(duration).count();
+
+		const auto bucket = std::lower_bound(DebugMetrics::StopDurationBuckets.begin(), DebugMetrics::StopDurationBuckets.end(), seconds);
+		buckets[static_cast<size_t>(bucket - DebugMetrics::StopDurationBuckets.begin())].fetch_add(1, std::memory_order_relaxed);
+
+		count.fetch_add(1, std::memory_order_relaxed);
+		nanoseconds.fetch_add(static_cast<uint64_t>(duration.count()), std::memory_order_relaxed);
+	}
+};
+
+
+struct MetricsRegistry
+{
+	std::mutex mutex;
+	std::vector<std::weak_ptr<DebugMetrics::StateCounters>> states;
+	StopDurations stopDurations;
+
+	static MetricsRegistry& Instance() {
+		static MetricsRegistry registry;
+		return registry;
+	}
+};
+
+
+void AppendNumber(std::string& output, double value) {
+	char buffer[32];
+	const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	output.append(buffer, result.ptr);
+}
+
+
+void AppendNumber(std::string& output, uint64_t value) {
+	output += std::to_string(value);
+}
+
+
+void AppendNumber(std::string& output, int64_t value) {
+	output += std::to_string(value);
+}
+
+
+void AppendHeader(std::string& output, std::string_view name, std::string_view type, std::string_view help) {
+	output.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	output.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+
+void AppendLabelValue(std::string& output, std::string_view value) {
+	for (const char c : value) {
+		if (c == '\\' || c == '"') {
+			output.push_back('\\');
+			output.push_back(c);
+		}
+		else if (c == '\n') {
+			output.append("\\n");
+		}
+		else {
+			output.push_back(c);
+		}
+	}
+}
+
+
+template<typename T>
+void AppendStateSample(std::string& output, std::string_view name, const DebugMetrics::StateCounters& state, T value) {
+	output.append(name).append("{state=\"");
+	AppendLabelValue(output, state.name);
+	output.append("\"} ");
+	AppendNumber(output, value);
+	output.push_back('\n');
+}
+
+
+template<typename T>
+void AppendGauge(std::string& output, std::string_view name, std::string_view help, T value) {
+	AppendHeader(output, name, "gauge", help);
+	output.append(name).append(" ");
+	AppendNumber(output, value);
+	output.push_back('\n');
+}
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+std::shared_ptr<DebugMetrics::StateCounters> DebugMetrics::RegisterState(std::string name) {
+	auto state = std::make_shared<StateCounters>(std::move(name));
+
+	MetricsRegistry& registry = MetricsRegistry::Instance();
+
+	lock_(registry.mutex);
+	std::erase_if(registry.states, [](const std::weak_ptr<StateCounters>& stateRef) {
+		return stateRef.expired();
+	});
+	registry.states.emplace_back(state);
+
+	return state;
+}
+
+
+void DebugMetrics::AddStop(std::chrono::nanoseconds duration) {
+	MetricsRegistry::Instance().stopDurations.Add(duration);
+}
+
+
+std::string DebugMetrics::FormatPrometheus() {
+	MetricsRegistry& registry = MetricsRegistry::Instance();
+
+	std::vector<std::shared_ptr<StateCounters>> states;
+	{
+		lock_(registry.mutex);
+		for (const auto& stateRef : registry.states) {
+			if (auto state = stateRef.lock()) {
+				states.emplace_back(std::move(state));
+			}
+		}
+	}
+
+	std::string output;
+
+	AppendHeader(output, "lua_toolkit_hook_invocations_total", "counter", "Debug hook invocations.");
+	for (const auto& state : states) {
+		AppendStateSample(output, "lua_toolkit_hook_invocations_total", *state, state->hookInvocations.load(std::memory_order_relaxed));
+	}
+
+	AppendHeader(output, "lua_toolkit_hook_seconds_total", "counter", "Time spent in the debug hook while debugging (excluding stops), estimated from the sampled invocations.");
+	for (const auto& state : states) {
+		AppendStateSample(output, "lua_toolkit_hook_seconds_total", *state, static_cast<double>(state->hookNanoseconds.load(std::memory_order_relaxed)) / 1e9);
+	}
+
+	AppendHeader(output, "lua_toolkit_breakpoint_hits_total", "counter", "Source and function breakpoint hits.");
+	for (const auto& state : states) {
+		AppendStateSample(output, "lua_toolkit_breakpoint_hits_total", *state, state->breakpointHits.load(std::memory_order_relaxed));
+	}
+
+	AppendHeader(output, "lua_toolkit_lua_memory_bytes", "gauge", "Memory used by the lua state (sampled by the debug hook).");
+	for (const auto& state : states) {
+		AppendStateSample(output, "lua_toolkit_lua_memory_bytes", *state, state->luaMemoryBytes.load(std::memory_order_relaxed));
+	}
+
+	const StopDurations& stopDurations = registry.stopDurations;
+
+	AppendHeader(output, "lua_toolkit_stop_duration_seconds", "histogram", "Time the lua thread was stopped by the debugger.");
+	uint64_t cumulativeCount = 0;
+	for (size_t i = 0; i < stopDurations.buckets.size(); ++i) {
+		cumulativeCount += stopDurations.buckets[i].load(std::memory_order_relaxed);
+
+		output.append("lua_toolkit_stop_duration_seconds_bucket{le=\"");
+		if (i < StopDurationBuckets.size()) {
+			AppendNumber(output, StopDurationBuckets[i]);
+		}
+		else {
+			output.append("+Inf");
+		}
+		output.append("\"} ");
+		AppendNumber(output, cumulativeCount);
+		output.push_back('\n');
+	}
+
+	output.append("lua_toolkit_stop_duration_seconds_sum ");
+	AppendNumber(output, static_cast<double>(stopDurations.nanoseconds.load(std::memory_order_relaxed)) / 1e9);
+	output.append("\nlua_toolkit_stop_duration_seconds_count ");
+	AppendNumber(output, stopDurations.count.load(std::memory_order_relaxed));
+	output.push_back('\n');
+
+	AppendGauge(output, "lua_toolkit_dap_queued_messages", "Outbound DAP messages waiting to be written.", s_queuedMessages.load(std::memory_order_relaxed));
+	AppendGauge(output, "lua_toolkit_dap_pending_requests", "Read-only DAP requests in progress.", s_pendingRequests.load(std::memory_order_relaxed));
+	AppendGauge(output, "lua_toolkit_channel_queued_writes", "Multiplexed channels writes waiting to be sent.", s_queuedChannelWrites.load(std::memory_order_relaxed));
+
+	return output;
+}
+
+} // namespace Runtime::Debug
@@ -1,12 +1,19 @@
 //◦ Playrix ◦
 #include "lua-toolkit/debug/debugsession.h"
+#include "lua-toolkit/debug/debugmetrics.h"
+#include "asyncwaitlist.h"
 #include "inplaceexecutionscheduler.h"
+#include "stacktracesnapshot.h"
 
 #include <runtime/com/comclass.h>
 #include <runtime/serialization/json.h>
 #include <runtime/serialization/runtimevaluebuilder.h>
 #include <runtime/utils/strings.h>
 #include <runtime/runtime/runtime.h>
+#include <runtime/threading/lock.h>
+
+#include <mutex>
+#include <unordered_map>
 
 namespace Runtime::Debug {
 
@@ -22,24 +29,140 @@ class DebugSessionImpl final : public DebugSession
 	COMCLASS_(DebugSession)
 
 public:
-	DebugSessionImpl(DapMessageStream::Ptr commandsStream, DebugSessionController::Ptr controller): _messageStream(std::move(commandsStream)), _controller(std::move(controller))
+	DebugSessionImpl(DapMessageStream::Ptr commandsStream, DebugSessionController::Ptr controller, std::optional<StopSnapshotOptions> snapshotOptions)
+		: _messageStream(std::move(commandsStream))
+		, _controller(std::move(controller))
+		, _snapshotOptions(std::move(snapshotOptions))
 	{
 		Assert(_messageStream);
 		Assert(_controller);
 
-		// _controller->SetMessageStream(_messageStream);
+		RegisterBuiltinCommands();
 	}
 
 private:
 
+	static constexpr size_t MaxPendingRequests = 32;
+
+	/**
+		Data that IDE will request right after the stop: the stack, scopes of the top frame and the first page of its locals.
+		Collected in one pass on the lua thread, so these requests can be answered without scheduling to the stopped lua thread.
+	*/
+	struct PrefetchedState
+	{
+		static constexpr unsigned VariablesPageSize = 100;
+
+		Dap::StackTraceResponseBody stackTrace;
+		std::optional<unsigned> frameId;
+		std::vector<Dap::Scope> scopes;
+		std::optional<unsigned> variablesReference;
+		std::vector<Dap::Variable> variables;
+		bool variablesComplete = false;
+
+		std::optional<Dap::StackTraceResponseBody> GetStackTrace(const Dap::StackTraceArguments& args) const {
+			// whole stack is prefetched: any page is served.
+			return stackTrace.GetFramesPage(args);
+		}
+
+		std::optional<std::vector<Dap::Scope>> GetScopes(unsigned frameId_) const {
+			if (frameId != frameId_) {
+				return std::nullopt;
+			}
+
+			return scopes;
+		}
+
+		std::optional<std::vector<Dap::Variable>> GetVariables(const Dap::VariablesArguments& args) const {
+			if (variablesReference != args.variablesReference || !args.filter.empty() || args.start.value_or(0) != 0) {
+				return std::nullopt;
+			}
+
+			const unsigned count = args.count.value_or(0);
+
+			if (count == 0) {
+				return variablesComplete ? std::optional{variables} : std::nullopt;
+			}
+
+			if (count > variables.size() && !variablesComplete) {
+				return std::nullopt;
+			}
+
+			return std::vector<Dap::Variable>{variables.begin(), variables.begin() + std::min<size_t>(count, variables.size())};
+		}
+	};
+
+
 	struct StoppedExectionState
 	{
 		Scheduler::Ptr scheduler;
 		StackTraceProvider::Ptr stackTraceProvider;
+		// set once (by the continue request or the disconnect) under the session's stopped state mutex.
 		std::optional<ContinueExecutionMode> continueMode;
+		std::optional<PrefetchedState> prefetched;
+		std::optional<StackTraceSnapshot> snapshot;
 
 		StoppedExectionState(Scheduler::Ptr scheduler_, StackTraceProvider::Ptr stackTraceProvider_): scheduler(std::move(scheduler_)), stackTraceProvider(std::move(stackTraceProvider_))
 		{}
+
+		/**
+			Must be called on the stopped lua thread.
+		*/
+		void Prefetch() {
+			PrefetchedState& state = prefetched.emplace();
+
+			state.stackTrace = stackTraceProvider->GetStackTrace({});
+			if (state.stackTrace.stackFrames.empty()) {
+				return;
+			}
+
+			state.frameId = state.stackTrace.stackFrames.front().id;
+			state.scopes = stackTraceProvider->GetScopes(*state.frameId);
+			if (state.scopes.empty()) {
+				return;
+			}
+
+			Dap::VariablesArguments args;
+			args.variablesReference = state.scopes.front().variablesReference;
+			args.count = PrefetchedState::VariablesPageSize;
+
+			state.variablesReference = args.variablesReference;
+			state.variables = stackTraceProvider->GetVariables(args);
+			state.variablesComplete = state.variables.size() < PrefetchedState::VariablesPageSize;
+		}
+
+		/**
+			Must be called on the stopped lua thread.
+		*/
+		void TakeSnapshot(const StopSnapshotOptions& options) {
+			snapshot.emplace(*stackTraceProvider, options);
+		}
+
+		std::optional<Dap::StackTraceResponseBody> GetCachedStackTrace(const Dap::StackTraceArguments& args) const {
+			return
+				snapshot ? snapshot->GetStackTrace(args) :
+				prefetched ? prefetched->GetStackTrace(args) :
+				std::nullopt;
+		}
+
+		std::optional<std::vector<Dap::Scope>> GetCachedScopes(unsigned frameId) const {
+			if (snapshot) {
+				if (auto scopes = snapshot->GetScopes(frameId)) {
+					return scopes;
+				}
+			}
+
+			return prefetched ? prefetched->GetScopes(frameId) : std::nullopt;
+		}
+
+		std::optional<std::vector<Dap::Variable>> GetCachedVariables(const Dap::VariablesArguments& args) const {
+			if (snapshot) {
+				if (auto variables = snapshot->GetVariables(args)) {
+					return variables;
+				}
+			}
+
+			return prefetched ? prefetched->GetVariables(args) : std::nullopt;
+		}
 	};
 
 
@@ -50,161 +173,459 @@ private:
 		co_await RuntimeCore::instance().poolScheduler();
 
 		do {
-			const ReadonlyDynamicObject message {co_await _messageStream->GetDapMessage()};
+			const std::optional<Dap::InboundMessage> message = co_await _messageStream->GetDapMessage();
 
 			if (!message) {
 				break;
 			}
 
-			const std::string messageType = message.Get<std::string>("type");
+			if (message->type == Dap::ProtocolMessage::MessageRequest) {
 
-			if (messageType == Dap::ProtocolMessage::MessageRequest) {
+				Dap::RequestMessage request;
+				request.seq = message->seq;
+				request.command = message->command;
 
-				auto request = RuntimeValueCast<Dap::RequestMessage>(message);
-
-				Dap::GenericResponseMessage<> response(NextSeqId(), request);
+				const DapCommandHandler* const command = FindCommand(request.command);
+				if (!command) {
+					// not handled requests (i.e. the ones the adapter answers itself) are acknowledged with the empty response.
+					co_await SendResponse(std::move(request), std::nullopt);
+					continue;
+				}
 
-				try
-				{
-					if (Strings::icaseEqual(request.command, "launch"))
-					{
-						co_await _controller->ConfigureLaunch(request.arguments);
+				// Read-only requests are answered as they complete (IDE matches responses by request_seq),
+				// all other requests are handled in order, after all the requests before them are completed.
+				if (!command->readOnly) {
+					// requests that wait for the debugged code (i.e. hot patch) must not hold the disconnect.
+					if (Strings::icaseEqual(request.command, "disconnect")) {
+						_controller->CancelPendingRequests();
+						co_await CompleteExecutionRequests();
 					}
-					else if (Strings::icaseEqual(request.command, "attach"))
-					{
-						co_await _controller->ConfigureAttach(request.arguments);
-					}
-					else if (Strings::icaseEqual(request.command, "configurationDone"))
+
+					co_await CompletePendingRequests();
+				}
+				else if (_pendingRequests.size() >= MaxPendingRequests) {
+					co_await CompletePendingRequests();
+				}
+
+				std::optional<DapCommandHandler::BoundRequest> boundRequest;
+				std::optional<std::string> error;
+
+				try {
+					// arguments are parsed before the next message is read: message's raw arguments are not valid after that.
+					boundRequest = command->bind(*message);
+				}
+				catch (const std::exception& exception) {
+					_isClosed = true;
+					error = exception.what();
+				}
+
+				if (error) {
+					co_await SendResponse(std::move(request), std::move(error));
+					continue;
+				}
+
+				const DapBodyEncoding encoding = command->largePayload ? _messageStream->GetPayloadEncoding() : DapBodyEncoding::Json;
+				Task<> requestTask = HandleRequest(std::move(request), std::move(*boundRequest), encoding);
+
+				if (command->readOnly) {
+					_pendingRequests.emplace_back(std::move(requestTask));
+					DebugMetrics::AddPendingRequests(1);
+				}
+				else if (command->awaitsExecution) {
 					{
-						co_await _controller->ConfigurationDone();
+						lock_(_executionRequestsMutex);
+						++_executionRequests;
 					}
-					else if (Strings::icaseEqual(request.command, "disconnect"))
-					{
-						_isClosed = true;
 
-						if (_stoppedState) {
-							_stoppedState->continueMode = ContinueExecutionMode::Stopped;
-							_stoppedState->scheduler->as<Disposable&>().dispose();
-						}
+					AwaitExecutionRequest(std::move(requestTask)).detach();
+				}
+				else {
+					co_await std::move(requestTask);
 
-						co_await _controller->Disconnect();
+					// IDE sends the configuration requests after the 'initialized' event, that must follow the 'initialize' response.
+					if (std::exchange(_isInitializedEventPending, false)) {
+						co_await _messageStream->SendDapMessage(Dap::EventMessage(NextSeqId(), "initialized"));
 					}
-					else if (Strings::icaseEqual(request.command, "setBreakpoints"))
-					{
-						auto args = RuntimeValueCast<Dap::SetBreakpointsArguments>(request.arguments);
+				}
+			}
+			else {
+			}
+		}
+		while (!_isClosed);
 
-						Dap::SetBreakpointsResponseBody body;
-						body.breakpoints = co_await _controller->SetBreakpoints(std::move(args));
-						response.body = runtimeValueCopy(std::move(body));
-					}
-					else if (Strings::icaseEqual(request.command, "setFunctionBreakpoints"))
-					{
-						auto args = RuntimeValueCast<Dap::SetFunctionBreakpointsArguments>(request.arguments);
+		_controller->CancelPendingRequests();
+		co_await CompletePendingRequests();
+		co_await CompleteExecutionRequests();
 
-						Dap::SetBreakpointsResponseBody body;
-						body.breakpoints = co_await _controller->SetFunctionBreakpoints(std::move(args));
-						response.body = runtimeValueCopy(std::move(body));
-					}
-					else if (Strings::icaseEqual(request.command, "threads"))
-					{
-						Dap::ThreadsResponseBody body;
-						body.threads = co_await _controller->GetThreads();
-						response.body = runtimeValueCopy(std::move(body));
-					}
-					else if (Strings::icaseEqual(request.command, "stackTrace"))
-					{
-						Assert(_stoppedState);
+		// connection can be lost without 'disconnect' request: stopped lua thread must not stay frozen.
+		co_await Disconnect();
+	}
 
-						auto args = RuntimeValueCast<Dap::StackTraceArguments>(request.arguments);
+	Task<> Close() override {
+		return Disconnect();
+	}
 
-						auto stack = co_await Async::run([](StackTraceProvider& stackTraceProvider, Dap::StackTraceArguments args) -> Dap::StackTraceResponseBody {
+	Task<> SendHeartbeat() override {
+		if (_isClosed) {
+			return Task<>::makeResolved();
+		}
 
-							return stackTraceProvider.GetStackTrace(args);
+		return _messageStream->SendDapMessage(Dap::EventMessage(NextSeqId(), "heartbeat"));
+	}
 
-						}, _stoppedState->scheduler, std::ref(*_stoppedState->stackTraceProvider), std::move(args));
+	void RegisterCommand(std::string_view command, DapCommandHandler handler) override {
+		Assert(handler.bind);
 
-						response.body = runtimeValueCopy(std::move(stack));
-					}
-					else if (Strings::icaseEqual(request.command, "scopes"))
-					{
-						Assert(_stoppedState);
+		const auto [iter, emplaced] = _commands.try_emplace(GetCommandHash(command), std::string{command}, std::move(handler));
+		if (!emplaced) {
+			Assert(Strings::icaseEqual(iter->second.first, command));
+			iter->second.second = std::move(handler);
+		}
+	}
 
-						const auto args = RuntimeValueCast<Dap::ScopesArguments>(request.arguments);
+	const DapCommandHandler* FindCommand(std::string_view command) const {
+		const auto iter = _commands.find(GetCommandHash(command));
+		if (iter == _commands.end() || !Strings::icaseEqual(iter->second.first, command)) {
+			return nullptr;
+		}
 
-						Dap::ScopesResponseBody body;
+		return &iter->second.second;
+	}
 
-						body.scopes = co_await Async::run([](StackTraceProvider& stackTraceProvider, unsigned frameId) -> std::vector<Dap::Scope> {
+	/**
+		Case insensitive FNV-1a hash of the command name.
+	*/
+	static constexpr uint64_t GetCommandHash(std::string_view command) {
+		uint64_t hash = 14695981039346656037ull;
+		for (const char c : command) {
+			hash ^= static_cast<uint64_t>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+			hash *= 1099511628211ull;
+		}
 
-							return stackTraceProvider.GetScopes(frameId);
+		return hash;
+	}
 
-						}, _stoppedState->scheduler, std::ref(*_stoppedState->stackTraceProvider), args.frameId);
+	void RegisterBuiltinCommands() {
+		RegisterCommand("initialize", DapCommandHandler::Create<void>([this] {
+			return Initialize();
+		}));
+
+		RegisterCommand("launch", DapCommandHandler::Create<RuntimeValue::Ptr>([this](RuntimeValue::Ptr args) {
+			return _controller->ConfigureLaunch(std::move(args));
+		}));
+
+		RegisterCommand("attach", DapCommandHandler::Create<RuntimeValue::Ptr>([this](RuntimeValue::Ptr args) {
+			return _controller->ConfigureAttach(std::move(args));
+		}));
+
+		RegisterCommand("configurationDone", DapCommandHandler::Create<void>([this] {
+			return _controller->ConfigurationDone();
+		}));
+
+		RegisterCommand("disconnect", DapCommandHandler::Create<void>([this] {
+			return Disconnect();
+		}));
+
+		RegisterCommand("setBreakpoints", DapCommandHandler::Create<Dap::SetBreakpointsArguments>([this](Dap::SetBreakpointsArguments args) {
+			return SetBreakpoints(std::move(args));
+		}));
+
+		RegisterCommand("setFunctionBreakpoints", DapCommandHandler::Create<Dap::SetFunctionBreakpointsArguments>([this](Dap::SetFunctionBreakpointsArguments args) {
+			return SetFunctionBreakpoints(std::move(args));
+		}));
+
+		RegisterCommand("setExceptionBreakpoints", DapCommandHandler::Create<Dap::SetExceptionBreakpointsArguments>([this](Dap::SetExceptionBreakpointsArguments args) {
+			return _controller->SetExceptionBreakpoints(std::move(args));
+		}));
+
+		RegisterCommand("exceptionInfo", DapCommandHandler::Create<Dap::ExceptionInfoArguments>([this](Dap::ExceptionInfoArguments args) {
+			return _controller->GetExceptionInfo(args);
+		}, true));
+
+		RegisterCommand("threads", DapCommandHandler::Create<void>([this] {
+			return GetThreads();
+		}, true));
+
+		DapCommandHandler stackTrace = DapCommandHandler::Create<Dap::StackTraceArguments>([this](Dap::StackTraceArguments args) {
+			return GetStackTrace(std::move(args));
+		}, true);
+		stackTrace.largePayload = true;
+		RegisterCommand("stackTrace", std::move(stackTrace));
+
+		RegisterCommand("scopes", DapCommandHandler::Create<Dap::ScopesArguments>([this](Dap::ScopesArguments args) {
+			return GetScopes(args);
+		}, true));
+
+		DapCommandHandler variables = DapCommandHandler::Create<Dap::VariablesArguments>([this](Dap::VariablesArguments args) {
+			return GetVariables(std::move(args));
+		}, true);
+		variables.largePayload = true;
+		RegisterCommand("variables", std::move(variables));
+
+		RegisterCommand("evaluate", DapCommandHandler::CreateOnStoppedThread<Dap::EvaluateArguments>([](StackTraceProvider& stackTraceProvider, const Dap::EvaluateArguments& args) {
+			// Evaluation errors are expected (i.e. invalid watch expression) and must not close the session.
+			try {
+				return stackTraceProvider.Evaluate(args);
+			}
+			catch (const std::exception& exception) {
+				throw DapRequestError(exception.what());
+			}
+		}));
 
-						response.body = runtimeValueCopy(std::move(body));
-					}
-					else if (Strings::icaseEqual(request.command, "variables"))
-					{
-						Assert(_stoppedState);
+		RegisterCommand("pause", DapCommandHandler::Create<void>([] {
+			return Task<>::makeResolved();
+		}));
 
-						const auto args = RuntimeValueCast<Dap::VariablesArguments>(request.arguments);
+		// reply of the client to the 'heartbeat' event: its arrival keeps the connection alive (see RemoteController::SessionTimeouts).
+		RegisterCommand("heartbeat", DapCommandHandler::Create<void>([] {
+			return Task<>::makeResolved();
+		}, true));
 
-						Dap::VariablesResponseBody body;
+		RegisterContinueCommand("continue", ContinueExecutionMode::Continue);
+		RegisterContinueCommand("next", ContinueExecutionMode::Step);
+		RegisterContinueCommand("stepIn", ContinueExecutionMode::StepIn);
+		RegisterContinueCommand("stepOut", ContinueExecutionMode::StepOut);
+	}
 
-						body.variables = co_await Async::run([](StackTraceProvider& stackTraceProvider, Dap::VariablesArguments args) -> std::vector<Dap::Variable> {
+	void RegisterContinueCommand(std::string_view command, ContinueExecutionMode continueMode) {
+		RegisterCommand(command, DapCommandHandler::Create<void>([this, continueMode] {
+			if (!EndStoppedExecution(continueMode)) {
+				throw DapRequestError("Execution is not stopped");
+			}
 
-							return stackTraceProvider.GetVariables(args);
+			return Task<>::makeResolved();
+		}));
+	}
 
-						}, _stoppedState->scheduler, std::ref(*_stoppedState->stackTraceProvider), args);
+	/**
+		Sets the continue mode of the current stop and releases the stopped thread.
+		Returns false when execution is not stopped or the stop is already ended (i.e. 'continue' is followed by the disconnect).
+	*/
+	bool EndStoppedExecution(ContinueExecutionMode continueMode) {
+		lock_(_stoppedStateMutex);
+		return EndStoppedExecutionLocked(continueMode);
+	}
 
-						response.body = runtimeValueCopy(std::move(body));
-					}
-					else if (Strings::icaseEqual(request.command, "pause"))
-					{
+	bool EndStoppedExecutionLocked(ContinueExecutionMode continueMode) {
+		if (!_stoppedState || _stoppedState->continueMode) {
+			return false;
+		}
 
-					}
-					else if (Strings::icaseEqual(request.command, "continue"))
-					{
-						Assert(_stoppedState);
-						Assert(!_stoppedState->continueMode);
+		_stoppedState->continueMode = continueMode;
+		_stoppedState->scheduler->as<Disposable&>().dispose();
 
-						_stoppedState->continueMode = ContinueExecutionMode::Continue;
-						_stoppedState->scheduler->as<Disposable&>().dispose();
-					}
-					else if (Strings::icaseEqual(request.command, "next"))
-					{
-						Assert(_stoppedState);
-						Assert(!_stoppedState->continueMode);
+		return true;
+	}
 
-						_stoppedState->continueMode = ContinueExecutionMode::Step;
-						_stoppedState->scheduler->as<Disposable&>().dispose();
-					}
-					else if (Strings::icaseEqual(request.command, "stepIn"))
-					{
-						Assert(_stoppedState);
-						Assert(!_stoppedState->continueMode);
+	/**
+		Stopped state is published by the lua thread and read by the requests (and the host's Close) on the other threads:
+		requests keep their own reference, so the state outlives the stop while the request is completing.
+	*/
+	std::shared_ptr<StoppedExectionState> GetStoppedState() const {
+		lock_(_stoppedStateMutex);
+		return _stoppedState;
+	}
 
-						_stoppedState->continueMode = ContinueExecutionMode::StepIn;
-						_stoppedState->scheduler->as<Disposable&>().dispose();
-					}
-					else if (Strings::icaseEqual(request.command, "stepOut"))
-					{
-						Assert(_stoppedState);
-						Assert(!_stoppedState->continueMode);
+	std::shared_ptr<StoppedExectionState> GetStoppedStateOrThrow() const {
+		std::shared_ptr<StoppedExectionState> stoppedState = GetStoppedState();
+		if (!stoppedState) {
+			throw DapRequestError("Request can be handled only while execution is stopped");
+		}
 
-						_stoppedState->continueMode = ContinueExecutionMode::StepOut;
-						_stoppedState->scheduler->as<Disposable&>().dispose();
-					}
-				}
-				catch (const std::exception& exception) {
-					_isClosed = true;
-					response.SetError(exception.what());
-				}
+		return stoppedState;
+	}
 
-				co_await _messageStream->SendDapMessage(runtimeValueRef(response));
-			}
-			else {
+	Task<> HandleRequest(Dap::RequestMessage request, DapCommandHandler::BoundRequest boundRequest, DapBodyEncoding encoding) {
+		std::optional<std::string> error;
+		Dap::AnyJsonValue body;
+
+		try {
+			body = co_await InvokeRequest(std::move(boundRequest));
+		}
+		catch (const DapRequestError& exception) {
+			error = exception.what();
+		}
+		catch (const std::exception& exception) {
+			_isClosed = true;
+			error = exception.what();
+		}
+
+		co_await SendResponse(std::move(request), std::move(error), std::move(body), encoding);
+	}
+
+	Task<Dap::AnyJsonValue> InvokeRequest(DapCommandHandler::BoundRequest boundRequest) {
+		if (auto* const invocation = std::get_if<DapCommandHandler::Invocation>(&boundRequest)) {
+			co_return co_await (*invocation)();
+		}
+
+		// the stopped lua thread is occupied only by the invocation, not by its preparation.
+		if (auto* const preparation = std::get_if<DapCommandHandler::StoppedThreadPreparation>(&boundRequest)) {
+			DapCommandHandler::StoppedThreadInvocation invocation = co_await (*preparation)();
+			boundRequest = std::move(invocation);
+		}
+
+		const std::shared_ptr<StoppedExectionState> stoppedState = GetStoppedStateOrThrow();
+
+		co_return co_await Async::run([](StackTraceProvider& stackTraceProvider, DapCommandHandler::StoppedThreadInvocation invocation) -> Dap::AnyJsonValue {
+
+			return invocation(stackTraceProvider);
+
+		}, stoppedState->scheduler, std::ref(*stoppedState->stackTraceProvider), std::get<DapCommandHandler::StoppedThreadInvocation>(std::move(boundRequest)));
+	}
+
+	Task<> SendResponse(Dap::RequestMessage request, std::optional<std::string> error, Dap::AnyJsonValue body = {}, DapBodyEncoding encoding = DapBodyEncoding::Json) {
+		Dap::GenericResponseMessage<Dap::AnyJsonValue> response(NextSeqId(), request);
+		if (error) {
+			response.SetError(*error);
+		}
+		else {
+			response.body = std::move(body);
+		}
+
+		co_await _messageStream->SendDapMessage(std::move(response), encoding);
+	}
+
+	/**
+		Request that waits for the debugged code runs detached: the session ends only after all of them are completed.
+	*/
+	Task<> AwaitExecutionRequest(Task<> requestTask) {
+		co_await std::move(requestTask);
+
+		{
+			lock_(_executionRequestsMutex);
+			--_executionRequests;
+		}
+
+		_executionRequestsCompleted.NotifyAll();
+	}
+
+	Task<> CompleteExecutionRequests() {
+		bool isSuspended = false;
+
+		{
+			std::unique_lock lock{_executionRequestsMutex};
+
+			while (_executionRequests > 0) {
+				co_await _executionRequestsCompleted.Wait(lock);
+				isSuspended = true;
+				lock = std::unique_lock{_executionRequestsMutex};
 			}
 		}
-		while (!_isClosed);
+
+		// resumed by the thread that completed the last request.
+		if (isSuspended) {
+			co_await RuntimeCore::instance().poolScheduler();
+		}
+	}
+
+	Task<> CompletePendingRequests() {
+		auto pendingRequests = std::move(_pendingRequests);
+		_pendingRequests.clear();
+
+		for (auto& request : pendingRequests) {
+			co_await std::move(request);
+			DebugMetrics::AddPendingRequests(-1);
+		}
+	}
+
+	Task<> Disconnect() {
+		_isClosed = true;
+
+		if (_isDisconnected.exchange(true)) {
+			co_return;
+		}
+
+		// Close can be called by the host thread: the stop that is begun after this point is ended by BeginStop itself.
+		EndStoppedExecution(ContinueExecutionMode::Stopped);
+
+		co_await _controller->Disconnect();
+	}
+
+	/**
+		Reports the session capabilities. The 'initialized' event is sent only when the IDE is connected directly (Content-Length framing):
+		the adapter of the legacy framing sends it itself.
+	*/
+	Task<Dap::Capabilities> Initialize() {
+		Dap::Capabilities capabilities;
+		capabilities.exceptionBreakpointFilters = _controller->GetExceptionBreakpointFilters();
+		capabilities.supportsExceptionInfoRequest = !capabilities.exceptionBreakpointFilters.empty();
+
+		_isInitializedEventPending = _messageStream->GetFraming() == DapFraming::ContentLength;
+
+		return Task<Dap::Capabilities>::makeResolved(std::move(capabilities));
+	}
+
+	Task<Dap::SetBreakpointsResponseBody> SetBreakpoints(Dap::SetBreakpointsArguments args) {
+		Dap::SetBreakpointsResponseBody body;
+		body.breakpoints = co_await _controller->SetBreakpoints(std::move(args));
+
+		co_return body;
+	}
+
+	Task<Dap::SetBreakpointsResponseBody> SetFunctionBreakpoints(Dap::SetFunctionBreakpointsArguments args) {
+		Dap::SetBreakpointsResponseBody body;
+		body.breakpoints = co_await _controller->SetFunctionBreakpoints(std::move(args));
+
+		co_return body;
+	}
+
+	Task<Dap::ThreadsResponseBody> GetThreads() {
+		Dap::ThreadsResponseBody body;
+		body.threads = co_await _controller->GetThreads();
+
+		co_return body;
+	}
+
+	Task<Dap::StackTraceResponseBody> GetStackTrace(Dap::StackTraceArguments args) {
+		const std::shared_ptr<StoppedExectionState> stoppedState = GetStoppedStateOrThrow();
+
+		if (auto stack = stoppedState->GetCachedStackTrace(args)) {
+			co_return std::move(*stack);
+		}
+
+		co_return co_await Async::run([](StackTraceProvider& stackTraceProvider, Dap::StackTraceArguments args) -> Dap::StackTraceResponseBody {
+
+			return stackTraceProvider.GetStackTrace(args);
+
+		}, stoppedState->scheduler, std::ref(*stoppedState->stackTraceProvider), std::move(args));
+	}
+
+	Task<Dap::ScopesResponseBody> GetScopes(Dap::ScopesArguments args) {
+		const std::shared_ptr<StoppedExectionState> stoppedState = GetStoppedStateOrThrow();
+
+		Dap::ScopesResponseBody body;
+
+		if (auto scopes = stoppedState->GetCachedScopes(args.frameId); scopes) {
+			body.scopes = std::move(*scopes);
+		}
+		else {
+			body.scopes = co_await Async::run([](StackTraceProvider& stackTraceProvider, unsigned frameId) -> std::vector<Dap::Scope> {
+
+				return stackTraceProvider.GetScopes(frameId);
+
+			}, stoppedState->scheduler, std::ref(*stoppedState->stackTraceProvider), args.frameId);
+		}
+
+		co_return body;
+	}
+
+	Task<Dap::VariablesResponseBody> GetVariables(Dap::VariablesArguments args) {
+		const std::shared_ptr<StoppedExectionState> stoppedState = GetStoppedStateOrThrow();
+
+		Dap::VariablesResponseBody body;
+
+		if (auto variables = stoppedState->GetCachedVariables(args); variables) {
+			body.variables = std::move(*variables);
+		}
+		else {
+			body.variables = co_await Async::run([](StackTraceProvider& stackTraceProvider, Dap::VariablesArguments args) -> std::vector<Dap::Variable> {
+
+				return stackTraceProvider.GetVariables(args);
+
+			}, stoppedState->scheduler, std::ref(*stoppedState->stackTraceProvider), args);
+		}
+
+		co_return body;
 	}
 
 	bool PauseIsRequested() const override {
@@ -219,27 +640,86 @@ private:
 
 
 	ContinueExecutionMode StopExecution(Dap::StoppedEventBody ev, StackTraceProvider::Ptr stackTraceProvider) override {
-		SCOPE_Leave {
-			_stoppedState.reset();
-		};
+		auto scheduler = BeginStop(std::move(ev), std::move(stackTraceProvider));
+		scheduler->Execute();
+
+		return EndStop();
+	}
+
+	void BeginStopExecution(Dap::StoppedEventBody ev, StackTraceProvider::Ptr stackTraceProvider) override {
+		Assert(!_pollingScheduler);
+
+		_pollingScheduler = BeginStop(std::move(ev), std::move(stackTraceProvider));
+	}
 
-		Assert(!_stoppedState);
+	std::optional<ContinueExecutionMode> PollStoppedExecution() override {
+		Assert(_pollingScheduler);
+
+		if (_pollingScheduler->ExecutePending()) {
+			return std::nullopt;
+		}
+
+		_pollingScheduler = nullptr;
+
+		return EndStop();
+	}
+
+	/**
+		Creates the stopped state and sends the 'stopped' event: requests of the stopped state are executed by the returned scheduler.
+	*/
+	ComPtr<Async::InplaceExecutionScheduler> BeginStop(Dap::StoppedEventBody ev, StackTraceProvider::Ptr stackTraceProvider) {
 		Assert(stackTraceProvider);
 
 		auto scheduler = Com::createInstance<Async::InplaceExecutionScheduler>();
 
-		_stoppedState.emplace(scheduler, std::move(stackTraceProvider));
+		// cached part is filled before the state is published: requests only read it.
+		auto stoppedState = std::make_shared<StoppedExectionState>(scheduler, std::move(stackTraceProvider));
+
+		// called by the debug hook that must not throw: failed cache is dropped, requests are served by the stopped thread.
+		try {
+			if (_snapshotOptions) {
+				stoppedState->TakeSnapshot(*_snapshotOptions);
+			}
+			else {
+				stoppedState->Prefetch();
+			}
+		}
+		catch (const std::exception& exception) {
+			LOG_WARN("Stopped state is not cached, requests are served on demand: {}", exception.what());
+			stoppedState->snapshot.reset();
+			stoppedState->prefetched.reset();
+		}
+
+		{
+			lock_(_stoppedStateMutex);
+			Assert(!_stoppedState);
+			_stoppedState = std::move(stoppedState);
+
+			// session is closed (i.e. by the host) before the stop: the thread is not frozen.
+			if (_isDisconnected) {
+				EndStoppedExecutionLocked(ContinueExecutionMode::Stopped);
+			}
+		}
 
 		Dap::GenericEventMessage<Dap::StoppedEventBody> eventMessage(NextSeqId(), "stopped");
 		eventMessage.body = std::move(ev);
 
-		_messageStream->SendDapMessage(runtimeValueCopy(std::move(eventMessage))).detach();
+		_messageStream->SendDapMessage(std::move(eventMessage)).detach();
 
-		scheduler->Execute();
+		return scheduler;
+	}
 
+	/**
+		Takes the continue mode of the ended stop and removes the stopped state (called on the stopped lua thread).
+	*/
+	ContinueExecutionMode EndStop() {
+		lock_(_stoppedStateMutex);
 		Assert(_stoppedState && _stoppedState->continueMode);
 
-		return *_stoppedState->continueMode;
+		const ContinueExecutionMode continueMode = *_stoppedState->continueMode;
+		_stoppedState.reset();
+
+		return continueMode;
 	}
 
 	unsigned NextSeqId() {
@@ -249,16 +729,29 @@ private:
 
 	DapMessageStream::Ptr _messageStream;
 	DebugSessionController::Ptr _controller;
+	const std::optional<StopSnapshotOptions> _snapshotOptions;
 	std::atomic<unsigned> _seqId{1ui32};
-	bool _isClosed = false;
-
-	std::optional<StoppedExectionState> _stoppedState;
+	std::atomic<bool> _isClosed = false;
+	std::atomic<bool> _isDisconnected = false;
+	// 'initialized' event is sent after the 'initialize' response (accessed only by the session task).
+	bool _isInitializedEventPending = false;
+	std::vector<Task<>> _pendingRequests;
+	// detached requests that wait for the debugged code.
+	std::mutex _executionRequestsMutex;
+	size_t _executionRequests = 0;
+	AsyncWaitList _executionRequestsCompleted;
+	std::unordered_map<uint64_t, std::pair<std::string, DapCommandHandler>> _commands;
+
+	mutable std::mutex _stoppedStateMutex;
+	std::shared_ptr<StoppedExectionState> _stoppedState;
+	// scheduler of the cooperative stop (accessed only by the lua thread).
+	ComPtr<Async::InplaceExecutionScheduler> _pollingScheduler;
 };
 
 
 /* -------------------------------------------------------------------------- */
-DebugSession::Ptr DebugSession::Create(DapMessageStream::Ptr commandsStream, DebugSessionController::Ptr controller) {
-	return Com::createInstance<DebugSessionImpl, DebugSession>(std::move(commandsStream), std::move(controller));
+DebugSession::Ptr DebugSession::Create(DapMessageStream::Ptr commandsStream, DebugSessionController::Ptr controller, std::optional<StopSnapshotOptions> snapshotOptions) {
+	return Com::createInstance<DebugSessionImpl, DebugSession>(std::move(commandsStream), std::move(controller), std::move(snapshotOptions));
 }
 
 }
@@ -2,18 +2,35 @@
 #include "inplaceexecutionscheduler.h"
 #include <runtime/threading/lock.h>
 
+#include <thread>
+
 
 namespace Runtime::Async {
 
 
 InplaceExecutionScheduler::InplaceExecutionScheduler()
-{}
+{
+	static_assert((RingCapacity & (RingCapacity - 1)) == 0, "Ring capacity must be power of two");
+
+	for (size_t i = 0; i < RingCapacity; ++i) {
+		_ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
 
 
 void InplaceExecutionScheduler::scheduleInvocation(Invocation invocation) noexcept {
-	lock_(_mutex);
-	_invocations.emplace_back(std::move(invocation));
-	_signal.set();
+	// once overflowed, invocations go to the overflow until it is taken: order of the single producer is kept.
+	if (_hasOverflow.load(std::memory_order_acquire) || !TryPush(invocation)) {
+		lock_(_overflowMutex);
+		_overflow.emplace_back(std::move(invocation));
+		_hasOverflow.store(true, std::memory_order_release);
+	}
+
+	// pairs with the fence in Wait: either the executing thread sees the invocation, or the producer sees it parked.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_isParked.load(std::memory_order_relaxed)) {
+		_signal.set();
+	}
 }
 
 
@@ -22,37 +39,137 @@ void InplaceExecutionScheduler::waitAnyActivity() noexcept {
 
 
 void InplaceExecutionScheduler::dispose() {
-	lock_(_mutex);
-	_isClosed = true;
+	_isClosed.store(true, std::memory_order_seq_cst);
 	_signal.set();
 }
 
 
-void InplaceExecutionScheduler::Execute() {
-
-	const auto getExecutionState = [this]() -> std::tuple<bool, decltype(this->_invocations) > {
-		lock_(_mutex);
-		return {!_isClosed, std::move(_invocations) };
-	};
+bool InplaceExecutionScheduler::TryPush(Invocation& invocation) noexcept {
+	size_t position = _pushPosition.load(std::memory_order_relaxed);
 
 	while (true) {
+		Slot& slot = _ring[position & (RingCapacity - 1)];
+		const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+		const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+		if (difference == 0) {
+			if (_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				slot.invocation.emplace(std::move(invocation));
+				slot.sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0) {
+			// ring is full.
+			return false;
+		}
+		else {
+			position = _pushPosition.load(std::memory_order_relaxed);
+		}
+	}
+}
 
-		auto [continueExecution, invocations] = getExecutionState();
 
-		if (!invocations.empty()) {
+std::optional<Invocation> InplaceExecutionScheduler::TryPop() noexcept {
+	Slot& slot = _ring[_popPosition & (RingCapacity - 1)];
 
-			const InvocationGuard guard{*this};
+	if (slot.sequence.load(std::memory_order_acquire) != _popPosition + 1) {
+		return std::nullopt;
+	}
 
-			for (auto& invocation : invocations) {
-				Scheduler::invoke(*this, std::move(invocation));
-			}
+	std::optional<Invocation> invocation = std::move(slot.invocation);
+	slot.invocation.reset();
+	slot.sequence.store(_popPosition + RingCapacity, std::memory_order_release);
+	++_popPosition;
+
+	return invocation;
+}
+
+
+bool InplaceExecutionScheduler::HasInvocations() const noexcept {
+	const Slot& slot = _ring[_popPosition & (RingCapacity - 1)];
+	return slot.sequence.load(std::memory_order_acquire) == _popPosition + 1 || _hasOverflow.load(std::memory_order_acquire);
+}
+
+
+bool InplaceExecutionScheduler::ExecuteInvocations() {
+	std::optional<InvocationGuard> guard;
+
+	while (std::optional<Invocation> invocation = TryPop()) {
+		if (!guard) {
+			guard.emplace(*this);
 		}
-		else if (!continueExecution) {
-			break;
+
+		Scheduler::invoke(*this, std::move(*invocation));
+	}
+
+	if (_hasOverflow.load(std::memory_order_acquire)) {
+		{
+			// batch vector is reused: its capacity is kept between the overflows.
+			lock_(_overflowMutex);
+			std::swap(_overflow, _overflowBatch);
+			_hasOverflow.store(false, std::memory_order_release);
+		}
+
+		if (!guard) {
+			guard.emplace(*this);
 		}
 
+		for (auto& invocation : _overflowBatch) {
+			Scheduler::invoke(*this, std::move(invocation));
+		}
+
+		_overflowBatch.clear();
+	}
+
+	return guard.has_value();
+}
+
+
+void InplaceExecutionScheduler::Wait() {
+	// the next request usually follows the response (i.e. stackTrace, scopes, variables): spin before parking.
+	for (unsigned i = 0; i < SpinIterations; ++i) {
+		if (HasInvocations() || _isClosed.load(std::memory_order_acquire)) {
+			return;
+		}
+
+		std::this_thread::yield();
+	}
+
+	_isParked.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (!HasInvocations() && !_isClosed.load(std::memory_order_acquire)) {
 		_signal.wait();
 	}
+
+	_isParked.store(false, std::memory_order_relaxed);
+}
+
+
+bool InplaceExecutionScheduler::ExecutePending() {
+	const bool isClosed = _isClosed.load(std::memory_order_acquire);
+
+	return ExecuteInvocations() || !isClosed;
+}
+
+
+void InplaceExecutionScheduler::Execute() {
+
+	while (true) {
+
+		const bool isClosed = _isClosed.load(std::memory_order_acquire);
+
+		if (ExecuteInvocations()) {
+			continue;
+		}
+
+		if (isClosed) {
+			break;
+		}
+
+		Wait();
+	}
 }
 
 } // namespace Runtime::Asyncs
@@ -4,9 +4,21 @@
 #include <runtime/utils/disposable.h>
 #include <runtime/com/comclass.h>
 
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <vector>
+
 
 namespace Runtime::Async {
 
+/**
+	Executes invocations on the thread that calls Execute (the stopped lua thread) until disposed.
+	Invocations are passed through the bounded lock-free MPSC ring: scheduling does not lock and does not allocate,
+	the ring overflow (unlikely: invocations are inspection requests) goes to the locked vector.
+	Execute spins a while before parking on the event, producers signal the event only when the executing thread is parked.
+*/
 class InplaceExecutionScheduler final : public Async::Scheduler, public Disposable
 {
 	COMCLASS_(Async::Scheduler, Disposable)
@@ -17,22 +29,62 @@ public:
 
 	void Execute();
 
+	/**
+		Executes the scheduled invocations without waiting for the new ones.
+		Returns false when the scheduler is disposed (and there is nothing left to execute).
+	*/
+	bool ExecutePending();
+
 private:
 
+	static constexpr size_t RingCapacity = 256;
+	static constexpr unsigned SpinIterations = 256;
+
+	/**
+		Slot is writable by the producer when sequence == position, readable by the consumer when sequence == position + 1.
+	*/
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		std::optional<Invocation> invocation;
+	};
+
+
 	void scheduleInvocation(Invocation invocation) noexcept override;
 
 	void waitAnyActivity() noexcept override;
 
 	void dispose() override;
 
+	bool TryPush(Invocation& invocation) noexcept;
+
+	std::optional<Invocation> TryPop() noexcept;
+
+	bool HasInvocations() const noexcept;
 
-	std::vector<Invocation> _invocations;
-	std::mutex _mutex;
+	/**
+		Returns false when there was nothing to execute.
+	*/
+	bool ExecuteInvocations();
+
+	void Wait();
+
+
+	std::array<Slot, RingCapacity> _ring;
+	alignas(64) std::atomic<size_t> _pushPosition {0};
+	// is accessed only by the executing thread.
+	alignas(64) size_t _popPosition = 0;
+
+	std::vector<Invocation> _overflow;
+	std::vector<Invocation> _overflowBatch;
+	std::mutex _overflowMutex;
+	std::atomic<bool> _hasOverflow {false};
+
+	std::atomic<bool> _isParked {false};
+	std::atomic<bool> _isClosed {false};
 	Threading::Event _signal{Threading::Event::ResetMode::Auto};
-	bool _isClosed = false;
 };
 
 
 }
 
-
@@ -1,4 +1,6 @@
 //◦ Playrix ◦
+#include "asyncwaitlist.h"
+#include "luahotpatch.h"
 #include "luastacktraceprovider.h"
 #include "lua-toolkit/debug/debugsessioncontroller.h"
 #include "lua-toolkit/debug/luadebug.h"
@@ -8,6 +10,15 @@
 #include <runtime/threading/event.h>
 #include <runtime/threading/lock.h>
 
+#include <array>
+
+extern "C" {
+#include <lauxlib.h>
+#if __has_include(<luajit.h>)
+#include <luajit.h>
+#endif
+}
+
 namespace Lua::Debug {
 
 using namespace Runtime;
@@ -18,6 +29,54 @@ using namespace std::chrono_literals;
 
 namespace {
 
+/**
+	Registry key of the coroutine suspended by the cooperative stop: it is kept alive until the stop is ended.
+*/
+constexpr const char* StoppedThreadKey = "__lua_DebuggerStoppedThread";
+
+/**
+	Registry keys prefix of the base library functions replaced by the error wrappers.
+*/
+constexpr std::string_view OriginalFunctionKeyPrefix {"__lua_DebuggerOriginal_"};
+
+/**
+	Registry keys prefix of the installed error wrappers: global is restored only when it still holds the wrapper.
+*/
+constexpr std::string_view WrapperFunctionKeyPrefix {"__lua_DebuggerWrapper_"};
+
+#ifdef LUAJIT_VERSION
+/**
+	LuaJIT pcall and xpcall are yieldable, lua_pcall of the C wrapper is not: the wrappers are lua functions over the original xpcall.
+	Arguments: original xpcall, caught errors handler, factory of the handler that calls the script's message handler.
+*/
+constexpr std::string_view ErrorWrappersChunk {
+	"local xpcall, handler, makeHandler = ...\n"
+	"return function(f, ...) return xpcall(f, handler, ...) end,\n"
+	"	function(f, msgh, ...) return xpcall(f, makeHandler(msgh), ...) end\n"
+};
+#endif
+
+/**
+	Registry key of the weak keyed table of the threads the hook has run on.
+*/
+constexpr const char* HookedThreadsKey = "__lua_DebuggerHookedThreads";
+
+constexpr const char* SessionGlobalKey = "__lua_DebuggerSession";
+
+
+std::string FormatTraceback(lua_State* l, int firstLevel) {
+	std::string traceback;
+
+	lua_Debug frame {};
+	for (int level = firstLevel; lua_getstack(l, level, &frame) != 0; ++level) {
+		lua_getinfo(l, "nSl", &frame);
+		traceback += Core::Format::format("{}:{}: in {}\n", frame.short_src, frame.currentline, frame.name ? frame.name : frame.what);
+	}
+
+	return traceback;
+}
+
+
 std::tuple<int, int> GetCurrentLineAndStackDepth(lua_State* l, lua_Debug* ar) {
 
 	int stackDepth = 0;
@@ -106,6 +165,44 @@ private:
 };
 
 
+struct LuaDebugSessionController::PendingPatch
+{
+	std::shared_ptr<const HotPatchArguments> args;
+	CompiledChunk chunk;
+
+	// completed by the lua thread (or cancelled), guarded by the mutex.
+	std::mutex mutex;
+	std::optional<HotPatchResponseBody> result;
+	std::exception_ptr error;
+	bool isCompleted = false;
+	AsyncWaitList completion;
+
+	void Complete(std::optional<HotPatchResponseBody> patchResult, std::exception_ptr patchError) {
+		{
+			lock_(mutex);
+			result = std::move(patchResult);
+			error = std::move(patchError);
+			isCompleted = true;
+		}
+
+		completion.NotifyAll();
+	}
+};
+
+
+struct LuaDebugSessionController::CooperativeStop
+{
+	ComPtr<DebugSession> session;
+	ComPtr<LuaStackTraceProvider> stackTraceProvider;
+	lua_State* thread = nullptr;
+	// copy of the hook's record: the record is not valid after the hook returns.
+	lua_Debug debugInfo {};
+	std::chrono::steady_clock::time_point stopStart;
+	// coroutine is resumed by the lua code and could not be suspended again (or is dead): its frames and debugInfo are stale.
+	bool isResumed = false;
+};
+
+
 /* -------------------------------------------------------------------------- */
 LuaDebugSessionController::LuaDebugSessionController()
 {}
@@ -115,11 +212,68 @@ LuaDebugSessionController::~LuaDebugSessionController()
 {}
 
 
+void LuaDebugSessionController::SetStopMode(StopMode stopMode) {
+	_stopMode = stopMode;
+}
+
+
+lua_State* LuaDebugSessionController::PollDebugger() {
+	if (!_cooperativeStop) {
+		return nullptr;
+	}
+
+	// coroutine resumed without the hook invocation (i.e. it is dead) is not noticed by ExecuteDebugger.
+	if (!_cooperativeStop->isResumed && lua_status(_cooperativeStop->thread) != LUA_YIELD) {
+		InvalidateCooperativeStop();
+	}
+
+	const std::optional<ContinueExecutionMode> continueMode = _cooperativeStop->session->PollStoppedExecution();
+	if (!continueMode) {
+		return _cooperativeStop->thread;
+	}
+
+	const std::unique_ptr<CooperativeStop> stop = std::move(_cooperativeStop);
+	stop->stackTraceProvider->ReleaseValues();
+
+	EndStop();
+	DebugMetrics::AddStop(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stop->stopStart));
+
+	lua_State* const l = GetLua();
+	lua_pushnil(l);
+	lua_setfield(l, LUA_REGISTRYINDEX, StoppedThreadKey);
+
+	// host is outside of the lua code: the main state's stack is used, not the one of the suspended coroutine.
+	if (*continueMode == ContinueExecutionMode::Stopped) {
+		TearDownDebug(l);
+	}
+	else if (!stop->isResumed) {
+		_resumedThread = stop->thread;
+		_resumedLine = stop->debugInfo.currentline;
+
+		ContinueExecution(stop->thread, &stop->debugInfo, *continueMode);
+	}
+	// resumed stop just continues: steps are relative to the stopped frames, which are gone.
+
+	return nullptr;
+}
+
+
 void LuaDebugSessionController::SetSession(ComPtr<DebugSession> session) {
+	if (session) {
+		session->RegisterCommand("hotPatch", CreateHotPatchCommand());
+	}
+
+	lock_(_mutex);
 	_sessionRef = std::move(session);
 }
 
 
+ComPtr<DebugSession> LuaDebugSessionController::AcquireSession() {
+	lock_(_mutex);
+	return _sessionRef.acquire();
+}
+
+
 unsigned LuaDebugSessionController::GetSourceId(Runtime::Dap::Source& source) {
 
 	auto existingSource = std::find_if(_sources.begin(), _sources.end(), [&source](const SourceEntry& entry) {
@@ -154,6 +308,29 @@ Task<> LuaDebugSessionController::ConfigurationDone() {
 
 
 Task<> LuaDebugSessionController::Disconnect(){
+
+	// hooks left installed keep slowing the lua thread: debugging is disabled and the session state is released,
+	// so the controller can be attached again. The lua state is not touched here (Disconnect runs on the session thread, or the host's one):
+	// the hook sees the request (set before the hook becomes inactive) and removes itself on the lua thread.
+	_isTeardownRequested = true;
+	_isActive = false;
+	CancelPendingPatches();
+
+	{
+		lock_(_mutex);
+		_sourceBreakpoints.clear();
+		_functionBreakpoints.clear();
+		_sources.clear();
+		_sessionRef = ComPtr<DebugSession>{};
+	}
+
+	// wrappers are removed by the lua thread (they do not report errors without the filters).
+	_breakOnAllErrors = false;
+	_breakOnUncaughtErrors = false;
+	_isErrorFiltersChanged = true;
+
+	_startMode = StartMode::Unknown;
+
 	return Task<>::makeResolved();
 }
 
@@ -211,6 +388,51 @@ Task<std::vector<Dap::Breakpoint>> LuaDebugSessionController::SetFunctionBreakpo
 }
 
 
+Task<> LuaDebugSessionController::SetExceptionBreakpoints(Dap::SetExceptionBreakpointsArguments arg) {
+	const auto hasFilter = [&arg](std::string_view filter) {
+		return std::find(arg.filters.begin(), arg.filters.end(), filter) != arg.filters.end();
+	};
+
+	// globals are changed by the lua thread: on the next hook invocation.
+	_breakOnAllErrors = hasFilter(AllErrorsFilter);
+	_breakOnUncaughtErrors = hasFilter(UncaughtErrorsFilter);
+	_isErrorFiltersChanged = true;
+
+	return Task<>::makeResolved();
+}
+
+
+std::vector<Dap::ExceptionBreakpointsFilter> LuaDebugSessionController::GetExceptionBreakpointFilters() const {
+	std::vector<Dap::ExceptionBreakpointsFilter> filters(2);
+
+	filters[0].filter = AllErrorsFilter;
+	filters[0].label = "All Errors";
+	filters[0].description = "Stops on every lua error, including the errors caught by pcall";
+
+	filters[1].filter = UncaughtErrorsFilter;
+	filters[1].label = "Uncaught Errors";
+	filters[1].description = "Stops on the errors that reach the host's message handler";
+	filters[1].isDefault = true;
+
+	return filters;
+}
+
+
+Task<Dap::ExceptionInfoResponseBody> LuaDebugSessionController::GetExceptionInfo(Dap::ExceptionInfoArguments) {
+	std::optional<Dap::ExceptionInfoResponseBody> exceptionInfo;
+	{
+		lock_(_mutex);
+		exceptionInfo = _exceptionInfo;
+	}
+
+	if (!exceptionInfo) {
+		throw DapRequestError("Execution is not stopped on error");
+	}
+
+	co_return std::move(*exceptionInfo);
+}
+
+
 Task<std::vector<Dap::Thread>> LuaDebugSessionController::GetThreads() {
 
 	std::vector<Dap::Thread> threads;
@@ -221,22 +443,67 @@ Task<std::vector<Dap::Thread>> LuaDebugSessionController::GetThreads() {
 }
 
 
+void LuaDebugSessionController::CancelPendingRequests() {
+	CancelPendingPatches();
+}
+
+
 void LuaDebugSessionController::EnableDebug() {
 
+	// teardown requested by the previous session is not needed: its hooks are reused.
+	_isTeardownRequested = false;
 	_isActive = true;
 
+	{
+		lock_(_patchesMutex);
+		_arePatchesAccepted = true;
+	}
+
+	// step of the previous session (is accessed only by the lua thread).
+	_debugStepPredicate.reset();
+
 	lua_State* const l = GetLua();
 
+	if (!_metrics) {
+		_metrics = DebugMetrics::RegisterState(GetStateName());
+	}
+	SampleLuaMemory(l);
+
 	lua_pushlightuserdata(l, this);
-	lua_setfield(l, LUA_GLOBALSINDEX, "__lua_DebuggerSession");
+	lua_setfield(l, LUA_GLOBALSINDEX, SessionGlobalKey);
+
+	lua_getfield(l, LUA_REGISTRYINDEX, HookedThreadsKey);
+	const bool hasHookedThreads = lua_istable(l, -1);
+	lua_pop(l, 1);
+
+	if (!hasHookedThreads) {
+		lua_newtable(l);
+		lua_newtable(l);
+		lua_pushliteral(l, "k");
+		lua_setfield(l, -2, "__mode");
+		lua_setmetatable(l, -2);
+		lua_setfield(l, LUA_REGISTRYINDEX, HookedThreadsKey);
+	}
+
+	_isErrorFiltersChanged = false;
+	SyncErrorWrappers(l);
+
+	lua_sethook(GetLua(), [](lua_State* l, lua_Debug* ar) {
 
-	lua_sethook(GetLua(), [](lua_State* l, lua_Debug* ar) noexcept {
+		const bool isSuspended = [l, ar]() noexcept {
+			LuaDebugSessionController* const self = GetController(l);
+			if (!self) {
+				// coroutine that inherited the hook of the debugged thread is run after the teardown.
+				lua_sethook(l, nullptr, 0, 0);
+				return false;
+			}
+
+			return self->ExecuteDebugger(l, ar);
+		}();
 
-		lua_getfield(l, LUA_GLOBALSINDEX, "__lua_DebuggerSession");
-		LuaDebugSessionController* self  = reinterpret_cast<LuaDebugSessionController*>(lua_touserdata (l, -1));
-		lua_pop(l, 1);
-		if (self) {
-			self->ExecuteDebugger(l, ar);
+		// yield is the last call of the hook and is made outside of the noexcept frame: LuaJIT unwinds the hook frame with it.
+		if (isSuspended) {
+			lua_yield(l, 0);
 		}
 	}
 	, LUA_MASKRET | LUA_MASKCALL | LUA_MASKLINE, 0);
@@ -244,13 +511,52 @@ void LuaDebugSessionController::EnableDebug() {
 
 
 void LuaDebugSessionController::DisableDebug() {
+	TearDownDebug(GetLua());
+}
 
-	//lua_State* const l = GetLua();
-	//lua_pushnil(l);
-	//lua_setfield(l, LUA_GLOBALSINDEX, "__lua_DebuggerSession");
 
+void LuaDebugSessionController::TearDownDebug(lua_State* l) {
+
+	_isTeardownRequested = false;
 	_isActive = false;
-	// lua_sethook(GetLua(), nullptr, 0, 0);
+	CancelPendingPatches();
+
+	// wrappers are synced by the hook: they are restored before the hook is removed, otherwise they stay installed.
+	SyncErrorWrappers(l);
+
+	lua_getfield(l, LUA_REGISTRYINDEX, HookedThreadsKey);
+	if (lua_istable(l, -1)) {
+		lua_pushnil(l);
+		while (lua_next(l, -2) != 0) {
+			lua_pop(l, 1);
+			lua_sethook(lua_tothread(l, -1), nullptr, 0, 0);
+		}
+
+		lua_pushnil(l);
+		lua_setfield(l, LUA_REGISTRYINDEX, HookedThreadsKey);
+	}
+	lua_pop(l, 1);
+
+	_lastHookedThread = nullptr;
+
+	lua_sethook(GetLua(), nullptr, 0, 0);
+	lua_sethook(l, nullptr, 0, 0);
+
+	lua_pushnil(l);
+	lua_setfield(l, LUA_GLOBALSINDEX, SessionGlobalKey);
+}
+
+
+void LuaDebugSessionController::TrackHookedThread(lua_State* l) {
+	_lastHookedThread = l;
+
+	lua_getfield(l, LUA_REGISTRYINDEX, HookedThreadsKey);
+	if (lua_istable(l, -1)) {
+		lua_pushthread(l);
+		lua_pushboolean(l, 1);
+		lua_rawset(l, -3);
+	}
+	lua_pop(l, 1);
 }
 
 
@@ -272,13 +578,86 @@ Task<> LuaDebugSessionController::ConfigureAttach(RuntimeValue::Ptr config) {
 }
 
 
-void LuaDebugSessionController::ExecuteDebugger(lua_State* l , lua_Debug* ar) {
+std::string LuaDebugSessionController::GetStateName() const {
+	return Core::Format::format("{}", static_cast<const void*>(GetLua()));
+}
+
+
+bool LuaDebugSessionController::ExecuteDebugger(lua_State* l , lua_Debug* ar) {
+
+	const uint64_t invocation = _metrics->hookInvocations.load(std::memory_order_relaxed);
+	DebugMetrics::StateCounters::Add(_metrics->hookInvocations, 1);
+
+	if (invocation % MemorySamplePeriod == 0) {
+		SampleLuaMemory(l);
+	}
 
 	if (!_isActive) {
-		return;
+		// teardown is requested before the hook becomes inactive: it is not missed by the inactive hook.
+		if (_isTeardownRequested.exchange(false)) {
+			TearDownDebug(l);
+		}
+		else {
+			// coroutine that inherited the hook, but was not run before the teardown.
+			lua_sethook(l, nullptr, 0, 0);
+		}
+
+		return false;
+	}
+
+	if (l != _lastHookedThread) {
+		TrackHookedThread(l);
+	}
+
+	// sampled invocation is accounted for the whole period.
+	const bool isTimed = invocation % HookTimingSamplePeriod == 0;
+	const auto hookStart = isTimed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+	std::chrono::steady_clock::duration stopDuration{};
+
+	SCOPE_Leave {
+		if (isTimed) {
+			const auto hookDuration = (std::chrono::steady_clock::now() - hookStart - stopDuration) * HookTimingSamplePeriod;
+			DebugMetrics::StateCounters::Add(_metrics->hookNanoseconds, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(hookDuration).count()));
+		}
+	};
+
+	if (_isErrorFiltersChanged.load(std::memory_order_relaxed) && _isErrorFiltersChanged.exchange(false)) {
+		SyncErrorWrappers(l);
+	}
+
+	// only the suspended coroutine is stopped: other lua code runs without breakpoints and steps until the stop is ended.
+	if (_cooperativeStop) {
+		if (l == _cooperativeStop->thread && !_cooperativeStop->isResumed) {
+			// the stopped coroutine is resumed by the lua code (i.e. its scheduler): the resumed line is reported again
+			// and the coroutine is suspended again, with the same frames.
+			if (ar->event == LUA_HOOKLINE && CanSuspend(l, ar)) {
+				return true;
+			}
+
+			InvalidateCooperativeStop();
+		}
+
+		return false;
+	}
+
+	// Lua 5.1 reports the line of the yielded instruction again when the coroutine is resumed.
+	if (_resumedThread == l && ar->event == LUA_HOOKLINE) {
+		const bool isStopLine = ar->currentline == _resumedLine;
+		_resumedThread = nullptr;
+
+		if (isStopLine) {
+			return false;
+		}
+	}
+
+	if (_hasPendingPatches.load(std::memory_order_acquire)) {
+		ApplyPendingPatches(l);
 	}
 
 	std::optional<Dap::StoppedEventBody> stoppedEvent = CheckBreakpoints(l, ar);
+	if (stoppedEvent) {
+		DebugMetrics::StateCounters::Add(_metrics->breakpointHits, 1);
+	}
 
 	if (!stoppedEvent && _debugStepPredicate) {
 		stoppedEvent = _debugStepPredicate->GetStopped(l, ar);
@@ -288,31 +667,421 @@ void LuaDebugSessionController::ExecuteDebugger(lua_State* l , lua_Debug* ar) {
 	}
 
 	if (stoppedEvent) {
-		auto session = _sessionRef.acquire();
-		Assert(session);
+		// session is disconnected while the hook is running: it is torn down by the next invocation.
+		auto session = AcquireSession();
+		if (!session) {
+			return false;
+		}
+
+		SampleLuaMemory(l);
+
+		// patches requested after this point are applied on the stopped thread.
+		ApplyPendingPatches(l, true);
+
+		if (CanSuspend(l, ar)) {
+			BeginCooperativeStop(std::move(session), l, ar, std::move(*stoppedEvent));
+			return true;
+		}
+
+		const ContinueExecutionMode continueMode = BlockingStop(std::move(session), l, ar, std::move(*stoppedEvent), stopDuration);
+		ContinueExecution(l, ar, continueMode);
+	}
 
-		auto stackTraceProvider = Com::createInstance<LuaStackTraceProvider>(l, ar);
-		const ContinueExecutionMode continueMode = session->StopExecution(std::move(*stoppedEvent), stackTraceProvider);
+	return false;
+}
+
+
+ContinueExecutionMode LuaDebugSessionController::BlockingStop(ComPtr<DebugSession> session, lua_State* l, lua_Debug* ar, Dap::StoppedEventBody stoppedEvent, std::chrono::steady_clock::duration& stopDuration) {
+	_stoppedLua = l;
+
+	const auto stopStart = std::chrono::steady_clock::now();
+
+	auto stackTraceProvider = Com::createInstance<LuaStackTraceProvider>(l, ar);
+	const ContinueExecutionMode continueMode = session->StopExecution(std::move(stoppedEvent), stackTraceProvider);
+	stackTraceProvider->ReleaseValues();
+
+	EndStop();
+
+	stopDuration = std::chrono::steady_clock::now() - stopStart;
+	DebugMetrics::AddStop(std::chrono::duration_cast<std::chrono::nanoseconds>(stopDuration));
+
+	return continueMode;
+}
+
+
+void LuaDebugSessionController::SyncErrorWrappers(lua_State* l) {
+	const bool isRequired = _isActive && _breakOnAllErrors;
+	if (isRequired == _areErrorWrappersInstalled) {
+		return;
+	}
 
-		if (continueMode == ContinueExecutionMode::Step) {
-			_debugStepPredicate = std::make_unique<StepPredicate>(l, ar);
+	_areErrorWrappersInstalled = isRequired;
+
+	// code that keeps the base functions in the locals (i.e. 'local pcall = pcall') is not affected.
+	// the order matches the wrappers pushed by PushErrorWrappers.
+	constexpr std::array<const char*, 3> wrappedNames {"pcall", "xpcall", "error"};
+
+	if (isRequired) {
+		for (const char* const name : wrappedNames) {
+			lua_getfield(l, LUA_GLOBALSINDEX, name);
+			lua_setfield(l, LUA_REGISTRYINDEX, (std::string{OriginalFunctionKeyPrefix} + name).c_str());
 		}
-		else if (continueMode == ContinueExecutionMode::StepIn) {
-			_debugStepPredicate = std::make_unique<StepPredicate>(l, ar, true);
+
+		PushErrorWrappers(l);
+
+		for (auto name = wrappedNames.rbegin(); name != wrappedNames.rend(); ++name) {
+			lua_pushvalue(l, -1);
+			lua_setfield(l, LUA_REGISTRYINDEX, (std::string{WrapperFunctionKeyPrefix} + *name).c_str());
+			lua_setfield(l, LUA_GLOBALSINDEX, *name);
 		}
-		else if (continueMode == ContinueExecutionMode::StepOut) {
-			if (const auto [line, stackDepth] = GetCurrentLineAndStackDepth(l, ar); stackDepth > 0) {
-				_debugStepPredicate = std::make_unique<StepOutPredicate>(stackDepth);
-			}
-			
+
+		return;
+	}
+
+	for (const char* const name : wrappedNames) {
+		const std::string originalKey = std::string{OriginalFunctionKeyPrefix} + name;
+		const std::string wrapperKey = std::string{WrapperFunctionKeyPrefix} + name;
+
+		// global that is replaced by the script after the wrapper was installed is kept.
+		lua_getfield(l, LUA_GLOBALSINDEX, name);
+		lua_getfield(l, LUA_REGISTRYINDEX, wrapperKey.c_str());
+		const bool isWrapper = lua_rawequal(l, -1, -2) != 0;
+		lua_pop(l, 2);
+
+		if (isWrapper) {
+			lua_getfield(l, LUA_REGISTRYINDEX, originalKey.c_str());
+			lua_setfield(l, LUA_GLOBALSINDEX, name);
+		}
+
+		lua_pushnil(l);
+		lua_setfield(l, LUA_REGISTRYINDEX, originalKey.c_str());
+		lua_pushnil(l);
+		lua_setfield(l, LUA_REGISTRYINDEX, wrapperKey.c_str());
+	}
+}
+
+
+void LuaDebugSessionController::PushErrorWrappers(lua_State* l) {
+#ifdef LUAJIT_VERSION
+	lua_getfield(l, LUA_REGISTRYINDEX, (std::string{OriginalFunctionKeyPrefix} + "xpcall").c_str());
+
+	// sandboxed state without xpcall gets the C wrappers.
+	if (lua_isfunction(l, -1)) {
+		[[maybe_unused]] const int status = luaL_loadbuffer(l, ErrorWrappersChunk.data(), ErrorWrappersChunk.size(), "=(debugger)");
+		Assert(status == 0);
+
+		lua_insert(l, -2);
+		lua_pushcfunction(l, CaughtErrorHandler);
+		lua_pushcfunction(l, MakeCaughtErrorHandler);
+		lua_call(l, 3, 2);
+
+		lua_pushcfunction(l, RaiseError);
+		return;
+	}
+
+	lua_pop(l, 1);
+#endif
+
+	lua_pushcfunction(l, ProtectedCall);
+	lua_pushcfunction(l, ProtectedCallWithHandler);
+	lua_pushcfunction(l, RaiseError);
+}
+
+
+void LuaDebugSessionController::OnError(lua_State* l, int errorIndex, bool isUncaught) noexcept {
+	const bool isFiltered = _breakOnAllErrors || (isUncaught && _breakOnUncaughtErrors);
+	if (!_isActive || !isFiltered || _cooperativeStop) {
+		return;
+	}
+
+	if (IsRaisedErrorReported(l)) {
+		return;
+	}
+
+	StopOnError(l, errorIndex, isUncaught ? "unhandled" : "always");
+}
+
+
+void LuaDebugSessionController::StopOnError(lua_State* l, int errorIndex, std::string_view breakMode) noexcept {
+	auto session = AcquireSession();
+	if (!session) {
+		return;
+	}
+
+	// number error value is not converted: lua_tostring would change the raised value.
+	const std::string message = lua_type(l, errorIndex) == LUA_TSTRING ?
+		std::string{lua_tostring(l, errorIndex)} :
+		Core::Format::format("(error object is a {} value)", lua_typename(l, lua_type(l, errorIndex)));
+
+	Dap::ExceptionInfoResponseBody exceptionInfo;
+	exceptionInfo.exceptionId = "LuaError";
+	exceptionInfo.description = message;
+	exceptionInfo.breakMode = breakMode;
+
+	// level 0 is the message handler (or the wrapped 'error').
+	Dap::ExceptionDetails& details = exceptionInfo.details.emplace();
+	details.message = message;
+	details.typeName = lua_typename(l, lua_type(l, errorIndex));
+	details.stackTrace = FormatTraceback(l, 1);
+
+	{
+		lock_(_mutex);
+		_exceptionInfo = std::move(exceptionInfo);
+	}
+
+	Dap::StoppedEventBody ev("exception", "Paused on error");
+	ev.text = message;
+	ev.threadId = 1;
+	ev.allThreadsStopped = true;
+
+	SampleLuaMemory(l);
+	ApplyPendingPatches(l, true);
+
+	lua_Debug ar {};
+	lua_getstack(l, 0, &ar);
+
+	std::chrono::steady_clock::duration stopDuration{};
+	const ContinueExecutionMode continueMode = BlockingStop(std::move(session), l, &ar, std::move(ev), stopDuration);
+
+	{
+		lock_(_mutex);
+		_exceptionInfo.reset();
+	}
+
+	// error is raised when execution is continued: steps continue execution as well.
+	if (continueMode == ContinueExecutionMode::Stopped) {
+		TearDownDebug(l);
+	}
+}
+
+
+bool LuaDebugSessionController::IsRaisedErrorReported(lua_State* l) const {
+	if (!_isRaisedErrorReported) {
+		return false;
+	}
+
+	// message handler is called at the raise point: level 0 is the handler, level 1 is the function that raised the error.
+	lua_Debug ar {};
+	if (lua_getstack(l, 1, &ar) == 0) {
+		return false;
+	}
+
+	lua_getinfo(l, "f", &ar);
+	const bool isRaisedByWrapper = lua_tocfunction(l, -1) == RaiseError;
+	lua_pop(l, 1);
+
+	return isRaisedByWrapper;
+}
+
+
+LuaDebugSessionController* LuaDebugSessionController::GetController(lua_State* l) {
+	lua_getfield(l, LUA_GLOBALSINDEX, SessionGlobalKey);
+	LuaDebugSessionController* const self = reinterpret_cast<LuaDebugSessionController*>(lua_touserdata(l, -1));
+	lua_pop(l, 1);
+
+	return self;
+}
+
+
+int LuaDebugSessionController::UncaughtErrorHandler(lua_State* l) {
+	lua_settop(l, 1);
+
+	if (LuaDebugSessionController* const self = GetController(l)) {
+		self->OnError(l, 1, true);
+	}
+
+	return 1;
+}
+
+
+int LuaDebugSessionController::CaughtErrorHandler(lua_State* l) {
+	lua_settop(l, 1);
+
+	if (LuaDebugSessionController* const self = GetController(l)) {
+		self->OnError(l, 1, false);
+	}
+
+	// xpcall: script's message handler is called after the stop.
+	if (!lua_isnoneornil(l, lua_upvalueindex(1))) {
+		lua_pushvalue(l, lua_upvalueindex(1));
+		lua_insert(l, 1);
+		lua_call(l, 1, 1);
+	}
+
+	return 1;
+}
+
+
+int LuaDebugSessionController::MakeCaughtErrorHandler(lua_State* l) {
+	// makeHandler (msgh)
+	lua_settop(l, 1);
+	lua_pushcclosure(l, CaughtErrorHandler, 1);
+
+	return 1;
+}
+
+
+int LuaDebugSessionController::ProtectedCall(lua_State* l) {
+	// pcall (f, ...)
+	luaL_checkany(l, 1);
+
+	lua_pushcfunction(l, CaughtErrorHandler);
+	lua_insert(l, 1);
+
+	const int status = lua_pcall(l, lua_gettop(l) - 2, LUA_MULTRET, 1);
+	lua_pushboolean(l, status == 0);
+	lua_replace(l, 1);
+
+	return lua_gettop(l);
+}
+
+
+int LuaDebugSessionController::ProtectedCallWithHandler(lua_State* l) {
+	// xpcall (f, msgh, ...): arguments after the handler are passed to f (as LuaJIT does).
+	luaL_checkany(l, 2);
+
+	lua_pushvalue(l, 2);
+	lua_pushcclosure(l, CaughtErrorHandler, 1);
+	lua_replace(l, 2);
+
+	// handler, f, ...
+	lua_pushvalue(l, 2);
+	lua_insert(l, 1);
+	lua_remove(l, 3);
+
+	const int status = lua_pcall(l, lua_gettop(l) - 2, LUA_MULTRET, 1);
+	lua_pushboolean(l, status == 0);
+	lua_replace(l, 1);
+
+	return lua_gettop(l);
+}
+
+
+int LuaDebugSessionController::RaiseError(lua_State* l) {
+	// as the base library 'error' does: position is added to the message before the error is reported.
+	const int level = luaL_optint(l, 2, 1);
+	lua_settop(l, 1);
+
+	if (lua_isstring(l, 1) && level > 0) {
+		luaL_where(l, level);
+		lua_pushvalue(l, 1);
+		lua_concat(l, 2);
+	}
+
+	if (LuaDebugSessionController* const self = GetController(l)) {
+		const bool isReported = self->_isActive && self->_breakOnAllErrors && !self->_cooperativeStop;
+		if (isReported) {
+			self->StopOnError(l, lua_gettop(l), "always");
 		}
-		else if (continueMode == ContinueExecutionMode::Stopped) {
-			//this->DisableDebug();
+
+		// set by every raise right before the error is thrown (evaluations of the stop above can raise errors as well):
+		// the message handler that is called for this raise does not stop on it again.
+		self->_isRaisedErrorReported = isReported;
+	}
+
+	return lua_error(l);
+}
+
+
+bool LuaDebugSessionController::CanSuspend(lua_State* l, lua_Debug* ar) const {
+	// only line (and count) hooks can yield.
+	if (_stopMode != StopMode::Cooperative || ar->event != LUA_HOOKLINE) {
+		return false;
+	}
+
+	const bool isMainThread = lua_pushthread(l) != 0;
+	lua_pop(l, 1);
+
+	if (isMainThread) {
+		return false;
+	}
+
+	// yield across the C call boundary fails: C functions, and (in Lua 5.1) metamethods and iterators called by the VM,
+	// which frames have no call name. Bottom frame is the coroutine body.
+	lua_Debug frame {};
+	lua_Debug nextFrame {};
+
+	for (int level = 0; lua_getstack(l, level, &frame) != 0; ++level) {
+		lua_getinfo(l, "nS", &frame);
+
+		if (strcmp(frame.what, "C") == 0) {
+			return false;
+		}
+
+		const bool isBottomFrame = lua_getstack(l, level + 1, &nextFrame) == 0;
+		const bool isCalledByName = frame.namewhat && *frame.namewhat != '\0' && strcmp(frame.namewhat, "for iterator") != 0;
+
+		if (!isBottomFrame && strcmp(frame.what, "tail") != 0 && !isCalledByName) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void LuaDebugSessionController::BeginCooperativeStop(ComPtr<DebugSession> session, lua_State* l, lua_Debug* ar, Dap::StoppedEventBody stoppedEvent) {
+	auto stop = std::make_unique<CooperativeStop>();
+	stop->session = std::move(session);
+	stop->thread = l;
+	stop->debugInfo = *ar;
+	stop->stopStart = std::chrono::steady_clock::now();
+	stop->stackTraceProvider = Com::createInstance<LuaStackTraceProvider>(l, &stop->debugInfo);
+
+	lua_pushthread(l);
+	lua_setfield(l, LUA_REGISTRYINDEX, StoppedThreadKey);
+
+	// coroutine is suspended: patches of the stopped execution are applied by the host thread through the main state.
+	_stoppedLua = GetLua();
+
+	CooperativeStop& cooperativeStop = *stop;
+	_cooperativeStop = std::move(stop);
+
+	cooperativeStop.session->BeginStopExecution(std::move(stoppedEvent), cooperativeStop.stackTraceProvider);
+}
+
+
+void LuaDebugSessionController::InvalidateCooperativeStop() {
+	LOG_WARN("Coroutine stopped by the debugger is resumed by the lua code, the stop is not valid anymore");
+
+	_cooperativeStop->isResumed = true;
+	_cooperativeStop->stackTraceProvider->Invalidate();
+}
+
+
+void LuaDebugSessionController::ContinueExecution(lua_State* l, lua_Debug* ar, ContinueExecutionMode continueMode) {
+	if (continueMode == ContinueExecutionMode::Step) {
+		_debugStepPredicate = std::make_unique<StepPredicate>(l, ar);
+	}
+	else if (continueMode == ContinueExecutionMode::StepIn) {
+		_debugStepPredicate = std::make_unique<StepPredicate>(l, ar, true);
+	}
+	else if (continueMode == ContinueExecutionMode::StepOut) {
+		if (const auto [line, stackDepth] = GetCurrentLineAndStackDepth(l, ar); stackDepth > 0) {
+			_debugStepPredicate = std::make_unique<StepOutPredicate>(stackDepth);
 		}
+		
+	}
+	else if (continueMode == ContinueExecutionMode::Stopped) {
+		TearDownDebug(l);
 	}
 }
 
 
+void LuaDebugSessionController::EndStop() {
+	_stoppedLua = nullptr;
+
+	lock_(_patchesMutex);
+	_isStopped = false;
+}
+
+
+void LuaDebugSessionController::SampleLuaMemory(lua_State* l) {
+	const uint64_t bytes = static_cast<uint64_t>(lua_gc(l, LUA_GCCOUNT, 0)) * 1024 + static_cast<uint64_t>(lua_gc(l, LUA_GCCOUNTB, 0));
+	_metrics->luaMemoryBytes.store(bytes, std::memory_order_relaxed);
+}
+
+
 std::optional<Dap::StoppedEventBody> LuaDebugSessionController::CheckBreakpoints(lua_State* l, lua_Debug* ar) {
 
 	lock_(_mutex);
@@ -362,6 +1131,198 @@ std::optional<Dap::StoppedEventBody> LuaDebugSessionController::CheckBreakpoints
 	return std::nullopt;
 }
 
+
+DapCommandHandler LuaDebugSessionController::CreateHotPatchCommand() {
+	DapCommandHandler command;
+	// the patch of the running execution waits for the next hook invocation: other requests are not held by it.
+	command.awaitsExecution = true;
+
+	command.bind = [this](const Dap::InboundMessage& message) -> DapCommandHandler::BoundRequest {
+		auto args = std::make_shared<const HotPatchArguments>(message.GetArguments<HotPatchArguments>());
+
+		bool isStopped = false;
+		{
+			lock_(_patchesMutex);
+			isStopped = _isStopped;
+		}
+
+		if (!isStopped) {
+			return DapCommandHandler::Invocation{[this, args] {
+				return HotPatch(args);
+			}};
+		}
+
+		// execution is stopped: the patch is compiled on the pool and applied right on the stopped lua thread.
+		return DapCommandHandler::StoppedThreadPreparation{[this, args] {
+			return PrepareStoppedHotPatch(args);
+		}};
+	};
+
+	return command;
+}
+
+
+Task<Dap::AnyJsonValue> LuaDebugSessionController::HotPatch(std::shared_ptr<const HotPatchArguments> args) {
+	co_await RuntimeCore::instance().poolScheduler();
+
+	auto patch = std::make_shared<PendingPatch>();
+	patch->args = args;
+	patch->chunk = CompileChunk(args->content, args->source.path);
+
+	{
+		lock_(_patchesMutex);
+
+		if (!_arePatchesAccepted) {
+			throw DapRequestError("Debugging is not enabled");
+		}
+
+		// stop began while the patch was compiled: the stopped thread does not run the hook.
+		if (_isStopped) {
+			throw DapRequestError("Execution is stopped, repeat the request");
+		}
+
+		// the request keeps its reference: it awaits the completion below.
+		_pendingPatches.push_back(patch);
+		_hasPendingPatches.store(true, std::memory_order_release);
+	}
+
+	// patch is applied by the next hook invocation: the request is suspended until then, no thread is blocked.
+	{
+		std::unique_lock lock{patch->mutex};
+		while (!patch->isCompleted) {
+			co_await patch->completion.Wait(lock);
+			lock = std::unique_lock{patch->mutex};
+		}
+	}
+
+	// resumed by the lua thread: the response is sent from the pool.
+	co_await RuntimeCore::instance().poolScheduler();
+
+	if (patch->error) {
+		std::rethrow_exception(patch->error);
+	}
+
+	co_return Dap::AnyJsonValue{std::move(*patch->result)};
+}
+
+
+Task<DapCommandHandler::StoppedThreadInvocation> LuaDebugSessionController::PrepareStoppedHotPatch(std::shared_ptr<const HotPatchArguments> args) {
+	co_await RuntimeCore::instance().poolScheduler();
+
+	auto chunk = std::make_shared<const CompiledChunk>(CompileChunk(args->content, args->source.path));
+
+	co_return DapCommandHandler::StoppedThreadInvocation{[this, args, chunk](StackTraceProvider&) {
+		Assert(_stoppedLua);
+		return Dap::AnyJsonValue{ApplyHotPatch(_stoppedLua, *chunk, *args)};
+	}};
+}
+
+
+void LuaDebugSessionController::ApplyPendingPatches(lua_State* l, bool isStopping) {
+	std::vector<std::shared_ptr<PendingPatch>> patches;
+
+	{
+		lock_(_patchesMutex);
+		patches = std::move(_pendingPatches);
+		_pendingPatches.clear();
+		_hasPendingPatches.store(false, std::memory_order_relaxed);
+		_isStopped = isStopping;
+	}
+
+	for (const std::shared_ptr<PendingPatch>& patch : patches) {
+		std::optional<HotPatchResponseBody> result;
+		std::exception_ptr error;
+
+		try {
+			result = ApplyHotPatch(l, patch->chunk, *patch->args);
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		patch->Complete(std::move(result), std::move(error));
+	}
+}
+
+
+void LuaDebugSessionController::CancelPendingPatches() {
+	std::vector<std::shared_ptr<PendingPatch>> patches;
+
+	// patches are not accepted anymore under the same lock: the patch is either queued before (and cancelled here) or rejected.
+	{
+		lock_(_patchesMutex);
+		_arePatchesAccepted = false;
+		patches = std::move(_pendingPatches);
+		_pendingPatches.clear();
+		_hasPendingPatches.store(false, std::memory_order_relaxed);
+	}
+
+	for (const std::shared_ptr<PendingPatch>& patch : patches) {
+		patch->Complete(std::nullopt, std::make_exception_ptr(DapRequestError("Debugging is disabled")));
+	}
+}
+
+
+HotPatchResponseBody LuaDebugSessionController::ApplyHotPatch(lua_State* l, const CompiledChunk& chunk, const HotPatchArguments& args) {
+	HotPatchResponseBody body = PatchFunctions(l, chunk, args.module);
+	body.breakpoints = RemapBreakpoints(args);
+
+	return body;
+}
+
+
+std::vector<Dap::Breakpoint> LuaDebugSessionController::RemapBreakpoints(const HotPatchArguments& args) {
+	lock_(_mutex);
+
+	std::optional<LineRemapper> remapper;
+	if (args.baseContent) {
+		remapper.emplace(*args.baseContent, args.content);
+	}
+	else if (const auto patchedContent = _patchedContents.find(args.source.path); patchedContent != _patchedContents.end()) {
+		remapper.emplace(patchedContent->second, args.content);
+	}
+
+	_patchedContents[args.source.path] = args.content;
+
+	const auto source = std::find_if(_sources.begin(), _sources.end(), [&args](const SourceEntry& entry) {
+		return entry.GetSource() == args.source;
+	});
+
+	std::vector<Dap::Breakpoint> breakpoints;
+
+	if (source == _sources.end()) {
+		return breakpoints;
+	}
+
+	for (SourceBp& sourceBp : _sourceBreakpoints) {
+		if (sourceBp.SourceId() != source->Id()) {
+			continue;
+		}
+
+		Dap::SourceBreakpoint srcBp = sourceBp.Bp();
+
+		Dap::Breakpoint& bp = breakpoints.emplace_back();
+		bp.id = sourceBp.Id();
+		bp.verified = true;
+
+		// without the base content lines are assumed to be unchanged.
+		if (remapper) {
+			if (const std::optional<unsigned> line = remapper->Map(srcBp.line)) {
+				srcBp.line = *line;
+				sourceBp = SourceBp{sourceBp.Id(), sourceBp.SourceId(), srcBp};
+			}
+			else {
+				bp.verified = false;
+				bp.message = "Breakpoint line is changed by the hot patch";
+			}
+		}
+
+		bp.line = srcBp.line;
+	}
+
+	return breakpoints;
+}
+
 /* -------------------------------------------------------------------------- */
 LuaDebugSessionController::SourceBp::SourceBp(unsigned bpId, unsigned sourceId, Runtime::Dap::SourceBreakpoint bp) noexcept
 	: _id(bpId)
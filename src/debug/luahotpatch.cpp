@@ -0,0 +1,475 @@
+//◦ Playrix ◦
+#include "luahotpatch.h"
+#include "lua-toolkit/debug/dapcommandhandler.h"
+
+extern "C" {
+#include <lauxlib.h>
+#if __has_include(<luajit.h>)
+#include <luajit.h>
+#endif
+}
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+namespace Lua::Debug {
+
+using namespace Runtime;
+using namespace Runtime::Debug;
+
+namespace {
+
+int AppendBytes(lua_State*, const void* bytes, size_t size, void* data) {
+	reinterpret_cast<std::string*>(data)->append(reinterpret_cast<const char*>(bytes), size);
+	return 0;
+}
+
+
+bool IsLuaFunction(lua_State* l, int index) {
+	return lua_isfunction(l, index) && !lua_iscfunction(l, index);
+}
+
+
+std::string PopErrorMessage(lua_State* l) {
+	const char* const error = lua_tostring(l, -1);
+	std::string message = error ? error : "Unknown error";
+	lua_pop(l, 1);
+
+	return message;
+}
+
+
+/**
+	Pushes package.loaded[module] (globals when module is empty).
+*/
+void PushTargetTable(lua_State* l, const std::string& module) {
+	if (module.empty()) {
+		lua_pushvalue(l, LUA_GLOBALSINDEX);
+		return;
+	}
+
+	lua_getfield(l, LUA_GLOBALSINDEX, "package");
+	if (lua_istable(l, -1)) {
+		lua_getfield(l, -1, "loaded");
+		if (lua_istable(l, -1)) {
+			lua_getfield(l, -1, module.c_str());
+		}
+	}
+
+	if (!lua_istable(l, -1)) {
+		throw DapRequestError(Core::Format::format("Module ({}) is not loaded", module));
+	}
+}
+
+
+/**
+	Marks the value as visited, returns false when it was visited already.
+*/
+bool MarkVisited(lua_State* l, int index, int visited) {
+	lua_pushvalue(l, index);
+	lua_rawget(l, visited);
+	const bool isVisited = lua_toboolean(l, -1) != 0;
+	lua_pop(l, 1);
+
+	if (isVisited) {
+		return false;
+	}
+
+	lua_pushvalue(l, index);
+	lua_pushboolean(l, 1);
+	lua_rawset(l, visited);
+
+	return true;
+}
+
+
+/**
+	Pushes the function that owns the old upvalue with the given name (the old function, or the replaced function the module upvalue
+	is collected from) and returns the upvalue index. Nothing is pushed when there is no such upvalue.
+*/
+std::optional<int> PushUpvalueOwner(lua_State* l, int oldFunction, int moduleUpvalues, const char* name) {
+	if (oldFunction != 0) {
+		for (int i = 1; const char* const oldName = lua_getupvalue(l, oldFunction, i); ++i) {
+			const bool isFound = strcmp(name, oldName) == 0;
+			lua_pop(l, 1);
+
+			if (isFound) {
+				lua_pushvalue(l, oldFunction);
+				return i;
+			}
+		}
+	}
+
+	// module upvalue: {owner function, upvalue index}.
+	lua_getfield(l, moduleUpvalues, name);
+	if (!lua_istable(l, -1)) {
+		lua_pop(l, 1);
+		return std::nullopt;
+	}
+
+	lua_rawgeti(l, -1, 2);
+	const int index = static_cast<int>(lua_tointeger(l, -1));
+	lua_pop(l, 1);
+
+	lua_rawgeti(l, -1, 1);
+	lua_replace(l, -2);
+
+	return index;
+}
+
+
+/**
+	Gives the data upvalue of the old function to the new one. LuaJIT joins them: assignments are seen by the old closures as well.
+	PUC Lua 5.1 can not join upvalues, the fallback copies the current value.
+*/
+void ShareUpvalue(lua_State* l, int newFunction, int newIndex, int oldFunction, int oldIndex) {
+#ifdef LUAJIT_VERSION
+	lua_upvaluejoin(l, newFunction, newIndex, oldFunction, oldIndex);
+#else
+	lua_getupvalue(l, oldFunction, oldIndex);
+	lua_setupvalue(l, newFunction, newIndex);
+#endif
+}
+
+
+/**
+	Gives the new function the environment and the data upvalues of the old one (oldFunction is 0 for the added function).
+	Function upvalues keep the new code, their state is transferred recursively.
+*/
+void TransferState(lua_State* l, int newFunction, int oldFunction, int moduleUpvalues, int visited) {
+	// local functions can reference each other.
+	if (!MarkVisited(l, newFunction, visited)) {
+		return;
+	}
+
+	if (lua_checkstack(l, 6) == 0) {
+		throw DapRequestError("Hot patch upvalues are too deep");
+	}
+
+	if (oldFunction != 0) {
+		lua_getfenv(l, oldFunction);
+	}
+	else {
+		lua_pushvalue(l, LUA_GLOBALSINDEX);
+	}
+	lua_setfenv(l, newFunction);
+
+	for (int i = 1; const char* const name = lua_getupvalue(l, newFunction, i); ++i) {
+		const int newValue = lua_gettop(l);
+		const std::optional<int> oldIndex = PushUpvalueOwner(l, oldFunction, moduleUpvalues, name);
+
+		if (!oldIndex) {
+			if (IsLuaFunction(l, newValue)) {
+				TransferState(l, newValue, 0, moduleUpvalues, visited);
+			}
+
+			lua_pop(l, 1);
+			continue;
+		}
+
+		const int owner = lua_gettop(l);
+		lua_getupvalue(l, owner, *oldIndex);
+		const int oldValue = lua_gettop(l);
+
+		if (IsLuaFunction(l, newValue)) {
+			TransferState(l, newValue, IsLuaFunction(l, oldValue) ? oldValue : 0, moduleUpvalues, visited);
+		}
+		else if (!lua_isfunction(l, oldValue)) {
+			ShareUpvalue(l, newFunction, i, owner, *oldIndex);
+		}
+
+		lua_settop(l, newValue - 1);
+	}
+}
+
+
+/**
+	Data upvalues of the replaced functions by name: the state that is given to the added functions.
+*/
+void CollectUpvalues(lua_State* l, int oldFunction, int moduleUpvalues) {
+	for (int i = 1; const char* const name = lua_getupvalue(l, oldFunction, i); ++i) {
+		const bool isFunction = lua_isfunction(l, -1);
+		lua_pop(l, 1);
+
+		lua_getfield(l, moduleUpvalues, name);
+		const bool isKnown = !lua_isnil(l, -1);
+		lua_pop(l, 1);
+
+		if (isKnown || isFunction || *name == '\0') {
+			continue;
+		}
+
+		lua_createtable(l, 2, 0);
+		lua_pushvalue(l, oldFunction);
+		lua_rawseti(l, -2, 1);
+		lua_pushinteger(l, i);
+		lua_rawseti(l, -2, 2);
+		lua_setfield(l, moduleUpvalues, name);
+	}
+}
+
+
+/**
+	Calls visit(patchTable, targetTable, prefix) for the patch table and its nested tables that have the table with the same key in the target
+	(i.e. M.Class of the module that defines M.Class:method), prefix is the path of the nested table ("Class.").
+*/
+template<typename F>
+void ForEachPatchedTable(lua_State* l, int patch, int target, const std::string& prefix, int visited, F&& visit) {
+	if (!MarkVisited(l, patch, visited)) {
+		return;
+	}
+
+	if (lua_checkstack(l, 8) == 0) {
+		throw DapRequestError("Hot patch tables are too deep");
+	}
+
+	visit(patch, target, prefix);
+
+	lua_pushnil(l);
+	while (lua_next(l, patch) != 0) {
+		const int nestedPatch = lua_gettop(l);
+
+		if (lua_type(l, -2) == LUA_TSTRING && lua_istable(l, nestedPatch)) {
+			lua_pushvalue(l, -2);
+			lua_rawget(l, target);
+
+			// chunk can assign to the running table itself (i.e. global table read through the sandbox): there is nothing to patch.
+			if (lua_istable(l, -1) && !lua_rawequal(l, -1, nestedPatch)) {
+				ForEachPatchedTable(l, nestedPatch, lua_gettop(l), prefix + lua_tostring(l, nestedPatch - 1) + ".", visited, visit);
+			}
+
+			lua_pop(l, 1);
+		}
+
+		lua_pop(l, 1);
+	}
+}
+
+
+void CollectTableUpvalues(lua_State* l, int patch, int target, int moduleUpvalues) {
+	lua_pushnil(l);
+	while (lua_next(l, patch) != 0) {
+		if (lua_type(l, -2) == LUA_TSTRING && IsLuaFunction(l, -1)) {
+			lua_pushvalue(l, -2);
+			lua_rawget(l, target);
+			if (IsLuaFunction(l, -1)) {
+				CollectUpvalues(l, lua_gettop(l), moduleUpvalues);
+			}
+
+			lua_pop(l, 1);
+		}
+
+		lua_pop(l, 1);
+	}
+}
+
+
+void PatchTableFunctions(lua_State* l, int patch, int target, const std::string& prefix, int moduleUpvalues, int visited, HotPatchResponseBody& body) {
+	lua_pushnil(l);
+	while (lua_next(l, patch) != 0) {
+		const int newFunction = lua_gettop(l);
+
+		if (lua_type(l, -2) == LUA_TSTRING && IsLuaFunction(l, newFunction)) {
+			std::string name = prefix + lua_tostring(l, -2);
+
+			lua_pushvalue(l, -2);
+			lua_rawget(l, target);
+
+			if (IsLuaFunction(l, -1)) {
+				TransferState(l, newFunction, lua_gettop(l), moduleUpvalues, visited);
+				body.replacedFunctions.emplace_back(std::move(name));
+			}
+			else {
+				TransferState(l, newFunction, 0, moduleUpvalues, visited);
+				body.addedFunctions.emplace_back(std::move(name));
+			}
+
+			lua_pop(l, 1);
+
+			lua_pushvalue(l, -2);
+			lua_pushvalue(l, newFunction);
+			lua_rawset(l, target);
+		}
+
+		lua_pop(l, 1);
+	}
+}
+
+
+std::vector<std::string_view> SplitLines(std::string_view content) {
+	std::vector<std::string_view> lines;
+
+	while (!content.empty()) {
+		const size_t end = content.find('\n');
+		std::string_view line = content.substr(0, end);
+		if (line.ends_with('\r')) {
+			line.remove_suffix(1);
+		}
+
+		lines.push_back(line);
+		content.remove_prefix(end == std::string_view::npos ? content.size() : end + 1);
+	}
+
+	return lines;
+}
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+CompiledChunk CompileChunk(std::string_view content, std::string chunkName) {
+	lua_State* const l = luaL_newstate();
+	Assert(l);
+
+	SCOPE_Leave {
+		lua_close(l);
+	};
+
+	if (luaL_loadbuffer(l, content.data(), content.size(), chunkName.c_str()) != 0) {
+		throw DapRequestError(PopErrorMessage(l));
+	}
+
+	CompiledChunk chunk;
+	chunk.chunkName = std::move(chunkName);
+
+	// debug info is kept: line hooks and source breakpoints work with the patched code.
+	if (lua_dump(l, AppendBytes, &chunk.bytecode) != 0) {
+		throw DapRequestError("Fail to dump compiled chunk");
+	}
+
+	return chunk;
+}
+
+
+HotPatchResponseBody PatchFunctions(lua_State* l, const CompiledChunk& chunk, const std::string& module) {
+	const int top = lua_gettop(l);
+
+	SCOPE_Leave {
+		lua_settop(l, top);
+	};
+
+	if (lua_checkstack(l, 16) == 0) {
+		throw DapRequestError("Lua stack overflow");
+	}
+
+	PushTargetTable(l, module);
+	const int target = lua_gettop(l);
+
+	if (luaL_loadbuffer(l, chunk.bytecode.data(), chunk.bytecode.size(), chunk.chunkName.c_str()) != 0) {
+		throw DapRequestError(PopErrorMessage(l));
+	}
+
+	const int function = lua_gettop(l);
+
+	// sandbox: globals are readable, global assignments of the chunk are collected (they are the patch of the globals).
+	lua_newtable(l);
+	const int sandbox = lua_gettop(l);
+	lua_newtable(l);
+	lua_pushvalue(l, LUA_GLOBALSINDEX);
+	lua_setfield(l, -2, "__index");
+	lua_setmetatable(l, sandbox);
+
+	lua_pushvalue(l, sandbox);
+	lua_setfenv(l, function);
+
+	// module chunk gets its name as 'require' gives it.
+	lua_pushvalue(l, function);
+	lua_pushstring(l, module.c_str());
+	if (lua_pcall(l, 1, 1, 0) != 0) {
+		throw DapRequestError(Core::Format::format("Patch chunk failed: {}", PopErrorMessage(l)));
+	}
+
+	if (!module.empty() && !lua_istable(l, -1)) {
+		throw DapRequestError(Core::Format::format("Patch chunk of the module ({}) does not return the module table", module));
+	}
+
+	const int patch = module.empty() ? sandbox : lua_gettop(l);
+
+	lua_newtable(l);
+	const int moduleUpvalues = lua_gettop(l);
+
+	lua_newtable(l);
+	const int visited = lua_gettop(l);
+
+	// upvalues of all the replaced functions (nested tables included) are collected before any of them is replaced.
+	lua_newtable(l);
+	ForEachPatchedTable(l, patch, target, {}, lua_gettop(l), [l, moduleUpvalues](int patchTable, int targetTable, const std::string&) {
+		CollectTableUpvalues(l, patchTable, targetTable, moduleUpvalues);
+	});
+	lua_pop(l, 1);
+
+	HotPatchResponseBody body;
+
+	lua_newtable(l);
+	ForEachPatchedTable(l, patch, target, {}, lua_gettop(l), [&](int patchTable, int targetTable, const std::string& prefix) {
+		PatchTableFunctions(l, patchTable, targetTable, prefix, moduleUpvalues, visited, body);
+	});
+	lua_pop(l, 1);
+
+	return body;
+}
+
+
+/* -------------------------------------------------------------------------- */
+LineRemapper::LineRemapper(std::string_view baseContent, std::string_view newContent)
+	: _baseLines(SplitLines(baseContent))
+	, _newLines(SplitLines(newContent))
+{
+	const size_t commonSize = std::min(_baseLines.size(), _newLines.size());
+
+	while (_prefixSize < commonSize && _baseLines[_prefixSize] == _newLines[_prefixSize]) {
+		++_prefixSize;
+	}
+
+	while (_prefixSize + _suffixSize < commonSize && _baseLines[_baseLines.size() - 1 - _suffixSize] == _newLines[_newLines.size() - 1 - _suffixSize]) {
+		++_suffixSize;
+	}
+}
+
+
+std::optional<unsigned> LineRemapper::Map(unsigned line) const {
+	if (line == 0 || line > _baseLines.size()) {
+		return std::nullopt;
+	}
+
+	const size_t index = line - 1;
+
+	if (index < _prefixSize) {
+		return line;
+	}
+
+	if (index >= _baseLines.size() - _suffixSize) {
+		return static_cast<unsigned>(index + _newLines.size() - _baseLines.size() + 1);
+	}
+
+	const size_t newChangedEnd = _newLines.size() - _suffixSize;
+
+	// line is kept at its place inside the changed block (i.e. the next line is fixed in place).
+	if (index < newChangedEnd && _newLines[index] == _baseLines[index]) {
+		return line;
+	}
+
+	if (_baseLines[index].find_first_not_of(" \t") == std::string_view::npos) {
+		return std::nullopt;
+	}
+
+	std::optional<size_t> nearest;
+	for (size_t i = _prefixSize; i < newChangedEnd; ++i) {
+		const auto distance = [index](size_t newIndex) {
+			return newIndex > index ? newIndex - index : index - newIndex;
+		};
+
+		if (_newLines[i] == _baseLines[index] && (!nearest || distance(i) < distance(*nearest))) {
+			nearest = i;
+		}
+	}
+
+	if (!nearest) {
+		return std::nullopt;
+	}
+
+	return static_cast<unsigned>(*nearest + 1);
+}
+
+} // namespace Lua::Debug
@@ -0,0 +1,120 @@
+//◦ Playrix ◦
+#pragma once
+#include <lua-toolkit/debug/adapterprotocol.h>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Lua::Debug {
+
+/**
+	Arguments of the 'hotPatch' request: the new source of the chunk that is already loaded by the lua state.
+*/
+struct HotPatchArguments
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(source),
+			CLASS_FIELD(module),
+			CLASS_FIELD(content),
+			CLASS_FIELD(baseContent)
+		)
+	)
+#pragma endregion
+
+	/* Patched source: its path is the chunk name (the name source breakpoints are matched with). */
+	Runtime::Dap::Source source;
+
+	/* Name of the module (package.loaded entry) which functions are replaced. Global functions are replaced when empty. */
+	std::string module;
+
+	/* New source text. */
+	std::string content;
+
+	/**
+		Source text the running code was loaded from: breakpoints are remapped by the difference with the new content.
+		Content of the previous patch of the same source is used when it is not specified.
+	*/
+	std::optional<std::string> baseContent;
+};
+
+
+struct HotPatchResponseBody
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(replacedFunctions),
+			CLASS_FIELD(addedFunctions),
+			CLASS_FIELD(breakpoints)
+		)
+	)
+#pragma endregion
+
+	std::vector<std::string> replacedFunctions;
+
+	std::vector<std::string> addedFunctions;
+
+	/* Source breakpoints of the patched source, lines are remapped to the new content. */
+	std::vector<Runtime::Dap::Breakpoint> breakpoints;
+};
+
+
+/**
+	Chunk compiled off the lua thread (by the separate lua state) and given to the patched state as the bytecode.
+*/
+struct CompiledChunk
+{
+	std::string chunkName;
+	std::string bytecode;
+};
+
+
+/**
+	Can be called on any thread. Throws DapRequestError with the syntax error.
+*/
+CompiledChunk CompileChunk(std::string_view content, std::string chunkName);
+
+
+/**
+	Must be called on the lua thread at the safe point (debug hook or stopped state).
+	Chunk is executed in the sandbox environment (globals are readable, assignments stay in the sandbox).
+	Functions of the table returned by the chunk (sandbox globals when module is empty) replace the functions with the same names
+	in the module table (globals), nested tables are patched the same way when the target has the table with the same key
+	(i.e. M.Class:method is reported as "Class.method"). Replaced function's environment and upvalues are transferred to the new one by name:
+	data upvalues keep the running state (i.e. module local caches), function upvalues (local helpers) keep the new code and get their state transferred recursively.
+	LuaJIT joins the data upvalues with the old closures; PUC Lua 5.1 can not join them, so they are copied (assignments are not seen by both).
+	Limitations: chunk's top-level statements are executed again, references to the old functions held elsewhere (i.e. registered callbacks) keep the old code.
+*/
+HotPatchResponseBody PatchFunctions(lua_State*, const CompiledChunk&, const std::string& module);
+
+
+/**
+	Maps lines of the base text to the lines of the new text: unchanged prefix and suffix are mapped by the offset,
+	changed lines are mapped to the nearest equal line of the changed block of the new text.
+*/
+class LineRemapper
+{
+public:
+
+	LineRemapper(std::string_view baseContent, std::string_view newContent);
+
+	/* Line numbers are 1-based. Returns nullopt when the line is removed or changed. */
+	std::optional<unsigned> Map(unsigned line) const;
+
+private:
+
+	std::vector<std::string_view> _baseLines;
+	std::vector<std::string_view> _newLines;
+	size_t _prefixSize = 0;
+	size_t _suffixSize = 0;
+};
+
+} // namespace Lua::Debug
@@ -1,6 +1,18 @@
 //◦ Playrix ◦
 #include "luastacktraceprovider.h"
-
+#include "lua-toolkit/debug/dapcommandhandler.h"
+
+extern "C" {
+#if __has_include(<luajit.h>)
+#include <luajit.h>
+#endif
+
+// LuaJIT hooks are not called while any hook is running: the active flag is reset for the evaluation (see Evaluate).
+#if defined(LUAJIT_VERSION) && __has_include(<lj_obj.h>)
+#include <lj_obj.h>
+#define LUA_TOOLKIT_LUAJIT_HOOK_STATE
+#endif
+}
 
 namespace Lua::Debug {
 
@@ -8,6 +20,175 @@ using namespace Runtime;
 using namespace Runtime::Debug;
 using namespace Core;
 
+namespace {
+
+/**
+	Registry keys:
+		compiled expressions are kept between stops (watches are re-evaluated on every stop),
+		pinned values are kept only while execution is stopped.
+*/
+constexpr const char* ExpressionsCacheKey = "__lua_DebuggerExpressions";
+constexpr const char* PinnedValuesKey = "__lua_DebuggerPinnedValues";
+
+/**
+	Max number of VM instructions that single expression evaluation is allowed to execute.
+*/
+constexpr int EvaluationInstructionsBudget = 1'000'000;
+
+/**
+	Max number of the table entries enumerated when the table variable is shown, the rest is enumerated on the children request.
+*/
+constexpr size_t EagerEnumerationLimit = 100;
+
+/**
+	Max number of the children returned by the variables request that does not specify the count.
+*/
+constexpr size_t DefaultVariablesPageSize = 1000;
+
+/**
+	Expressions cache: expression -> { compiled function, last use stamp }, least recently used expression is evicted when the limit is reached.
+	Cache's integer keys hold the use clock and the number of the cached expressions.
+*/
+constexpr int ExpressionsCacheLimit = 64;
+constexpr int CacheClockIndex = 1;
+constexpr int CacheSizeIndex = 2;
+constexpr int EntryFunctionIndex = 1;
+constexpr int EntryStampIndex = 2;
+
+
+/**
+	Frame environment lookup of the name that is not set in the environment table (upvalues: names of the nil locals, frame function's globals).
+	Nil local (or upvalue) shadows the global with the same name, as it does in the frame's code.
+*/
+int IndexFrameEnvironment(lua_State* l) {
+	lua_pushvalue(l, 2);
+	lua_rawget(l, lua_upvalueindex(1));
+	if (lua_toboolean(l, -1)) {
+		lua_pushnil(l);
+		return 1;
+	}
+
+	lua_pushvalue(l, 2);
+	lua_gettable(l, lua_upvalueindex(2));
+	return 1;
+}
+
+
+/**
+	Assignment to the nil local stays in the environment table, other names are assigned in the frame function's globals.
+*/
+int NewIndexFrameEnvironment(lua_State* l) {
+	lua_pushvalue(l, 2);
+	lua_rawget(l, lua_upvalueindex(1));
+	const bool isLocal = lua_toboolean(l, -1) != 0;
+	lua_settop(l, 3);
+
+	if (isLocal) {
+		lua_rawset(l, 1);
+	}
+	else {
+		lua_settable(l, lua_upvalueindex(2));
+	}
+
+	return 0;
+}
+
+
+/**
+	Sets the local (or upvalue) value at the top of the stack, nil value is recorded in the nil locals table.
+*/
+void SetFrameVariable(lua_State* l, int env, int nilLocals, const char* name) {
+	lua_pushboolean(l, lua_isnil(l, -1));
+	lua_setfield(l, nilLocals, name);
+	lua_setfield(l, env, name);
+}
+
+
+int LoadChunk(lua_State* l, std::string_view code) {
+
+	const auto reader = [](lua_State*, void* data, size_t* size) -> const char* {
+		auto& chunk = *reinterpret_cast<std::string_view*>(data);
+		if (chunk.empty()) {
+			*size = 0;
+			return nullptr;
+		}
+
+		*size = chunk.size();
+		const char* const bytes = chunk.data();
+		chunk = {};
+		return bytes;
+	};
+
+	return lua_load(l, reader, &code, "=(evaluate)");
+}
+
+
+lua_Integer GetCacheCounter(lua_State* l, int cache, int index) {
+	lua_rawgeti(l, cache, index);
+	const lua_Integer value = lua_tointeger(l, -1);
+	lua_pop(l, 1);
+
+	return value;
+}
+
+
+void SetCacheCounter(lua_State* l, int cache, int index, lua_Integer value) {
+	lua_pushinteger(l, value);
+	lua_rawseti(l, cache, index);
+}
+
+
+/**
+	Integer keys are shown without the fraction, keys beyond the int64 range are shown as lua formats them.
+*/
+std::string FormatIndex(lua_Number index) {
+	constexpr lua_Number Int64Limit = 9223372036854775808.0;
+
+	if (index >= -Int64Limit && index < Int64Limit) {
+		return std::to_string(static_cast<int64_t>(index));
+	}
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.14g", index);
+
+	return buffer;
+}
+
+
+void EvictLeastRecentExpression(lua_State* l, int cache) {
+	// expression key of the least recent entry is kept on the stack while the cache is traversed.
+	lua_pushnil(l);
+	const int leastRecentKey = lua_gettop(l);
+	std::optional<lua_Integer> leastRecentStamp;
+
+	lua_pushnil(l);
+	while (lua_next(l, cache) != 0) {
+		if (lua_type(l, -2) == LUA_TSTRING && lua_istable(l, -1)) {
+			lua_rawgeti(l, -1, EntryStampIndex);
+			const lua_Integer stamp = lua_tointeger(l, -1);
+			lua_pop(l, 1);
+
+			if (!leastRecentStamp || stamp < *leastRecentStamp) {
+				leastRecentStamp = stamp;
+				lua_pushvalue(l, -2);
+				lua_replace(l, leastRecentKey);
+			}
+		}
+
+		lua_pop(l, 1);
+	}
+
+	if (leastRecentStamp) {
+		lua_pushnil(l);
+		lua_rawset(l, cache);
+	}
+	else {
+		lua_pop(l, 1);
+	}
+}
+
+} // namespace
+
 LuaStackTraceProvider::StackFrameEntry::StackFrameEntry(LuaStackTraceProvider& provider, unsigned frameId, int level)
 	: _id(frameId)
 	, _level(level)
@@ -53,36 +234,28 @@ std::vector<Dap::Scope> LuaStackTraceProvider::StackFrameEntry::GetScopes(LuaSta
 
 	if (_scopes.empty()) {
 
-		const auto GetScope = [&](std::string_view name) -> Dap::Scope& {
+		const auto AddScope = [&](std::string_view name, FrameScope scope) -> VariableEntry& {
+			const unsigned varRef = provider.NewVariable(*this, scope);
+			_scopes.emplace_back(name, varRef);
 
-			auto scp = std::find_if(_scopes.begin(), _scopes.end(), [name](const Dap::Scope& s) { return s.name == name; });
-
-			if (scp != _scopes.end()) {
-				return *scp;
-			}
-
-			const unsigned varRef = provider.NewVariable(*this);
-
-			return _scopes.emplace_back(name, varRef);
+			return provider.GetVariableEntry(varRef);
 		};
 
-
+		lua_State* const l = provider._lua;
 		lua_Debug* const ar = provider._ar;
 
-		if (lua_getstack(provider._lua, _level, ar) == 0) {
+		if (lua_getstack(l, _level, ar) == 0) {
 			LOG_WARN("Fail to activate stack frame");
 			return {};
 		}
 
-		Dap::Scope& locals = GetScope("Locals");
-		locals.presentationHint.emplace("locals");
-
-		auto& localsVar = provider.GetVariableEntry(locals.variablesReference);
+		auto& localsVar = AddScope("Locals", FrameScope::Locals);
+		_scopes.back().presentationHint.emplace("locals");
 
 		int n = 0;
 		do
 		{
-			const char* const name = lua_getlocal(provider._lua, ar, ++n);
+			const char* const name = lua_getlocal(l, ar, ++n);
 			if (name == nullptr){
 				break;
 			}
@@ -91,10 +264,34 @@ std::vector<Dap::Scope> LuaStackTraceProvider::StackFrameEntry::GetScopes(LuaSta
 				localsVar.AddChild(provider, name, n);
 			}
 
-			lua_pop(provider._lua, 1);
+			lua_pop(l, 1);
 		}
 		while (true);
 
+		lua_getinfo(l, "f", ar);
+
+		VariableEntry* upvaluesVar = nullptr;
+
+		for (n = 1; const char* const name = lua_getupvalue(l, -1, n); ++n) {
+			lua_pop(l, 1);
+
+			// C function upvalues have no names
+			if (*name == '\0') {
+				continue;
+			}
+
+			if (!upvaluesVar) {
+				upvaluesVar = &AddScope("Upvalues", FrameScope::Upvalues);
+			}
+
+			upvaluesVar->AddChild(provider, name, n);
+		}
+
+		lua_pop(l, 1);
+
+		// Globals can hold huge amount of entries: scope is marked as expensive and enumerated only on demand.
+		Dap::Scope& globals = _scopes.emplace_back("Globals", provider.GetGlobalsVariable());
+		globals.expensive = true;
 	}
 
 
@@ -111,17 +308,25 @@ LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, Variab
 }
 
 
-LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, VariableEntry& parentVariable, int index)
+LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, VariableEntry& parentVariable, lua_Number index)
 	: _referenceId(referenceId)
-	, _name(std::to_string(index))
+	, _name(FormatIndex(index))
 	, _indexedKey(index)
 	, _parentVariableId(parentVariable.Id())
 {}
 
 
-LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, StackFrameEntry& parentFrame)
+LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, StackFrameEntry& parentFrame, FrameScope scope)
 	: _referenceId(referenceId)
 	, _parentFrame(parentFrame.Id())
+	, _frameScope(scope)
+{}
+
+
+LuaStackTraceProvider::VariableEntry::VariableEntry(unsigned referenceId, std::string_view name, int pinnedIndex)
+	: _referenceId(referenceId)
+	, _name(name)
+	, _pinnedIndex(pinnedIndex)
 {}
 
 
@@ -140,7 +345,7 @@ bool LuaStackTraceProvider::VariableEntry::IsIndexed() const {
 }
 
 
-int LuaStackTraceProvider::VariableEntry::GetIndex() const {
+lua_Number LuaStackTraceProvider::VariableEntry::GetIndex() const {
 	Assert(IsIndexed());
 	return *_indexedKey;
 }
@@ -160,12 +365,12 @@ const Dap::Variable& LuaStackTraceProvider::VariableEntry::GetVariable(LuaStackT
 		Dap::Variable& variable = _variableInfo.emplace(_referenceId, std::move(_name));
 		variable.presentationHint.emplace().kind = "property";
 
+		// Entry that holds children: the same table reached through the different paths (or through the cycle) is enumerated only once.
+		const VariableEntry* childrenOwner = this;
+
 		if (!_parentFrame) {
-		
-			Assert(_parentVariableId);
-		
-			auto& parent = provider.GetVariableEntry(*_parentVariableId);
-			if (parent.PushChildValue(provider, *this)) {
+
+			if (PushValue(provider)) {
 
 				const int valueType = lua_type(l, -1);
 
@@ -194,31 +399,24 @@ const Dap::Variable& LuaStackTraceProvider::VariableEntry::GetVariable(LuaStackT
 				}
 				else if (valueType == LUA_TTABLE) {
 
-					lua_pushnil(l);
-					while (lua_next(l, -2) != 0) {
-
-						constexpr int KeyIndex = -2;
+					const auto [table, isNewTable] = provider._tableVariables.emplace(lua_topointer(l, -1), _referenceId);
 
-						const int keyType = lua_type(l, KeyIndex);
+					if (isNewTable) {
+						// table is pinned until ReleaseValues: its address is not reused by another table while it identifies the entry.
+						lua_pushvalue(l, -1);
+						provider.PinValue();
 
-						if (keyType == LUA_TNUMBER) {
-							const int index = static_cast<int>(lua_tointeger(l, KeyIndex));
-							this->AddChild(provider, index);
-						}
-						else if (keyType == LUA_TSTRING) {
-							size_t len;
-							const char* const value = lua_tolstring(l, KeyIndex, &len);
-							std::string_view name{value, len};
-							this->AddChild(provider, name);
-						}
-						else {
-							// Unsupported index type
+						// large table is enumerated further only when its children are requested.
+						EnumerateTable(provider, lua_gettop(l), {}, EagerEnumerationLimit);
+						if (!_enumerationComplete) {
+							SetLazyTable();
 						}
-						
-						lua_pop(l, 1);
+					}
+					else {
+						childrenOwner = &provider.GetVariableEntry(table->second);
 					}
 
-					variable.type = _namedChildren.empty() && !_indexedChildren.empty() ? "array" : "object";
+					variable.type = childrenOwner->_namedChildren.empty() && !childrenOwner->_indexedChildren.empty() ? "array" : "object";
 				}
 				else if (valueType == LUA_TFUNCTION) {
 
@@ -236,16 +434,21 @@ const Dap::Variable& LuaStackTraceProvider::VariableEntry::GetVariable(LuaStackT
 		}
 
 
-		if (_namedChildren.empty() && _indexedChildren.empty()) {
+		if (childrenOwner->_isLazyTable) {
+			variable.variablesReference = childrenOwner->Id();
+		}
+		else if (childrenOwner->_namedChildren.empty() && childrenOwner->_indexedChildren.empty()) {
 			variable.variablesReference = 0;
 		}
 		else {
-			if (!_namedChildren.empty()) {
-				variable.namedVariables = static_cast<unsigned>(_namedChildren.size());
+			variable.variablesReference = childrenOwner->Id();
+
+			if (!childrenOwner->_namedChildren.empty()) {
+				variable.namedVariables = static_cast<unsigned>(childrenOwner->_namedChildren.size());
 			}
 
-			if (!_indexedChildren.empty()) {
-				variable.indexedVariables = static_cast<unsigned>(_indexedChildren.size());
+			if (!childrenOwner->_indexedChildren.empty()) {
+				variable.indexedVariables = static_cast<unsigned>(childrenOwner->_indexedChildren.size());
 			}
 
 		}
@@ -258,32 +461,151 @@ const Dap::Variable& LuaStackTraceProvider::VariableEntry::GetVariable(LuaStackT
 void LuaStackTraceProvider::VariableEntry::AddChild(LuaStackTraceProvider& provider, std::string_view name, std::optional<int> indexOnFrame) {
 	const auto childId = provider.NewVariable(*this, name, indexOnFrame);
 	_namedChildren.push_back(childId);
+	_children.push_back(childId);
 }
 
-void LuaStackTraceProvider::VariableEntry::AddChild(LuaStackTraceProvider& provider, int index) {
+void LuaStackTraceProvider::VariableEntry::AddChild(LuaStackTraceProvider& provider, lua_Number index) {
 	const auto childId = provider.NewVariable(*this, index);
 	_indexedChildren.push_back(childId);
+	_children.push_back(childId);
 }
 
 
 std::vector<Dap::Variable> LuaStackTraceProvider::VariableEntry::GetChildren(LuaStackTraceProvider& provider, const Dap::VariablesArguments& args) {
 
+	const size_t start = args.start.value_or(0);
+	const size_t count = args.count.value_or(0);
+	const size_t end = start + (count == 0 ? DefaultVariablesPageSize : count);
+
+	if (_isLazyTable && !_enumerationComplete && ChildrenCount(args.filter) < end) {
+
+		lua_State* const l = provider._lua;
+
+		const auto top = lua_gettop(l);
+
+		SCOPE_Leave {
+			lua_settop(l, top);
+		};
+
+		if (PushValue(provider) && lua_type(l, -1) == LUA_TTABLE) {
+			EnumerateTable(provider, lua_gettop(l), args.filter, end);
+		}
+	}
+
+	// pages are taken in the enumeration order: the lazy enumeration only appends, so the pages taken so far stay in place.
+	const std::vector<unsigned>& children = args.filter == "indexed" ? _indexedChildren : args.filter == "named" ? _namedChildren : _children;
+
+	const auto first = children.begin() + std::min(start, children.size());
+	const auto last = children.begin() + std::min(end, children.size());
+
 	std::vector<Dap::Variable> variables;
-	variables.reserve(_indexedChildren.size() + _namedChildren.size());
+	variables.reserve(std::distance(first, last));
 
-	if (args.filter.empty() || args.filter == "indexed") {
-		std::transform(_indexedChildren.begin(), _indexedChildren.end(), std::back_inserter(variables), [&provider](unsigned variableId) {
-			return provider.GetVariableEntry(variableId).GetVariable(provider);
-		});
+	std::transform(first, last, std::back_inserter(variables), [&provider](unsigned variableId) {
+		return provider.GetVariableEntry(variableId).GetVariable(provider);
+	});
+
+	return variables;
+}
+
+
+void LuaStackTraceProvider::VariableEntry::SetLazyTable() {
+	_isLazyTable = true;
+}
+
+
+void LuaStackTraceProvider::VariableEntry::EnumerateTable(LuaStackTraceProvider& provider, int tableIndex, std::string_view filter, size_t limit) {
+
+	lua_State* const l = provider._lua;
+
+	// Enumeration is resumed from the last enumerated key.
+	if (_lastEnumeratedChild) {
+		const auto& lastChild = provider.GetVariableEntry(*_lastEnumeratedChild);
+		if (lastChild.IsIndexed()) {
+			lua_pushnumber(l, lastChild.GetIndex());
+		}
+		else {
+			lua_pushlstring(l, lastChild.GetName().data(), lastChild.GetName().size());
+		}
+
+		// table can be changed by the evaluated expression: lua_next raises an (unprotected) error for the key that is not in the table.
+		lua_pushvalue(l, -1);
+		lua_rawget(l, tableIndex);
+		const bool isKeyPresent = !lua_isnil(l, -1);
+		lua_pop(l, 1);
+
+		if (!isKeyPresent) {
+			lua_pop(l, 1);
+			_enumerationComplete = true;
+			return;
+		}
 	}
+	else {
+		lua_pushnil(l);
+	}
+
+	while (ChildrenCount(filter) < limit) {
+
+		if (lua_next(l, tableIndex) == 0) {
+			_enumerationComplete = true;
+			return;
+		}
+
+		++provider._enumeratedCount;
+
+		constexpr int KeyIndex = -2;
+
+		const int keyType = lua_type(l, KeyIndex);
+
+		if (keyType == LUA_TNUMBER && std::floor(lua_tonumber(l, KeyIndex)) == lua_tonumber(l, KeyIndex)) {
+			this->AddChild(provider, lua_tonumber(l, KeyIndex));
+			_lastEnumeratedChild = _indexedChildren.back();
+		}
+		else if (keyType == LUA_TSTRING) {
+			size_t len;
+			const char* const value = lua_tolstring(l, KeyIndex, &len);
+			std::string_view name{value, len};
+			this->AddChild(provider, name);
+			_lastEnumeratedChild = _namedChildren.back();
+		}
+		else {
+			// Unsupported index type
+		}
 
-	if (args.filter.empty() || args.filter == "named") {
-		std::transform(_namedChildren.begin(), _namedChildren.end(), std::back_inserter(variables), [&provider](unsigned variableId) {
-			return provider.GetVariableEntry(variableId).GetVariable(provider);
-		});
+		lua_pop(l, 1);
 	}
 
-	return variables;
+	// pop the key of the last enumerated entry
+	lua_pop(l, 1);
+}
+
+
+size_t LuaStackTraceProvider::VariableEntry::ChildrenCount(std::string_view filter) const {
+	const size_t indexed = filter.empty() || filter == "indexed" ? _indexedChildren.size() : 0;
+	const size_t named = filter.empty() || filter == "named" ? _namedChildren.size() : 0;
+
+	return indexed + named;
+}
+
+
+bool LuaStackTraceProvider::VariableEntry::PushValue(LuaStackTraceProvider& provider) const {
+
+	auto l = provider._lua;
+
+	if (_pinnedIndex) {
+		lua_getfield(l, LUA_REGISTRYINDEX, PinnedValuesKey);
+		Assert(lua_type(l, -1) == LUA_TTABLE);
+
+		lua_rawgeti(l, -1, *_pinnedIndex);
+		lua_remove(l, -2);
+
+		return true;
+	}
+
+	Assert(_parentVariableId);
+
+	auto& parent = provider.GetVariableEntry(*_parentVariableId);
+	return parent.PushChildValue(provider, *this);
 }
 
 
@@ -299,18 +621,27 @@ bool LuaStackTraceProvider::VariableEntry::PushChildValue(LuaStackTraceProvider&
 
 		auto& frame = provider.GetStackFrameEntry(*_parentFrame);
 		lua_getstack(l, frame.Level(), ar);
+
+		if (_frameScope == FrameScope::Upvalues) {
+			lua_getinfo(l, "f", ar);
+			if (lua_getupvalue(l, -1, *child._indexOnFrame) == nullptr) {
+				lua_pop(l, 1);
+				return false;
+			}
+
+			lua_remove(l, -2);
+			return true;
+		}
+
 		return lua_getlocal(l, ar, *child._indexOnFrame) != nullptr;
 	}
 	else {
-		Assert(this->_parentVariableId);
-
-		auto& parentVariable = provider.GetVariableEntry(*this->_parentVariableId);
-		parentVariable.PushChildValue(provider, *this);
+		this->PushValue(provider);
 
 		Assert(lua_type(l, -1) == LUA_TTABLE);
 
 		if (child.IsIndexed()) {
-			lua_pushinteger(l, child.GetIndex());
+			lua_pushnumber(l, child.GetIndex());
 		}
 		else {
 			lua_pushstring(l, child.GetName().c_str());
@@ -333,13 +664,8 @@ LuaStackTraceProvider::LuaStackTraceProvider(lua_State* luaState, lua_Debug* ar)
 
 Dap::StackTraceResponseBody LuaStackTraceProvider::GetStackTrace(Dap::StackTraceArguments args) {
 
-	if (_stackFrames.empty()) {
-		unsigned frameId = 0;
-		
-		for (int level = 0; lua_getstack(_lua, level, _ar) != 0; ++level) {
-			_stackFrames.emplace_back(*this, ++frameId, level);
-		}
-	}
+	ThrowIfInvalidated();
+	EnsureStackFrames();
 
 	Dap::StackTraceResponseBody response;
 	response.stackFrames.reserve(_stackFrames.size());
@@ -348,31 +674,176 @@ Dap::StackTraceResponseBody LuaStackTraceProvider::GetStackTrace(Dap::StackTrace
 	});
 
 
-	return response;
+	return response.GetFramesPage(args);
+}
+
+
+size_t LuaStackTraceProvider::GetEnumeratedCount() const {
+	return _enumeratedCount;
 }
 
 
 std::vector<Dap::Scope> LuaStackTraceProvider::GetScopes(unsigned frameId) {
+	ThrowIfInvalidated();
 	auto& frame = GetStackFrameEntry(frameId);
 	return frame.GetScopes(*this);
 }
 
 
 std::vector<Dap::Variable> LuaStackTraceProvider::GetVariables(Runtime::Dap::VariablesArguments arg) {
+	ThrowIfInvalidated();
 	auto& variableEntry = GetVariableEntry(arg.variablesReference);
 	return variableEntry.GetChildren(*this, arg);
 }
 
 
+Dap::EvaluateResponseBody LuaStackTraceProvider::Evaluate(Dap::EvaluateArguments args) {
+
+	ThrowIfInvalidated();
+
+	lua_State* const l = _lua;
+
+	const auto top = lua_gettop(l);
+
+	SCOPE_Leave {
+		lua_settop(l, top);
+	};
+
+	EnsureStackFrames();
+
+	const int level = args.frameId ? GetStackFrameEntry(*args.frameId).Level() : 0;
+	if (lua_getstack(l, level, _ar) == 0) {
+		throw std::runtime_error("Fail to activate stack frame");
+	}
+
+	if (!PushCompiledExpression(args.expression)) {
+		const char* const error = lua_tostring(l, -1);
+		throw std::runtime_error(error ? error : "Fail to compile expression");
+	}
+
+	const int function = lua_gettop(l);
+
+	// cached function must not keep the frame environment (locals of the frame) alive after the evaluation.
+	SCOPE_Leave {
+		lua_pushvalue(l, LUA_GLOBALSINDEX);
+		lua_setfenv(l, function);
+	};
+
+	PushFrameEnvironment();
+	lua_setfenv(l, function);
+
+	// Expression is executed on the separate coroutine with the count hook that limits the number of executed instructions,
+	// and the debugger hook does not re-enter. LuaJIT hook is global (not the coroutine's one): the debugger hook is restored after the evaluation.
+	const lua_Hook hook = lua_gethook(l);
+	const int hookMask = lua_gethookmask(l);
+	const int hookCount = lua_gethookcount(l);
+
+	SCOPE_Leave {
+		lua_sethook(l, hook, hookMask, hookCount);
+	};
+
+#ifdef LUA_TOOLKIT_LUAJIT_HOOK_STATE
+	// LuaJIT does not call hooks while the debugger hook is running (blocking stop): the budget hook could not fire.
+	global_State* const g = G(l);
+	const uint8_t activeHook = g->hookmask & HOOK_ACTIVE;
+	g->hookmask &= ~HOOK_ACTIVE;
+
+	SCOPE_Leave {
+		g->hookmask |= activeHook;
+	};
+#elif defined(LUAJIT_VERSION)
+	// without LuaJIT internals the budget is enforced only for the evaluations outside of the hook (cooperative stop).
+#endif
+
+	lua_State* const thread = lua_newthread(l);
+	lua_pushvalue(l, function);
+	lua_sethook(thread, [](lua_State* l, lua_Debug*) {
+		lua_pushstring(l, "Evaluation instructions budget exceeded");
+		lua_error(l);
+	}
+	, LUA_MASKCOUNT, EvaluationInstructionsBudget);
+
+	lua_xmove(l, thread, 1);
+
+	if (const int status = lua_resume(thread, 0); status != 0) {
+		if (status == LUA_YIELD) {
+			throw std::runtime_error("Expression can not yield");
+		}
+
+		const char* const error = lua_tostring(thread, -1);
+		throw std::runtime_error(error ? error : "Evaluation failed");
+	}
+
+	if (lua_gettop(thread) == 0) {
+		lua_pushnil(thread);
+	}
+
+	lua_settop(thread, 1);
+	lua_xmove(thread, l, 1);
+
+	const unsigned variableId = NewVariable(args.expression, PinValue());
+	const Dap::Variable& variable = GetVariableEntry(variableId).GetVariable(*this);
+
+	Dap::EvaluateResponseBody body;
+	body.result = variable.value;
+	body.type = variable.type;
+	body.variablesReference = variable.variablesReference;
+	body.namedVariables = variable.namedVariables;
+	body.indexedVariables = variable.indexedVariables;
+
+	return body;
+}
+
+
+void LuaStackTraceProvider::ReleaseValues() {
+	lua_pushnil(_lua);
+	lua_setfield(_lua, LUA_REGISTRYINDEX, PinnedValuesKey);
+	_pinnedCount = 0;
+	_globalsVariableId.reset();
+	_tableVariables.clear();
+}
+
+
+void LuaStackTraceProvider::Invalidate() {
+	ReleaseValues();
+	_isInvalidated = true;
+}
+
+
+void LuaStackTraceProvider::ThrowIfInvalidated() const {
+	if (_isInvalidated) {
+		throw DapRequestError("Stopped execution is resumed by the lua code");
+	}
+}
+
+
+void LuaStackTraceProvider::EnsureStackFrames() {
+
+	if (!_stackFrames.empty()) {
+		return;
+	}
+
+	unsigned frameId = 0;
+
+	for (int level = 0; lua_getstack(_lua, level, _ar) != 0; ++level) {
+		_stackFrames.emplace_back(*this, ++frameId, level);
+	}
+}
+
+
 LuaStackTraceProvider::StackFrameEntry& LuaStackTraceProvider::GetStackFrameEntry(unsigned frameId) {
 	auto frame = std::find_if(_stackFrames.begin(), _stackFrames.end(), [frameId](const StackFrameEntry& entry) { return entry.Id() == frameId; });
-	Assert2(frame != _stackFrames.end(), "Invalid frame id");
+	// frame id comes from the client: unknown id fails the request, not the session.
+	if (frame == _stackFrames.end()) {
+		throw DapRequestError(Core::Format::format("Invalid frame id ({})", frameId));
+	}
+
 	return *frame;
 }
 
 
-unsigned LuaStackTraceProvider::NewVariable(StackFrameEntry& parentStack) {
-	return _variables.emplace_back(++_variableRefId, parentStack).Id();
+unsigned LuaStackTraceProvider::NewVariable(StackFrameEntry& parentStack, FrameScope scope) {
+	return _variables.emplace_back(++_variableRefId, parentStack, scope).Id();
 }
 
 
@@ -381,15 +852,169 @@ unsigned LuaStackTraceProvider::NewVariable(VariableEntry& parentVariable, std::
 }
 
 
-unsigned LuaStackTraceProvider::NewVariable(VariableEntry& parentVariable, int index) {
+unsigned LuaStackTraceProvider::NewVariable(VariableEntry& parentVariable, lua_Number index) {
 	return _variables.emplace_back(++_variableRefId, parentVariable, index).Id();
 }
 
 
+unsigned LuaStackTraceProvider::NewVariable(std::string_view name, int pinnedIndex) {
+	return _variables.emplace_back(++_variableRefId, name, pinnedIndex).Id();
+}
+
+
+bool LuaStackTraceProvider::PushCompiledExpression(const std::string& expression) {
+
+	lua_State* const l = _lua;
+
+	lua_getfield(l, LUA_REGISTRYINDEX, ExpressionsCacheKey);
+	if (lua_isnil(l, -1)) {
+		lua_pop(l, 1);
+		lua_newtable(l);
+		lua_pushvalue(l, -1);
+		lua_setfield(l, LUA_REGISTRYINDEX, ExpressionsCacheKey);
+	}
+
+	const int cache = lua_gettop(l);
+
+	const lua_Integer stamp = GetCacheCounter(l, cache, CacheClockIndex) + 1;
+	SetCacheCounter(l, cache, CacheClockIndex, stamp);
+
+	lua_pushlstring(l, expression.data(), expression.size());
+	lua_rawget(l, cache);
+
+	if (lua_istable(l, -1)) {
+		lua_pushinteger(l, stamp);
+		lua_rawseti(l, -2, EntryStampIndex);
+		lua_rawgeti(l, -1, EntryFunctionIndex);
+		lua_remove(l, -2);
+		lua_remove(l, cache);
+		return true;
+	}
+
+	lua_pop(l, 1);
+
+	// Expression is compiled as 'return <expression>' first, that allows to get a value, but statements (i.e. from repl) must be accepted also.
+	if (LoadChunk(l, "return " + expression) != 0) {
+		lua_pop(l, 1);
+		if (LoadChunk(l, expression) != 0) {
+			lua_remove(l, cache);
+			return false;
+		}
+	}
+
+	const lua_Integer size = GetCacheCounter(l, cache, CacheSizeIndex);
+	if (size >= ExpressionsCacheLimit) {
+		EvictLeastRecentExpression(l, cache);
+	}
+	else {
+		SetCacheCounter(l, cache, CacheSizeIndex, size + 1);
+	}
+
+	lua_pushlstring(l, expression.data(), expression.size());
+	lua_createtable(l, 2, 0);
+	lua_pushvalue(l, -3);
+	lua_rawseti(l, -2, EntryFunctionIndex);
+	lua_pushinteger(l, stamp);
+	lua_rawseti(l, -2, EntryStampIndex);
+	lua_rawset(l, cache);
+
+	lua_remove(l, cache);
+	return true;
+}
+
+
+void LuaStackTraceProvider::PushFrameEnvironment() {
+
+	lua_State* const l = _lua;
+
+	lua_newtable(l);
+	const int env = lua_gettop(l);
+
+	lua_newtable(l);
+	const int nilLocals = lua_gettop(l);
+
+	lua_getinfo(l, "f", _ar);
+	const int func = lua_gettop(l);
+
+	// Locals are resolved before upvalues: upvalues are assigned first, so locals with the same name will override them.
+	for (int n = 1; const char* const name = lua_getupvalue(l, func, n); ++n) {
+		if (*name != '\0') {
+			SetFrameVariable(l, env, nilLocals, name);
+		}
+		else {
+			lua_pop(l, 1);
+		}
+	}
+
+	for (int n = 1; const char* const name = lua_getlocal(l, _ar, n); ++n) {
+		if (std::string_view{name}.find("(*") != 0) {
+			SetFrameVariable(l, env, nilLocals, name);
+		}
+		else {
+			lua_pop(l, 1);
+		}
+	}
+
+	// Everything else is resolved through the frame function's globals.
+	lua_newtable(l);
+
+	lua_pushvalue(l, nilLocals);
+	lua_getfenv(l, func);
+	lua_pushcclosure(l, IndexFrameEnvironment, 2);
+	lua_setfield(l, -2, "__index");
+
+	lua_pushvalue(l, nilLocals);
+	lua_getfenv(l, func);
+	lua_pushcclosure(l, NewIndexFrameEnvironment, 2);
+	lua_setfield(l, -2, "__newindex");
+
+	lua_setmetatable(l, env);
+
+	lua_settop(l, env);
+}
+
+
+int LuaStackTraceProvider::PinValue() {
+
+	lua_State* const l = _lua;
+
+	lua_getfield(l, LUA_REGISTRYINDEX, PinnedValuesKey);
+	if (lua_isnil(l, -1)) {
+		lua_pop(l, 1);
+		lua_newtable(l);
+		lua_pushvalue(l, -1);
+		lua_setfield(l, LUA_REGISTRYINDEX, PinnedValuesKey);
+	}
+
+	lua_insert(l, -2);
+	lua_rawseti(l, -2, ++_pinnedCount);
+	lua_pop(l, 1);
+
+	return _pinnedCount;
+}
+
+
+unsigned LuaStackTraceProvider::GetGlobalsVariable() {
+
+	if (!_globalsVariableId) {
+		lua_pushvalue(_lua, LUA_GLOBALSINDEX);
+		const void* const globalsTable = lua_topointer(_lua, -1);
+
+		_globalsVariableId = NewVariable("Globals", PinValue());
+		_tableVariables.emplace(globalsTable, *_globalsVariableId);
+		GetVariableEntry(*_globalsVariableId).SetLazyTable();
+	}
+
+	return *_globalsVariableId;
+}
+
+
 LuaStackTraceProvider::VariableEntry& LuaStackTraceProvider::GetVariableEntry(unsigned variableId) {
 
 	auto variable = std::find_if(_variables.begin(), _variables.end(), [variableId](const VariableEntry& v) { return v.Id() == variableId;});
-	Assert(variable != _variables.end());
+	if (variable == _variables.end()) {
+		throw DapRequestError(Core::Format::format("Invalid variables reference ({})", variableId));
+	}
 
 	return *variable;
 
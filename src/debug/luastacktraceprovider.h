@@ -2,6 +2,8 @@
 #include <lua-toolkit/debug/stacktraceprovider.h>
 #include <runtime/com/comclass.h>
 
+#include <unordered_map>
+
 extern "C" {
 #include <lua.h>
 }
@@ -23,9 +25,31 @@ public:
 
 	std::vector<Runtime::Dap::Variable> GetVariables(Runtime::Dap::VariablesArguments) override;
 
+	Runtime::Dap::EvaluateResponseBody Evaluate(Runtime::Dap::EvaluateArguments) override;
+
+	size_t GetEnumeratedCount() const override;
+
+	/**
+		Drops references to the values that were kept alive for the stopped state (i.e. evaluation results).
+		Must be called on the lua thread before execution is resumed.
+	*/
+	void ReleaseValues();
+
+	/**
+		Stopped frames are gone (i.e. the suspended coroutine is resumed by the lua code): values are released
+		and the requests fail instead of reading the stale frames. Must be called on the lua thread.
+	*/
+	void Invalidate();
+
 
 private:
 
+	enum class FrameScope
+	{
+		Locals,
+		Upvalues
+	};
+
 	class StackFrameEntry
 	{
 	public:
@@ -51,11 +75,13 @@ private:
 	{
 	public:
 
-		VariableEntry(unsigned referenceId, StackFrameEntry& parentFrame);
+		VariableEntry(unsigned referenceId, StackFrameEntry& parentFrame, FrameScope scope);
 
 		VariableEntry(unsigned referenceId, VariableEntry& parentVariable, std::string_view name, std::optional<int> indexOnFrame = std::nullopt);
 
-		VariableEntry(unsigned referenceId, VariableEntry& parentVariable, int index);
+		VariableEntry(unsigned referenceId, VariableEntry& parentVariable, lua_Number index);
+
+		VariableEntry(unsigned referenceId, std::string_view name, int pinnedIndex);
 
 		unsigned Id() const;
 
@@ -63,52 +89,90 @@ private:
 
 		bool IsIndexed() const;
 
-		int GetIndex() const;
+		lua_Number GetIndex() const;
 
 		const Runtime::Dap::Variable& GetVariable(LuaStackTraceProvider&);
 
 		void AddChild(LuaStackTraceProvider& provider, std::string_view name, std::optional<int> indexOnFrame = std::nullopt);
 
-		void AddChild(LuaStackTraceProvider& provider, int);
+		void AddChild(LuaStackTraceProvider& provider, lua_Number index);
 
 		std::vector<Runtime::Dap::Variable> GetChildren(LuaStackTraceProvider& provider, const Runtime::Dap::VariablesArguments&);
 
+		/**
+			Children of the lazy table are not enumerated up front, but only as far as requested page requires.
+		*/
+		void SetLazyTable();
+
 
 	private:
 
+		bool PushValue(LuaStackTraceProvider& provider) const;
+
 		bool PushChildValue(LuaStackTraceProvider& provider, const VariableEntry& child) const;
 
+		void EnumerateTable(LuaStackTraceProvider& provider, int tableIndex, std::string_view filter, size_t limit);
+
+		size_t ChildrenCount(std::string_view filter) const;
+
 		const unsigned _referenceId;
 		std::string _name;
-		std::optional<int> _indexedKey;
+		// lua_Number: the key is pushed back as the resume key of lua_next and must match the table key exactly.
+		std::optional<lua_Number> _indexedKey;
 
 		std::optional<unsigned> _parentFrame;
+		FrameScope _frameScope = FrameScope::Locals;
 		std::optional<unsigned> _parentVariableId;
 		std::optional<int> _indexOnFrame;
+		std::optional<int> _pinnedIndex;
 
 
 		std::optional<Runtime::Dap::Variable> _variableInfo;
 		std::vector<unsigned> _indexedChildren;
 		std::vector<unsigned> _namedChildren;
+		// indexed and named children in the enumeration order.
+		std::vector<unsigned> _children;
+		std::optional<unsigned> _lastEnumeratedChild;
+		bool _isLazyTable = false;
+		bool _enumerationComplete = false;
 	};
 
 
+	void EnsureStackFrames();
+
 	StackFrameEntry& GetStackFrameEntry(unsigned frameId);
 
-	unsigned NewVariable(StackFrameEntry& parentStack);
+	unsigned NewVariable(StackFrameEntry& parentStack, FrameScope scope);
 
 	unsigned NewVariable(VariableEntry& parentVariable, std::string_view name, std::optional<int> indexOnFrame);
 
-	unsigned NewVariable(VariableEntry& parentVariable, int index);
+	unsigned NewVariable(VariableEntry& parentVariable, lua_Number index);
+
+	unsigned NewVariable(std::string_view name, int pinnedIndex);
+
+	bool PushCompiledExpression(const std::string& expression);
+
+	void PushFrameEnvironment();
+
+	int PinValue();
+
+	unsigned GetGlobalsVariable();
 
 	VariableEntry& GetVariableEntry(unsigned refId);
 
+	void ThrowIfInvalidated() const;
+
 
 	lua_State* const _lua;
 	lua_Debug* _ar;
 	std::vector<StackFrameEntry> _stackFrames;
 	std::list<VariableEntry> _variables;
 	unsigned _variableRefId = 0;
+	int _pinnedCount = 0;
+	size_t _enumeratedCount = 0;
+	std::optional<unsigned> _globalsVariableId;
+	bool _isInvalidated = false;
+	std::unordered_map<const void*, unsigned> _tableVariables; // table identity (lua_topointer, the table is pinned) -> variable that holds its children
 
 };
 
@@ -0,0 +1,193 @@
+//◦ Playrix ◦
+#include "lua-toolkit/debug/protocoltrace.h"
+#include <runtime/threading/lock.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace Runtime::Debug {
+
+namespace {
+
+constexpr std::string_view TraceFileSignature {"LTKTRACE1"};
+
+
+/**
+	Slot is protected with the sequence lock: sequence is odd while the slot is written,
+	reader copies the slot and accepts it only when the sequence is even and was not changed during the copy.
+*/
+struct FrameSlot
+{
+	std::atomic<uint64_t> sequence {0};
+	uint64_t timestamp = 0;
+	ProtocolTrace::Direction direction = ProtocolTrace::Direction::Inbound;
+	uint32_t size = 0;
+	uint32_t recordedSize = 0;
+	std::array<char, ProtocolTrace::MaxRecordedBodySize> body;
+};
+
+
+class FramesRing
+{
+public:
+
+	FramesRing(): _slots(std::make_unique<FrameSlot[]>(ProtocolTrace::MaxFrames)), _startTime(std::chrono::steady_clock::now())
+	{}
+
+	void Record(ProtocolTrace::Direction direction, std::string_view body) {
+		const uint64_t index = _nextIndex.fetch_add(1, std::memory_order_relaxed);
+		FrameSlot& slot = _slots[index % ProtocolTrace::MaxFrames];
+
+		slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _startTime).count());
+		slot.direction = direction;
+		slot.size = static_cast<uint32_t>(body.size());
+		slot.recordedSize = static_cast<uint32_t>(std::min(body.size(), slot.body.size()));
+		memcpy(slot.body.data(), body.data(), slot.recordedSize);
+
+		slot.sequence.store(index * 2 + 2, std::memory_order_release);
+	}
+
+	std::vector<ProtocolTrace::Frame> GetFrames() const {
+		const uint64_t endIndex = _nextIndex.load(std::memory_order_acquire);
+		const uint64_t startIndex = endIndex > ProtocolTrace::MaxFrames ? endIndex - ProtocolTrace::MaxFrames : 0;
+
+		std::vector<ProtocolTrace::Frame> frames;
+		frames.reserve(static_cast<size_t>(endIndex - startIndex));
+
+		for (uint64_t index = startIndex; index < endIndex; ++index) {
+			const FrameSlot& slot = _slots[index % ProtocolTrace::MaxFrames];
+
+			const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence != index * 2 + 2) {
+				// frame is being written or was already overwritten.
+				continue;
+			}
+
+			ProtocolTrace::Frame frame;
+			frame.timestamp = slot.timestamp;
+			frame.direction = slot.direction;
+			frame.size = slot.size;
+			frame.body.assign(slot.body.data(), std::min<size_t>(slot.recordedSize, slot.body.size()));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+				continue;
+			}
+
+			frames.emplace_back(std::move(frame));
+		}
+
+		return frames;
+	}
+
+private:
+
+	std::unique_ptr<FrameSlot[]> _slots;
+	std::atomic<uint64_t> _nextIndex {0};
+	const std::chrono::steady_clock::time_point _startTime;
+};
+
+
+std::mutex s_ringMutex;
+std::atomic<FramesRing*> s_ring {nullptr};
+
+
+template<typename T>
+void WriteValue(std::ofstream& stream, T value) {
+	stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+template<typename T>
+bool ReadValue(std::ifstream& stream, T& value) {
+	return static_cast<bool>(stream.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+void ProtocolTrace::SetEnabled(bool enabled) {
+	if (enabled && !s_ring.load(std::memory_order_acquire)) {
+		// ring is allocated only once and never released: recording threads are not synchronized with disabling.
+		lock_(s_ringMutex);
+		if (!s_ring.load(std::memory_order_relaxed)) {
+			s_ring.store(new FramesRing, std::memory_order_release);
+		}
+	}
+
+	s_isEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+void ProtocolTrace::Record(Direction direction, std::string_view body) {
+	if (FramesRing* const ring = s_ring.load(std::memory_order_acquire)) {
+		ring->Record(direction, body);
+	}
+}
+
+
+bool ProtocolTrace::DumpToFile(const std::string& path) {
+	const FramesRing* const ring = s_ring.load(std::memory_order_acquire);
+
+	std::ofstream stream{path, std::ios::binary | std::ios::trunc};
+	if (!stream) {
+		return false;
+	}
+
+	stream.write(TraceFileSignature.data(), TraceFileSignature.size());
+
+	if (ring) {
+		for (const Frame& frame : ring->GetFrames()) {
+			WriteValue(stream, frame.timestamp);
+			WriteValue(stream, static_cast<uint8_t>(frame.direction));
+			WriteValue(stream, frame.size);
+			WriteValue(stream, static_cast<uint32_t>(frame.body.size()));
+			stream.write(frame.body.data(), frame.body.size());
+		}
+	}
+
+	return static_cast<bool>(stream);
+}
+
+
+std::optional<std::vector<ProtocolTrace::Frame>> ProtocolTrace::ReadFile(const std::string& path) {
+	std::ifstream stream{path, std::ios::binary};
+
+	std::array<char, TraceFileSignature.size()> signature;
+	if (!stream.read(signature.data(), signature.size()) || std::string_view{signature.data(), signature.size()} != TraceFileSignature) {
+		return std::nullopt;
+	}
+
+	std::vector<Frame> frames;
+
+	while (stream.peek() != std::ifstream::traits_type::eof()) {
+		Frame frame;
+		uint8_t direction = 0;
+		uint32_t recordedSize = 0;
+
+		if (!ReadValue(stream, frame.timestamp) || !ReadValue(stream, direction) || !ReadValue(stream, frame.size) || !ReadValue(stream, recordedSize)) {
+			return std::nullopt;
+		}
+
+		frame.direction = static_cast<Direction>(direction);
+		frame.body.resize(recordedSize);
+		if (!stream.read(frame.body.data(), recordedSize)) {
+			return std::nullopt;
+		}
+
+		frames.emplace_back(std::move(frame));
+	}
+
+	return frames;
+}
+
+} // namespace Runtime::Debug
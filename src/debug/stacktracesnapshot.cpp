@@ -0,0 +1,144 @@
+//◦ Playrix ◦
+#include "stacktracesnapshot.h"
+
+#include <deque>
+
+namespace Runtime::Debug {
+
+StackTraceSnapshot::StackTraceSnapshot(StackTraceProvider& provider, const StopSnapshotOptions& options) {
+
+	struct PendingVariable
+	{
+		unsigned variablesReference;
+		std::optional<size_t> indexedCount;
+		unsigned depth;
+	};
+
+	// children of the lazy enumerated table (reference without the children counts) can not be split by the filter.
+	const auto GetIndexedCount = [](const auto& variable) -> std::optional<size_t> {
+		if (!variable.indexedVariables && !variable.namedVariables) {
+			return std::nullopt;
+		}
+
+		return variable.indexedVariables.value_or(0);
+	};
+
+	std::deque<PendingVariable> pending;
+
+	_stackTrace = provider.GetStackTrace({});
+
+	const size_t framesCount = std::min<size_t>(_stackTrace.stackFrames.size(), options.maxFrames);
+
+	for (size_t i = 0; i < framesCount; ++i) {
+		const unsigned frameId = _stackTrace.stackFrames[i].id;
+		auto& scopes = _scopes[frameId] = provider.GetScopes(frameId);
+
+		for (const Dap::Scope& scope : scopes) {
+			if (!scope.expensive) {
+				pending.push_back({scope.variablesReference, GetIndexedCount(scope), 0});
+			}
+		}
+	}
+
+	// Budget is charged for the copied variables and for the entries enumerated by the provider (i.e. table that is shown as the variable
+	// is enumerated to count its children): the work done on the stopped thread is bounded, not only the size of the snapshot.
+	const size_t enumeratedAtStart = provider.GetEnumeratedCount();
+	size_t copiedCount = 0;
+
+	const auto GetRemainingBudget = [&]() -> size_t {
+		const size_t spent = copiedCount + (provider.GetEnumeratedCount() - enumeratedAtStart);
+		return spent < options.maxVariables ? options.maxVariables - spent : 0;
+	};
+
+	// Breadth first: the closest to the frame variables are the most likely to be inspected.
+	while (!pending.empty() && GetRemainingBudget() > 0) {
+
+		const PendingVariable current = pending.front();
+		pending.pop_front();
+
+		if (current.depth >= options.maxDepth || _variables.count(current.variablesReference) > 0) {
+			continue;
+		}
+
+		VariableChildren& children = _variables[current.variablesReference];
+		children.indexedCount = current.indexedCount;
+
+		// children are requested by pages: the budget is checked between the pages.
+		for (size_t remaining = GetRemainingBudget(); remaining > 0 && !children.complete; remaining = GetRemainingBudget()) {
+			Dap::VariablesArguments args;
+			args.variablesReference = current.variablesReference;
+			args.start = static_cast<unsigned>(children.variables.size());
+			args.count = static_cast<unsigned>(std::min(remaining, VariablesPageSize));
+
+			std::vector<Dap::Variable> page = provider.GetVariables(args);
+			children.complete = page.size() < *args.count;
+			copiedCount += page.size();
+
+			for (Dap::Variable& variable : page) {
+				if (variable.variablesReference != 0) {
+					pending.push_back({variable.variablesReference, GetIndexedCount(variable), current.depth + 1});
+				}
+
+				children.variables.push_back(std::move(variable));
+			}
+		}
+	}
+}
+
+
+std::optional<Dap::StackTraceResponseBody> StackTraceSnapshot::GetStackTrace(const Dap::StackTraceArguments& args) const {
+	return _stackTrace.GetFramesPage(args);
+}
+
+
+std::optional<std::vector<Dap::Scope>> StackTraceSnapshot::GetScopes(unsigned frameId) const {
+	auto scopes = _scopes.find(frameId);
+	if (scopes == _scopes.end()) {
+		return std::nullopt;
+	}
+
+	return scopes->second;
+}
+
+
+std::optional<std::vector<Dap::Variable>> StackTraceSnapshot::GetVariables(const Dap::VariablesArguments& args) const {
+
+	auto entry = _variables.find(args.variablesReference);
+	if (entry == _variables.end()) {
+		return std::nullopt;
+	}
+
+	const VariableChildren& children = entry->second;
+
+	// Provider returns indexed children first, then named.
+	auto first = children.variables.begin();
+	auto last = children.variables.end();
+
+	if (!args.filter.empty() && !children.indexedCount) {
+		return std::nullopt;
+	}
+
+	if (args.filter == "indexed") {
+		last = first + std::min(*children.indexedCount, children.variables.size());
+	}
+	else if (args.filter == "named") {
+		first += std::min(*children.indexedCount, children.variables.size());
+	}
+
+	const size_t available = static_cast<size_t>(std::distance(first, last));
+	const size_t start = args.start.value_or(0);
+	const size_t count = args.count.value_or(0);
+
+	if (!children.complete && (count == 0 || start + count > available)) {
+		return std::nullopt;
+	}
+
+	first += std::min(start, available);
+	if (count != 0) {
+		last = first + std::min(count, static_cast<size_t>(std::distance(first, last)));
+	}
+
+	return std::vector<Dap::Variable>{first, last};
+}
+
+} // namespace Runtime::Debug
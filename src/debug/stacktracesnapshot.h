@@ -0,0 +1,47 @@
+//◦ Playrix ◦
+#pragma once
+#include <lua-toolkit/debug/debugsession.h>
+#include <lua-toolkit/debug/stacktraceprovider.h>
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+
+namespace Runtime::Debug {
+
+/**
+	Immutable copy of the stopped state: stack, scopes and variables collected through StackTraceProvider down to the configured depth and size.
+	Must be created on the thread that owns the provider (i.e. stopped lua thread), after that can be accessed concurrently from any thread.
+	Requests that are not covered by the snapshot (out of budget, expensive scopes) must be served by the provider itself.
+*/
+class StackTraceSnapshot
+{
+public:
+
+	StackTraceSnapshot(StackTraceProvider& provider, const StopSnapshotOptions& options);
+
+	std::optional<Dap::StackTraceResponseBody> GetStackTrace(const Dap::StackTraceArguments&) const;
+
+	std::optional<std::vector<Dap::Scope>> GetScopes(unsigned frameId) const;
+
+	std::optional<std::vector<Dap::Variable>> GetVariables(const Dap::VariablesArguments&) const;
+
+private:
+
+	static constexpr size_t VariablesPageSize = 64;
+
+	struct VariableChildren
+	{
+		std::vector<Dap::Variable> variables;
+		// unknown for the lazy enumerated table.
+		std::optional<size_t> indexedCount;
+		bool complete = false;
+	};
+
+	Dap::StackTraceResponseBody _stackTrace;
+	std::unordered_map<unsigned, std::vector<Dap::Scope>> _scopes;
+	std::unordered_map<unsigned, VariableChildren> _variables;
+};
+
+} // namespace Runtime::Debug
@@ -628,6 +628,169 @@ CLASS_INFO(
 };
 
 
+/**
+	An ExceptionBreakpointsFilter is shown in the UI as an filter option for configuring how exceptions are dealt with.
+*/
+struct ExceptionBreakpointsFilter
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(filter),
+			CLASS_FIELD(label),
+			CLASS_FIELD(description),
+			CLASS_NAMED_FIELD(isDefault, "default")
+		)
+	)
+#pragma endregion
+
+	/* The internal ID of the filter option. This value is passed to the 'setExceptionBreakpoints' request. */
+	std::string filter;
+
+	/* The name of the filter option. This is shown in the UI. */
+	std::string label;
+
+	/* A help text providing additional information about the exception filter. */
+	std::optional<std::string> description;
+
+	/* Initial value of the filter option. If not specified a value false is assumed. */
+	bool isDefault = false;
+};
+
+
+/**
+	Information about the capabilities of a debug adapter (body of the 'initialize' response).
+*/
+struct Capabilities
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(supportsConfigurationDoneRequest),
+			CLASS_FIELD(supportsFunctionBreakpoints),
+			CLASS_FIELD(supportsEvaluateForHovers),
+			CLASS_FIELD(supportsExceptionInfoRequest),
+			CLASS_FIELD(supportsDelayedStackTraceLoading),
+			CLASS_FIELD(exceptionBreakpointFilters)
+		)
+	)
+#pragma endregion
+
+	/* The debug adapter supports the 'configurationDone' request. */
+	bool supportsConfigurationDoneRequest = true;
+
+	/* The debug adapter supports function breakpoints. */
+	bool supportsFunctionBreakpoints = true;
+
+	/* The debug adapter supports a (side effect free) evaluate request for data hovers. */
+	bool supportsEvaluateForHovers = true;
+
+	/* The debug adapter supports the 'exceptionInfo' request. */
+	bool supportsExceptionInfoRequest = false;
+
+	/* The debug adapter supports the 'startFrame' and 'levels' arguments of the 'stackTrace' request. */
+	bool supportsDelayedStackTraceLoading = true;
+
+	/* Available exception filter options for the 'setExceptionBreakpoints' request. */
+	std::vector<ExceptionBreakpointsFilter> exceptionBreakpointFilters;
+};
+
+
+/**
+	SetExceptionBreakpoints request; value of command field is 'setExceptionBreakpoints'.
+	The request configures the debuggers response to thrown exceptions.
+	If an exception is configured to break, a 'stopped' event is fired (with reason 'exception').
+*/
+struct SetExceptionBreakpointsArguments
+{
+#pragma region Class info
+CLASS_INFO(
+	CLASS_FIELDS(
+		CLASS_FIELD(filters)
+	)
+)
+#pragma endregion
+
+	/* Set of exception filters specified by their ID. The set of all possible exception filters is defined by the 'exceptionBreakpointFilters' capability. */
+	std::vector<std::string> filters;
+};
+
+
+/**
+	ExceptionInfo request; value of command field is 'exceptionInfo'.
+	Retrieves the details of the exception that caused this event to be raised.
+*/
+struct ExceptionInfoArguments
+{
+#pragma region Class info
+CLASS_INFO(
+	CLASS_FIELDS(
+		CLASS_FIELD(threadId)
+	)
+)
+#pragma endregion
+
+	/* Thread for which exception information should be retrieved. */
+	unsigned threadId = 0;
+};
+
+
+/**
+	Detailed information about an exception that has occurred.
+*/
+struct ExceptionDetails
+{
+#pragma region Class info
+CLASS_INFO(
+	CLASS_FIELDS(
+		CLASS_FIELD(message),
+		CLASS_FIELD(typeName),
+		CLASS_FIELD(stackTrace)
+	)
+)
+#pragma endregion
+
+	/* Message contained in the exception. */
+	std::optional<std::string> message;
+
+	/* Short type name of the exception object. */
+	std::optional<std::string> typeName;
+
+	/* Stack trace at the time the exception was thrown. */
+	std::optional<std::string> stackTrace;
+};
+
+
+/**
+	Response to 'exceptionInfo' request.
+*/
+struct ExceptionInfoResponseBody
+{
+#pragma region Class info
+CLASS_INFO(
+	CLASS_FIELDS(
+		CLASS_FIELD(exceptionId),
+		CLASS_FIELD(description),
+		CLASS_FIELD(breakMode),
+		CLASS_FIELD(details)
+	)
+)
+#pragma endregion
+
+	/* ID of the exception that was thrown. */
+	std::string exceptionId;
+
+	/* Descriptive text for the exception provided by the debug adapter. */
+	std::optional<std::string> description;
+
+	/* Mode that caused the exception notification to be raised. */
+	std::string breakMode; // 'never' | 'always' | 'unhandled' | 'userUnhandled'
+
+	/* Detailed information about the exception. */
+	std::optional<ExceptionDetails> details;
+};
+
+
 struct ThreadsResponseBody
 {
 #pragma region Class info
@@ -833,6 +996,11 @@ struct StackTraceResponseBody
 		Returning monotonically increasing totalFrames values for subsequent requests can be used to enforce paging in the client.
 	*/
 	std::optional<unsigned> totalFrames;
+
+	/**
+		Frames requested by startFrame and levels of the whole stack response, totalFrames is the size of the whole stack.
+	*/
+	StackTraceResponseBody GetFramesPage(const StackTraceArguments& args) const;
 };
 
 /**
@@ -1124,4 +1292,92 @@ struct VariablesResponseBody
 	std::vector<Variable> variables;
 };
 
+
+/* Arguments for 'evaluate' request. */
+struct EvaluateArguments
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(expression, Serialization::RequiredFieldAttribute{}),
+			CLASS_FIELD(frameId),
+			CLASS_FIELD(context),
+			CLASS_FIELD(format)
+		)
+	)
+#pragma endregion
+
+	/* The expression to evaluate. */
+	std::string expression;
+
+	/* Evaluate the expression in the scope of this stack frame. If not specified, the expression is evaluated in the global scope. */
+	std::optional<unsigned> frameId;
+
+	/**
+		The context in which the evaluate request is run.
+		Values:
+		'watch': evaluate is run in a watch.
+		'repl': evaluate is run from REPL console.
+		'hover': evaluate is run from a data hover.
+		'clipboard': evaluate is run to generate the value that will be stored in the clipboard.
+		etc.
+	*/
+	std::string context;
+
+	/*
+		Specifies details on how to format the Evaluate result.
+		The attribute is only honored by a debug adapter if the capability 'supportsValueFormattingOptions' is true.
+	*/
+	std::optional<ValueFormat> format;
+};
+
+
+/* Response to 'evaluate' request. */
+struct EvaluateResponseBody
+{
+#pragma region Class info
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(result),
+			CLASS_FIELD(type),
+			CLASS_FIELD(presentationHint),
+			CLASS_FIELD(variablesReference),
+			CLASS_FIELD(namedVariables),
+			CLASS_FIELD(indexedVariables),
+			CLASS_FIELD(memoryReference)
+		)
+	)
+#pragma endregion
+
+	/* The result of the evaluate request. */
+	std::string result;
+
+	/**
+		The optional type of the evaluate result.
+		This attribute should only be returned by a debug adapter if the client has passed the value true for the 'supportsVariableType' capability of the 'initialize' request.
+	*/
+	std::optional<std::string> type;
+
+	/* Properties of a evaluate result that can be used to determine how to render the result in the UI. */
+	std::optional<VariablePresentationHint> presentationHint;
+
+	/* If variablesReference is > 0, the evaluate result is structured and its children can be retrieved by passing variablesReference to the VariablesRequest. */
+	unsigned variablesReference = 0;
+
+	/**
+		The number of named child variables.
+		The client can use this optional information to present the variables in a paged UI and fetch them in chunks.
+	*/
+	std::optional<unsigned> namedVariables;
+
+	/**
+		The number of indexed child variables.
+		The client can use this optional information to present the variables in a paged UI and fetch them in chunks.
+	*/
+	std::optional<unsigned> indexedVariables;
+
+	/* Optional memory reference to a location appropriate for this result. */
+	std::optional<std::string> memoryReference;
+};
+
 } // namespace Runtime::Dap
@@ -0,0 +1,141 @@
+//◦ Playrix ◦
+#pragma once
+#include <lua-toolkit/debug/dapjsonreader.h>
+#include <lua-toolkit/debug/dapjsonwriter.h>
+#include <lua-toolkit/debug/stacktraceprovider.h>
+#include <runtime/async/task.h>
+
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+namespace Runtime::Debug {
+
+/**
+	Request failure that is reported to the IDE with the error response, but does not close the session.
+*/
+struct DapRequestError : std::runtime_error
+{
+	using std::runtime_error::runtime_error;
+};
+
+
+/**
+	DAP request handler registered in the session's commands table.
+	Handler is created with Create<Args>() (any thread, asynchronous) or CreateOnStoppedThread<Args>() (invoked on the stopped lua thread,
+	request fails when execution is not stopped). Custom bind can return StoppedThreadPreparation: the asynchronous part of the request
+	(i.e. compilation) runs on the pool and only the invocation it returns runs on the stopped lua thread. Args is the arguments type parsed with Dap::JsonReader,
+	RuntimeValue::Ptr (arguments as runtime value) or void (arguments are ignored).
+*/
+struct DapCommandHandler
+{
+	using Invocation = std::function<Async::Task<Dap::AnyJsonValue> ()>;
+	using StoppedThreadInvocation = std::function<Dap::AnyJsonValue (StackTraceProvider&)>;
+	using StoppedThreadPreparation = std::function<Async::Task<StoppedThreadInvocation> ()>;
+	using BoundRequest = std::variant<Invocation, StoppedThreadInvocation, StoppedThreadPreparation>;
+
+	/**
+		Request does not change the session state: it is handled concurrently with the other read-only requests.
+	*/
+	bool readOnly = false;
+
+	/**
+		Request waits for the debugged code (i.e. hot patch of the running execution): it is started in order as the other not read-only requests,
+		but the requests after it are not held by its completion. It is cancelled with DebugSessionController::CancelPendingRequests.
+	*/
+	bool awaitsExecution = false;
+
+	/**
+		Response can be large (i.e. variables, reports): it is sent with the binary encoding when it is negotiated with the client.
+	*/
+	bool largePayload = false;
+
+	/**
+		Parses request arguments (message is valid only during the call) and returns the request invocation.
+	*/
+	std::function<BoundRequest (const Dap::InboundMessage&)> bind;
+
+
+	/**
+		Handler: Async::Task<Body> (Args).
+	*/
+	template<typename Args, typename F>
+	static DapCommandHandler Create(F handler, bool readOnly = false) {
+		DapCommandHandler command;
+		command.readOnly = readOnly;
+		command.bind = [handler = std::move(handler)](const Dap::InboundMessage& message) -> BoundRequest {
+			if constexpr (std::is_void_v<Args>) {
+				return Invocation{[handler] {
+					return ToJsonValue(handler());
+				}};
+			}
+			else {
+				return Invocation{[handler, args = ParseArguments<Args>(message)] {
+					return ToJsonValue(handler(args));
+				}};
+			}
+		};
+
+		return command;
+	}
+
+	/**
+		Handler: Body (StackTraceProvider&, Args).
+	*/
+	template<typename Args, typename F>
+	static DapCommandHandler CreateOnStoppedThread(F handler, bool readOnly = false) {
+		DapCommandHandler command;
+		command.readOnly = readOnly;
+		command.bind = [handler = std::move(handler)](const Dap::InboundMessage& message) -> BoundRequest {
+			if constexpr (std::is_void_v<Args>) {
+				return StoppedThreadInvocation{[handler](StackTraceProvider& stackTraceProvider) {
+					return ToJsonValue(std::bind(handler, std::ref(stackTraceProvider)));
+				}};
+			}
+			else {
+				return StoppedThreadInvocation{[handler, args = ParseArguments<Args>(message)](StackTraceProvider& stackTraceProvider) {
+					return ToJsonValue(std::bind(handler, std::ref(stackTraceProvider), std::cref(args)));
+				}};
+			}
+		};
+
+		return command;
+	}
+
+private:
+
+	template<typename Args>
+	static Args ParseArguments(const Dap::InboundMessage& message) {
+		if constexpr (std::is_same_v<Args, RuntimeValue::Ptr>) {
+			return message.GetArgumentsValue();
+		}
+		else {
+			return message.GetArguments<Args>();
+		}
+	}
+
+	template<typename T>
+	static Async::Task<Dap::AnyJsonValue> ToJsonValue(Async::Task<T> task) {
+		if constexpr (std::is_void_v<T>) {
+			co_await std::move(task);
+			co_return Dap::AnyJsonValue{};
+		}
+		else {
+			co_return Dap::AnyJsonValue{co_await std::move(task)};
+		}
+	}
+
+	template<typename F>
+	static Dap::AnyJsonValue ToJsonValue(F invoke) {
+		if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+			invoke();
+			return {};
+		}
+		else {
+			return Dap::AnyJsonValue{invoke()};
+		}
+	}
+};
+
+} // namespace Runtime::Debug
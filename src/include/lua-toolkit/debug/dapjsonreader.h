@@ -0,0 +1,192 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/meta/classinfo.h>
+#include <runtime/serialization/runtimevalue.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace Runtime::Dap {
+
+/**
+	Pull JSON parser that reads values directly into the DAP structures (described with CLASS_FIELDS), without building RuntimeValue tree.
+	Unknown fields are skipped. Throws std::runtime_error on malformed input.
+*/
+class JsonReader
+{
+public:
+
+	enum class ValueType
+	{
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	explicit JsonReader(std::string_view json);
+
+	/**
+		Returns type of the next value (without reading it).
+	*/
+	ValueType PeekType();
+
+	void Read(bool& value);
+
+	void Read(double& value);
+
+	void Read(std::string& value);
+
+	void Read(RuntimeValue::Ptr& value);
+
+	template<typename T>
+	requires(std::is_integral_v<T> && !std::is_same_v<T, bool>)
+	void Read(T& value) {
+		if constexpr (std::is_signed_v<T>) {
+			value = static_cast<T>(ReadInteger());
+		}
+		else {
+			value = static_cast<T>(ReadUnsigned());
+		}
+	}
+
+	template<typename T>
+	void Read(std::optional<T>& value) {
+		if (TryReadNull()) {
+			value.reset();
+		}
+		else {
+			Read(value.emplace());
+		}
+	}
+
+	template<typename T>
+	void Read(std::vector<T>& values) {
+		values.clear();
+
+		ReadArray([&] {
+			Read(values.emplace_back());
+		});
+	}
+
+	template<typename T>
+	requires(std::is_class_v<T>)
+	void Read(T& value) {
+		auto fields = meta::getClassAllFields<T>();
+
+		ReadObject([&](std::string_view key) {
+			const bool isKnownField = std::apply([&](auto&... field) {
+				return ((field.getName() == key ? (Read(field.getValue(value)), true) : false) || ...);
+			}, fields);
+
+			if (!isKnownField) {
+				SkipValue();
+			}
+		});
+	}
+
+	/**
+		Reads object calling handler for each key: handler must read (or skip) the value.
+	*/
+	template<typename F>
+	void ReadObject(F&& handler) {
+		Expect('{');
+		if (TryConsume('}')) {
+			return;
+		}
+
+		do {
+			const std::string_view key = ReadKey();
+			Expect(':');
+			handler(key);
+		}
+		while (TryConsume(','));
+
+		Expect('}');
+	}
+
+	template<typename F>
+	void ReadArray(F&& handler) {
+		Expect('[');
+		if (TryConsume(']')) {
+			return;
+		}
+
+		do {
+			handler();
+		}
+		while (TryConsume(','));
+
+		Expect(']');
+	}
+
+	/**
+		Skips the next value and returns its raw JSON text.
+	*/
+	std::string_view SkipValue();
+
+	bool TryReadNull();
+
+private:
+
+	long long ReadInteger();
+
+	unsigned long long ReadUnsigned();
+
+	std::string_view ReadNumberToken();
+
+	std::string_view ReadKey();
+
+	void ReadString(std::string& value);
+
+	void SkipWhitespace();
+
+	bool TryConsume(char c);
+
+	void Expect(char c);
+
+	[[noreturn]] void ThrowError(std::string_view message) const;
+
+	const std::string_view _json;
+	size_t _pos = 0;
+	std::string _keyBuffer;
+};
+
+
+/**
+	Inbound DAP message: envelope fields are parsed up front, arguments are kept as raw JSON and decoded on demand into the command specific structure.
+*/
+struct InboundMessage
+{
+	unsigned seq = 0;
+	std::string type;
+	std::string command;
+
+	/**
+		Raw JSON of the 'arguments'. References the packet buffer: valid only until the next message is read from the stream.
+	*/
+	std::string_view arguments;
+
+	static InboundMessage Parse(std::string_view json);
+
+	template<typename T>
+	T GetArguments() const {
+		T args{};
+		if (!arguments.empty()) {
+			JsonReader{arguments}.Read(args);
+		}
+
+		return args;
+	}
+
+	RuntimeValue::Ptr GetArgumentsValue() const;
+};
+
+} // namespace Runtime::Dap
@@ -0,0 +1,165 @@
+//◦ Playrix ◦
+#pragma once
+#include <lua-toolkit/debug/dapmsgpackwriter.h>
+#include <runtime/memory/bytesbuffer.h>
+#include <runtime/meta/classinfo.h>
+#include <runtime/serialization/runtimevalue.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace Runtime::Dap {
+
+class AnyJsonValue;
+
+/**
+	Writes DAP structures (described with CLASS_FIELDS) as JSON directly into the bytes buffer.
+	Fields are resolved at compile time: no intermediate RuntimeValue tree and no per field allocations.
+	Empty optional fields and null RuntimeValue fields are omitted.
+*/
+class JsonWriter
+{
+public:
+
+	explicit JsonWriter(BytesBuffer& buffer);
+
+	void Write(bool value);
+
+	void Write(double value);
+
+	void Write(std::string_view value);
+
+	void Write(const std::string& value);
+
+	void Write(const char* value);
+
+	void Write(const RuntimeValue::Ptr& value);
+
+	void Write(const AnyJsonValue& value);
+
+	template<typename T>
+	requires(std::is_integral_v<T> && !std::is_same_v<T, bool>)
+	void Write(T value) {
+		if constexpr (std::is_signed_v<T>) {
+			WriteInteger(static_cast<long long>(value));
+		}
+		else {
+			WriteUnsigned(static_cast<unsigned long long>(value));
+		}
+	}
+
+	template<typename T>
+	void Write(const std::optional<T>& value) {
+		if (value) {
+			Write(*value);
+		}
+		else {
+			WriteRaw("null");
+		}
+	}
+
+	template<typename T>
+	void Write(const std::vector<T>& values) {
+		WriteRaw("[");
+		for (size_t i = 0; i < values.size(); ++i) {
+			if (i > 0) {
+				WriteRaw(",");
+			}
+			Write(values[i]);
+		}
+		WriteRaw("]");
+	}
+
+	template<typename T>
+	requires(std::is_class_v<T>)
+	void Write(const T& value) {
+		WriteRaw("{");
+
+		bool isFirstField = true;
+
+		std::apply([&](const auto&... field) {
+			(WriteField(isFirstField, field.getName(), field.getValue(value)), ...);
+		}, meta::getClassAllFields<T>());
+
+		WriteRaw("}");
+	}
+
+private:
+
+	template<typename T>
+	static bool IsOmitted(const T& value) {
+		if constexpr (requires { value.has_value(); }) {
+			return !value.has_value();
+		}
+		else if constexpr (std::is_same_v<T, RuntimeValue::Ptr> || std::is_same_v<T, AnyJsonValue>) {
+			return !static_cast<bool>(value);
+		}
+		else {
+			return false;
+		}
+	}
+
+	template<typename T>
+	void WriteField(bool& isFirstField, std::string_view name, const T& value) {
+		if (IsOmitted(value)) {
+			return;
+		}
+
+		if (!isFirstField) {
+			WriteRaw(",");
+		}
+
+		isFirstField = false;
+
+		Write(name);
+		WriteRaw(":");
+		Write(value);
+	}
+
+	void WriteInteger(long long value);
+
+	void WriteUnsigned(unsigned long long value);
+
+	void WriteRaw(std::string_view str);
+
+	BytesBuffer& _buffer;
+};
+
+
+/**
+	Type erased value that will be written with JsonWriter or MsgPackWriter (i.e. response body which type depends on the request).
+*/
+class AnyJsonValue
+{
+public:
+
+	AnyJsonValue() = default;
+
+	template<typename T>
+	requires(!std::is_same_v<std::decay_t<T>, AnyJsonValue>)
+	AnyJsonValue(T value)
+		: _value(std::make_shared<T>(std::move(value)))
+		, _write([](JsonWriter& writer, const void* value) { writer.Write(*static_cast<const T*>(value)); })
+		, _writeMsgPack([](MsgPackWriter& writer, const void* value) { writer.Write(*static_cast<const T*>(value)); })
+	{}
+
+	explicit operator bool() const;
+
+	void Write(JsonWriter& writer) const;
+
+	void Write(MsgPackWriter& writer) const;
+
+private:
+
+	std::shared_ptr<const void> _value;
+	void (*_write)(JsonWriter&, const void*) = nullptr;
+	void (*_writeMsgPack)(MsgPackWriter&, const void*) = nullptr;
+};
+
+} // namespace Runtime::Dap
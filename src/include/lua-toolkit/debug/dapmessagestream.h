@@ -1,11 +1,40 @@
 //◦ Playrix ◦
 #pragma once
+#include <lua-toolkit/debug/adapterprotocol.h>
+#include <lua-toolkit/debug/dapjsonreader.h>
+#include <lua-toolkit/debug/dapjsonwriter.h>
 #include <runtime/async/task.h>
 #include <runtime/io/asyncreader.h>
 #include <runtime/serialization/runtimevalue.h>
 
+#include <concepts>
+#include <functional>
+
 namespace Runtime::Debug {
 
+/**
+	How DAP messages are framed in the bytes stream.
+*/
+enum class DapFraming
+{
+	/* Legacy toolkit framing: every message is wrapped into HTTP like 'POST /dap' packet. */
+	Http,
+
+	/* Standard DAP base protocol: 'Content-Length' header followed by the JSON body (IDE can connect without the custom adapter). */
+	ContentLength
+};
+
+/**
+	Encoding of the message body.
+*/
+enum class DapBodyEncoding
+{
+	Json,
+
+	/* MessagePack document with the same structure as JSON. Requires Http framing: body encoding is given by the packet Content-Type. */
+	MsgPack
+};
+
 /**
 * 
 */
@@ -13,12 +42,58 @@ struct ABSTRACT_TYPE DapMessageStream: virtual IRefCounted
 {
 	using Ptr = ComPtr<DapMessageStream>;
 
-	static DapMessageStream::Ptr Create(ComPtr<Io::AsyncReader> stream);
+	static DapMessageStream::Ptr Create(ComPtr<Io::AsyncReader> stream, DapFraming framing = DapFraming::Http);
+
+	/**
+		Http framing with the outbound packets sent to the given path: the channel ('/dap/<id>') multiplexed with others over the one connection.
+	*/
+	static DapMessageStream::Ptr CreateChannel(ComPtr<Io::AsyncReader> stream, std::string path);
+
+	/**
+		Standard framed messages over the process stdin/stdout (IDE launches the debuggee and talks through the stdio pipes).
+	*/
+	static DapMessageStream::Ptr CreateStdio();
+
 
+	/**
+		Returns next inbound message, or nothing when stream is closed.
+		Message's raw arguments are valid until the next call.
+	*/
+	virtual Async::Task<std::optional<Dap::InboundMessage>> GetDapMessage() = 0;
 
-	virtual Async::Task<RuntimeReadonlyDictionary::Ptr> GetDapMessage() = 0;
+	virtual DapFraming GetFraming() const = 0;
+
+	/**
+		Encoding negotiated with the client for the large payloads (i.e. variables, reports), JSON by default.
+	*/
+	virtual DapBodyEncoding GetPayloadEncoding() const = 0;
+
+	virtual void SetPayloadEncoding(DapBodyEncoding encoding) = 0;
 
 	virtual Async::Task<> SendDapMessage(RuntimeReadonlyDictionary::Ptr command) = 0;
+
+	/**
+		Sends message which body is written by the callback (with the given encoding) directly into the outbound packet.
+		Messages are written in the order of the calls, the callback is invoked later by the stream writer task.
+		Returned task can be completed before the message is actually written, it is suspended while the outbound queue is full.
+	*/
+	virtual Async::Task<> SendDapMessage(std::function<void (BytesBuffer&)> writeBody, DapBodyEncoding encoding = DapBodyEncoding::Json) = 0;
+
+	/**
+		Sends typed DAP message: it is serialized with Dap::JsonWriter (or Dap::MsgPackWriter), without building RuntimeValue.
+	*/
+	template<std::derived_from<Dap::ProtocolMessage> T>
+	Async::Task<> SendDapMessage(T message, DapBodyEncoding encoding = DapBodyEncoding::Json) {
+		if (encoding == DapBodyEncoding::MsgPack) {
+			return SendDapMessage(std::function<void (BytesBuffer&)>{[message = std::move(message)](BytesBuffer& buffer) {
+				Dap::MsgPackWriter{buffer}.Write(message);
+			}}, encoding);
+		}
+
+		return SendDapMessage(std::function<void (BytesBuffer&)>{[message = std::move(message)](BytesBuffer& buffer) {
+			Dap::JsonWriter{buffer}.Write(message);
+		}}, encoding);
+	}
 };
 
 } // namespace Runtime::Debug
@@ -0,0 +1,137 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/memory/bytesbuffer.h>
+#include <runtime/meta/classinfo.h>
+#include <runtime/serialization/runtimevalue.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+namespace Runtime::Dap {
+
+class AnyJsonValue;
+class JsonReader;
+
+/**
+	Writes DAP structures (described with CLASS_FIELDS) as MessagePack directly into the bytes buffer.
+	Produces the same document as JsonWriter (objects are maps with the string keys), but without the text encoding of numbers and strings:
+	used for the large payloads when the client has negotiated binary encoding.
+*/
+class MsgPackWriter
+{
+public:
+
+	explicit MsgPackWriter(BytesBuffer& buffer);
+
+	void WriteNil();
+
+	void Write(bool value);
+
+	void Write(double value);
+
+	void Write(std::string_view value);
+
+	void Write(const std::string& value);
+
+	void Write(const char* value);
+
+	void Write(const RuntimeValue::Ptr& value);
+
+	void Write(const AnyJsonValue& value);
+
+	template<typename T>
+	requires(std::is_integral_v<T> && !std::is_same_v<T, bool>)
+	void Write(T value) {
+		if constexpr (std::is_signed_v<T>) {
+			WriteInteger(static_cast<long long>(value));
+		}
+		else {
+			WriteUnsigned(static_cast<unsigned long long>(value));
+		}
+	}
+
+	template<typename T>
+	void Write(const std::optional<T>& value) {
+		if (value) {
+			Write(*value);
+		}
+		else {
+			WriteNil();
+		}
+	}
+
+	template<typename T>
+	void Write(const std::vector<T>& values) {
+		WriteArrayHeader(values.size());
+		for (const T& value : values) {
+			Write(value);
+		}
+	}
+
+	template<typename T>
+	requires(std::is_class_v<T>)
+	void Write(const T& value) {
+		const auto fields = meta::getClassAllFields<T>();
+
+		const size_t fieldsCount = std::apply([&](const auto&... field) {
+			return (size_t{0} + ... + (IsOmitted(field.getValue(value)) ? 0 : 1));
+		}, fields);
+
+		WriteMapHeader(fieldsCount);
+
+		std::apply([&](const auto&... field) {
+			(WriteField(field.getName(), field.getValue(value)), ...);
+		}, fields);
+	}
+
+private:
+
+	template<typename T>
+	static bool IsOmitted(const T& value) {
+		if constexpr (requires { value.has_value(); }) {
+			return !value.has_value();
+		}
+		else if constexpr (std::is_same_v<T, RuntimeValue::Ptr> || std::is_same_v<T, AnyJsonValue>) {
+			return !static_cast<bool>(value);
+		}
+		else {
+			return false;
+		}
+	}
+
+	template<typename T>
+	void WriteField(std::string_view name, const T& value) {
+		if (IsOmitted(value)) {
+			return;
+		}
+
+		Write(name);
+		Write(value);
+	}
+
+	/**
+		Transcodes JSON value (dynamic runtime values are serialized through JSON).
+	*/
+	void WriteJsonValue(JsonReader& reader);
+
+	void WriteInteger(long long value);
+
+	void WriteUnsigned(unsigned long long value);
+
+	void WriteArrayHeader(size_t size);
+
+	void WriteMapHeader(size_t size);
+
+	void WriteHeader(uint8_t type, uint64_t value, size_t valueSize);
+
+	void WriteRaw(const void* data, size_t size);
+
+	BytesBuffer& _buffer;
+};
+
+} // namespace Runtime::Dap
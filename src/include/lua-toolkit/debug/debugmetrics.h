@@ -0,0 +1,81 @@
+//◦ Playrix ◦
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace Runtime::Debug {
+
+/**
+	Debugger overhead counters, formatted as the Prometheus text exposition (RemoteController answers 'GET /metrics' with it).
+	Counters are relaxed atomics: updating is cheap, the formatted values are not the consistent snapshot.
+*/
+class DebugMetrics
+{
+public:
+
+	/**
+		Counters of the one lua state. Written only by the thread that runs the state (the debug hook).
+	*/
+	struct StateCounters
+	{
+		const std::string name;
+
+		std::atomic<uint64_t> hookInvocations {0};
+		std::atomic<uint64_t> hookNanoseconds {0};
+		std::atomic<uint64_t> breakpointHits {0};
+		std::atomic<uint64_t> luaMemoryBytes {0};
+
+		explicit StateCounters(std::string name_): name(std::move(name_))
+		{}
+
+		/**
+			Single writer: plain load and store instead of the locked increment.
+		*/
+		static void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+	};
+
+	/* Upper bounds (in seconds) of the stop durations histogram buckets. */
+	static constexpr std::array<double, 6> StopDurationBuckets {0.01, 0.1, 1.0, 10.0, 60.0, 600.0};
+
+	/**
+		State is reported while the returned counters are alive.
+	*/
+	static std::shared_ptr<StateCounters> RegisterState(std::string name);
+
+	/**
+		Time the lua thread was stopped by the debugger.
+	*/
+	static void AddStop(std::chrono::nanoseconds duration);
+
+	/* Outbound DAP messages that are queued, but not written yet. */
+	static void AddQueuedMessages(int64_t delta) {
+		s_queuedMessages.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	/* Read-only requests that are handled concurrently, but not answered yet. */
+	static void AddPendingRequests(int64_t delta) {
+		s_pendingRequests.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	/* Writes of the multiplexed channels that are queued, but not written yet. */
+	static void AddQueuedChannelWrites(int64_t delta) {
+		s_queuedChannelWrites.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	static std::string FormatPrometheus();
+
+private:
+
+	static inline std::atomic<int64_t> s_queuedMessages {0};
+	static inline std::atomic<int64_t> s_pendingRequests {0};
+	static inline std::atomic<int64_t> s_queuedChannelWrites {0};
+};
+
+} // namespace Runtime::Debug
@@ -1,10 +1,12 @@
 //◦ Playrix ◦
 #pragma once
 #include <lua-toolkit/debug/adapterprotocol.h>
+#include <lua-toolkit/debug/dapcommandhandler.h>
 #include <lua-toolkit/debug/dapmessagestream.h>
 #include <lua-toolkit/debug/debugsessioncontroller.h>
 #include <lua-toolkit/debug/stacktraceprovider.h>
 
+#include <optional>
 #include <variant>
 
 namespace Runtime::Debug {
@@ -20,22 +22,69 @@ enum class ContinueExecutionMode
 };
 
 
+/**
+	Snapshot mode: when execution is stopped, reachable frame data is copied into the C++ values,
+	so inspection requests are served from any thread without access to the stopped lua thread.
+*/
+struct StopSnapshotOptions
+{
+	/* Max number of stack frames which scopes are copied. */
+	unsigned maxFrames = 16;
+
+	/* Max nesting level of the copied variables (scopes variables are level 0). */
+	unsigned maxDepth = 3;
+
+	/* Max total number of the copied variables and the table entries enumerated to collect them. */
+	size_t maxVariables = 4096;
+};
+
+
 struct ABSTRACT_TYPE DebugSession : IRefCounted
 {
 	using Ptr = ComPtr<DebugSession>;
 
 
 
-	static DebugSession::Ptr Create(DapMessageStream::Ptr, DebugSessionController::Ptr);
+	static DebugSession::Ptr Create(DapMessageStream::Ptr, DebugSessionController::Ptr, std::optional<StopSnapshotOptions> snapshotOptions = std::nullopt);
 
 	virtual Async::Task<> Run();
 
+	/**
+		Ends the session from the host side (as 'disconnect' request does): stopped execution is resumed and the controller is disconnected.
+		Run() completes when the messages stream is closed.
+	*/
+	virtual Async::Task<> Close() = 0;
+
+	/**
+		Sends the custom 'heartbeat' event (IDEs ignore unknown events): write to the dead connection fails, so the session is closed.
+		Client that answers it sends the 'heartbeat' request (read-only, no-op).
+	*/
+	virtual Async::Task<> SendHeartbeat() = 0;
+
 	virtual bool PauseIsRequested() const = 0;
 
 	virtual DapMessageStream& GetCommandsStream() const = 0;
 
 	virtual ContinueExecutionMode StopExecution(Dap::StoppedEventBody ev, StackTraceProvider::Ptr) = 0;
 
+	/**
+		Cooperative stop: sends the 'stopped' event and returns, the stopped lua code is suspended by the controller.
+		Requests of the stopped execution are executed by PollStoppedExecution (called by the thread that runs the lua state).
+	*/
+	virtual void BeginStopExecution(Dap::StoppedEventBody ev, StackTraceProvider::Ptr) = 0;
+
+	/**
+		Executes the requests of the cooperative stop that are scheduled so far, does not wait for the new ones.
+		Returns the continue mode once execution is resumed by the IDE (the stop is ended).
+	*/
+	virtual std::optional<ContinueExecutionMode> PollStoppedExecution() = 0;
+
+	/**
+		Adds (or replaces) request handler. Command names are case insensitive.
+		Must be called before the session starts handling requests (i.e. from DebugSessionController::SetSession).
+	*/
+	virtual void RegisterCommand(std::string_view command, DapCommandHandler handler) = 0;
+
 };
 
 } // namespace Runtime::Debug
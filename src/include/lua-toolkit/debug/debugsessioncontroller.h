@@ -27,7 +27,24 @@ struct ABSTRACT_TYPE DebugSessionController : IRefCounted
 
 	virtual Async::Task<std::vector<Dap::Breakpoint>> SetFunctionBreakpoints(Dap::SetFunctionBreakpointsArguments) = 0;
 
+	virtual Async::Task<> SetExceptionBreakpoints(Dap::SetExceptionBreakpointsArguments) = 0;
+
+	virtual Async::Task<Dap::ExceptionInfoResponseBody> GetExceptionInfo(Dap::ExceptionInfoArguments) = 0;
+
 	virtual Async::Task<std::vector<Dap::Thread>> GetThreads() = 0;
+
+	/**
+		Exception filters advertised by the 'initialize' response (the filters of the 'setExceptionBreakpoints' request), none by default.
+	*/
+	virtual std::vector<Dap::ExceptionBreakpointsFilter> GetExceptionBreakpointFilters() const {
+		return {};
+	}
+
+	/**
+		Session is ending: requests that wait for the debugged code (i.e. hot patch of the idle lua state) are completed with the error,
+		so the session does not wait for them.
+	*/
+	virtual void CancelPendingRequests() {}
 };
 
 } // namespace Runtime::Debug
@@ -1,6 +1,7 @@
 //◦ Playrix ◦
 #pragma once
 #include <lua-toolkit/debug/debugsessioncontroller.h>
+#include <lua-toolkit/debug/debugmetrics.h>
 #include <lua-toolkit/debug/debugsession.h>
 #include <runtime/async/scheduler.h>
 #include <runtime/com/weakcomptr.h>
@@ -13,12 +14,29 @@ extern "C" {
 #include <lua.h>
 }
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
 
 namespace Lua::Debug {
 
+struct HotPatchArguments;
+
+struct HotPatchResponseBody;
+
+struct CompiledChunk;
+
+
+/**
+	Controller of the lua state debugging.
+	Besides the DAP requests it handles 'hotPatch' (HotPatchArguments): the new source of the loaded chunk is compiled on the pool thread,
+	functions are replaced on the lua thread by the next debug hook invocation (or right away, when execution is stopped),
+	source breakpoints are remapped to the new lines.
+*/
 class LuaDebugSessionController : public Runtime::Debug::DebugSessionController
 {
 	CLASS_INFO(
@@ -35,10 +53,41 @@ public:
 	};
 
 
+	/**
+		Blocking: the lua thread is blocked by the stop until the IDE continues execution.
+		Cooperative: the stop on the line of the coroutine suspends the coroutine (the hook yields), the host keeps running its frames
+		and serves the stopped execution requests with PollDebugger. Stops that can not yield (main thread, function breakpoints,
+		code called through the C function) are blocking.
+	*/
+	enum class StopMode
+	{
+		Blocking,
+		Cooperative
+	};
+
+
 	LuaDebugSessionController();
 
 	~LuaDebugSessionController();
 
+	/**
+		Must be called on the lua thread.
+	*/
+	void SetStopMode(StopMode);
+
+	/**
+		Cooperative stop mode: must be called by the host on the lua thread (i.e. every frame), outside of the lua code.
+		Executes the requests of the stopped execution scheduled so far and returns the coroutine suspended by the stop:
+		host must not resume it while it is returned. Returns nullptr when execution is not stopped.
+	*/
+	lua_State* PollDebugger();
+
+	/**
+		Message handler (errfunc) for the host's lua_pcall of the top level lua calls: with 'uncaught' (or 'all') exception filter set,
+		execution is stopped on the error with the failing frame alive. Returns the error value unchanged.
+	*/
+	static int UncaughtErrorHandler(lua_State*);
+
 protected:
 
 	Runtime::Async::Task<> ConfigureLaunch(Runtime::RuntimeValue::Ptr config) override;
@@ -47,16 +96,37 @@ protected:
 
 	Runtime::Async::Task<> Disconnect() override;
 
+	/**
+		Must be called on the lua thread.
+	*/
 	void EnableDebug();
 
+	/**
+		Must be called on the lua thread (Disconnect requests the teardown by the next hook invocation).
+	*/
 	void DisableDebug();
 
 	virtual lua_State* GetLua() const = 0;
 
 	virtual Runtime::Async::Task<> Start(StartMode) = 0;
 
+	/**
+		Name of the state in the metrics (i.e. debug location id), the state address by default.
+	*/
+	virtual std::string GetStateName() const;
+
 private:
 
+	/* Lua memory is sampled by the hook once per given number of invocations. */
+	static constexpr uint64_t MemorySamplePeriod = 4096;
+
+	/* Hook time is measured once per given number of active invocations (two clock reads cost more than the inactive hook itself). */
+	static constexpr uint64_t HookTimingSamplePeriod = 16;
+
+	/* Exception filters (exceptionBreakpointFilters reported by the adapter). */
+	static constexpr std::string_view AllErrorsFilter {"all"};
+	static constexpr std::string_view UncaughtErrorsFilter {"uncaught"};
+
 
 	class SourceBp
 	{
@@ -126,6 +196,10 @@ private:
 
 	class StepOutPredicate;
 
+	struct PendingPatch;
+
+	struct CooperativeStop;
+
 
 
 	void SetSession(Runtime::ComPtr<Runtime::Debug::DebugSession> session) override final;
@@ -140,23 +214,159 @@ private:
 
 	Runtime::Async::Task<std::vector<Runtime::Dap::Breakpoint>> SetFunctionBreakpoints(Runtime::Dap::SetFunctionBreakpointsArguments) override final;
 
+	Runtime::Async::Task<> SetExceptionBreakpoints(Runtime::Dap::SetExceptionBreakpointsArguments) override final;
+
+	Runtime::Async::Task<Runtime::Dap::ExceptionInfoResponseBody> GetExceptionInfo(Runtime::Dap::ExceptionInfoArguments) override final;
+
+	std::vector<Runtime::Dap::ExceptionBreakpointsFilter> GetExceptionBreakpointFilters() const override final;
+
 	Runtime::Async::Task<std::vector<Runtime::Dap::Thread>> GetThreads() override final;
 
-	void ExecuteDebugger(lua_State*, lua_Debug*);
+	void CancelPendingRequests() override final;
+
+	/**
+		Returns true when the lua code must be suspended by the hook (cooperative stop is begun).
+	*/
+	bool ExecuteDebugger(lua_State*, lua_Debug*);
+
+	bool CanSuspend(lua_State*, lua_Debug*) const;
+
+	void BeginCooperativeStop(Runtime::ComPtr<Runtime::Debug::DebugSession>, lua_State*, lua_Debug*, Runtime::Dap::StoppedEventBody);
+
+	/**
+		Stopped coroutine is resumed (and not suspended again) or is dead: the requests of the stop fail, and the stop continues without steps.
+	*/
+	void InvalidateCooperativeStop();
+
+	void ContinueExecution(lua_State*, lua_Debug*, Runtime::Debug::ContinueExecutionMode);
+
+	void EndStop();
+
+	/**
+		Removes the hooks (of the main state and of the coroutines the hook has run on) and the session global.
+		Called on the lua thread, l is the running thread (its stack is used).
+	*/
+	void TearDownDebug(lua_State* l);
+
+	/**
+		Coroutines inherit the hook of the thread that creates them: every thread the hook runs on is kept in the registry weak table.
+	*/
+	void TrackHookedThread(lua_State*);
+
+	Runtime::ComPtr<Runtime::Debug::DebugSession> AcquireSession();
+
+	Runtime::Debug::ContinueExecutionMode BlockingStop(Runtime::ComPtr<Runtime::Debug::DebugSession>, lua_State*, lua_Debug*, Runtime::Dap::StoppedEventBody, std::chrono::steady_clock::duration& stopDuration);
+
+	/**
+		'all' filter replaces global pcall, xpcall and error with the reporting wrappers, they are restored when the filter is removed
+		(or debugging is torn down): without the filter errors are handled by the base library functions only. Called on the lua thread.
+	*/
+	void SyncErrorWrappers(lua_State*);
+
+	/**
+		Pushes pcall, xpcall and error wrappers. Under LuaJIT pcall and xpcall wrappers are lua functions that call the original xpcall
+		(yield across them keeps working), Lua 5.1 pcall is not yieldable anyway: its wrappers are C functions that use lua_pcall.
+	*/
+	void PushErrorWrappers(lua_State*);
+
+	/**
+		Stops on the error at the given stack index, when the error is not reported yet and the matching filter is set.
+	*/
+	void OnError(lua_State*, int errorIndex, bool isUncaught) noexcept;
+
+	void StopOnError(lua_State*, int errorIndex, std::string_view breakMode) noexcept;
+
+	/**
+		Called by the message handler: the error is raised by the wrapped 'error' that has stopped on it already.
+	*/
+	bool IsRaisedErrorReported(lua_State*) const;
+
+	static LuaDebugSessionController* GetController(lua_State*);
+
+	static int CaughtErrorHandler(lua_State*);
+
+	static int MakeCaughtErrorHandler(lua_State*);
+
+	static int ProtectedCall(lua_State*);
+
+	static int ProtectedCallWithHandler(lua_State*);
+
+	static int RaiseError(lua_State*);
 
 	std::optional<Runtime::Dap::StoppedEventBody> CheckBreakpoints(lua_State*, lua_Debug*);
 
+	void SampleLuaMemory(lua_State*);
+
+	Runtime::Debug::DapCommandHandler CreateHotPatchCommand();
+
+	/**
+		Compiles the patch on the pool thread and awaits (without blocking the thread) until it is applied by the lua thread.
+	*/
+	Runtime::Async::Task<Runtime::Dap::AnyJsonValue> HotPatch(std::shared_ptr<const HotPatchArguments>);
+
+	/**
+		Compiles the patch of the stopped execution on the pool, returned invocation applies it on the stopped lua thread.
+	*/
+	Runtime::Async::Task<Runtime::Debug::DapCommandHandler::StoppedThreadInvocation> PrepareStoppedHotPatch(std::shared_ptr<const HotPatchArguments>);
+
+	/**
+		Applies the patches queued while execution was running. Called on the lua thread by the hook (and before the execution is stopped).
+	*/
+	void ApplyPendingPatches(lua_State*, bool isStopping = false);
+
+	/**
+		Fails the patches that will not be applied (hook is removed, or the session is ending) and rejects the new ones until EnableDebug.
+	*/
+	void CancelPendingPatches();
+
+	HotPatchResponseBody ApplyHotPatch(lua_State*, const CompiledChunk&, const HotPatchArguments&);
+
+	std::vector<Runtime::Dap::Breakpoint> RemapBreakpoints(const HotPatchArguments&);
+
 
-	StartMode _startMode = StartMode::Unknown;
+	std::atomic<StartMode> _startMode = StartMode::Unknown;
+	// set by the session thread, acquired by the lua thread (guarded by _mutex).
 	Runtime::WeakComPtr<Runtime::Debug::DebugSession> _sessionRef;
 	std::vector<SourceBp> _sourceBreakpoints;
 	std::vector<FunctionBp> _functionBreakpoints;
 	std::vector<SourceEntry> _sources;
 	DebugStepPredicate::Ptr _debugStepPredicate;
+	std::shared_ptr<Runtime::Debug::DebugMetrics::StateCounters> _metrics;
+	// content of the applied patches by source path: base of the next patch breakpoints remapping.
+	std::unordered_map<std::string, std::string> _patchedContents;
+
+	// state the stopped execution is inspected with (accessed only by the lua thread).
+	lua_State* _stoppedLua = nullptr;
+
+	// cooperative stop state (accessed only by the lua thread).
+	StopMode _stopMode = StopMode::Blocking;
+	std::unique_ptr<CooperativeStop> _cooperativeStop;
+	lua_State* _resumedThread = nullptr;
+	int _resumedLine = -1;
+
+	std::atomic<bool> _breakOnAllErrors = false;
+	std::atomic<bool> _breakOnUncaughtErrors = false;
+	std::atomic<bool> _isErrorFiltersChanged = false;
+	// accessed only by the lua thread.
+	bool _areErrorWrappersInstalled = false;
+	// the last raise of the wrapped 'error' has stopped on its error (accessed only by the lua thread).
+	bool _isRaisedErrorReported = false;
+	// info of the error execution is stopped on (guarded by _mutex).
+	std::optional<Runtime::Dap::ExceptionInfoResponseBody> _exceptionInfo;
+
+	std::vector<std::shared_ptr<PendingPatch>> _pendingPatches;
+	std::atomic<bool> _hasPendingPatches = false;
+	bool _isStopped = false;
+	bool _arePatchesAccepted = false;
+	std::mutex _patchesMutex;
 
 	unsigned _bpId = 0;
 	unsigned _srcId = 0;
-	bool _isActive = false;
+	std::atomic<bool> _isActive = false;
+	// Disconnect does not touch the lua state: hooks are removed by the next hook invocation on the lua thread.
+	std::atomic<bool> _isTeardownRequested = false;
+	// last thread added to the hooked threads table (accessed only by the lua thread).
+	lua_State* _lastHookedThread = nullptr;
 	std::mutex _mutex;
 };
 
@@ -0,0 +1,70 @@
+//◦ Playrix ◦
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Runtime::Debug {
+
+/**
+	Recorder of the inbound and outbound protocol frames (message bodies) with timestamps.
+	Frames are stored into the bounded lock-free ring (the oldest frames are overwritten), large bodies are truncated.
+	Switchable at runtime: when disabled the only cost is the relaxed atomic load.
+	Dumped into the binary file that is read back with ReadFile() (i.e. by the session replay tooling).
+*/
+class ProtocolTrace
+{
+public:
+
+	enum class Direction : uint8_t
+	{
+		Inbound,
+		Outbound
+	};
+
+	struct Frame
+	{
+		/* Nanoseconds since the trace was enabled. */
+		uint64_t timestamp = 0;
+		Direction direction = Direction::Inbound;
+
+		/* Original body size: recorded body is truncated when it is larger than MaxRecordedBodySize. */
+		uint32_t size = 0;
+		std::string body;
+	};
+
+	static constexpr size_t MaxRecordedBodySize = 8 * 1024;
+
+	static constexpr size_t MaxFrames = 2048;
+
+	static void SetEnabled(bool enabled);
+
+	static bool IsEnabled() {
+		return s_isEnabled.load(std::memory_order_relaxed);
+	}
+
+	static void Trace(Direction direction, std::string_view body) {
+		if (IsEnabled()) {
+			Record(direction, body);
+		}
+	}
+
+	/**
+		Writes currently recorded frames (in the order of recording).
+	*/
+	static bool DumpToFile(const std::string& path);
+
+	static std::optional<std::vector<Frame>> ReadFile(const std::string& path);
+
+private:
+
+	static void Record(Direction direction, std::string_view body);
+
+	static inline std::atomic<bool> s_isEnabled = false;
+};
+
+} // namespace Runtime::Debug
@@ -15,6 +15,13 @@ struct StackTraceProvider : IRefCounted
 	virtual std::vector<Dap::Scope> GetScopes(unsigned stackFrameId) = 0;
 
 	virtual std::vector<Dap::Variable> GetVariables(Dap::VariablesArguments) = 0;
+
+	virtual Dap::EvaluateResponseBody Evaluate(Dap::EvaluateArguments) = 0;
+
+	/**
+		Number of the entries (i.e. table fields) enumerated by the provider so far: the cost of the requests served on the stopped thread.
+	*/
+	virtual size_t GetEnumeratedCount() const = 0;
 };
 
 
@@ -3,10 +3,18 @@
 
 #include <runtime/com/ianything.h>
 #include <runtime/meta/classinfo.h>
-#include <runtime/network/stream.h>
+#include <runtime/io/asyncreader.h>
+#include <lua-toolkit/debug/dapmessagestream.h>
+#include <lua-toolkit/debug/debugsession.h>
 #include <lua-toolkit/debug/debugsessioncontroller.h>
 
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -33,6 +41,24 @@ public:
 #pragma endregion
 	};
 
+	/**
+		Connected client bound to the debug location.
+	*/
+	struct SessionInfo
+	{
+		unsigned id = 0;
+		std::string location;
+
+#pragma region Class info
+		CLASS_INFO(
+			CLASS_FIELDS(
+				CLASS_FIELD(id),
+				CLASS_FIELD(location)
+			)
+		)
+#pragma endregion
+	};
+
 #pragma region Class info
 		CLASS_INFO(
 			CLASS_METHODS(
@@ -42,17 +68,121 @@ public:
 #pragma endregion
 
 
-	Runtime::Async::Task<> Run();
+	static constexpr std::string_view DefaultAddress {"tcp://:8845"};
+
+	static constexpr size_t DefaultMaxSessions = 16;
+
+	/**
+		Supervision of the connections: closed connection ends its sessions (and the controllers remove the debug hooks).
+	*/
+	struct SessionTimeouts
+	{
+		/* Connection is closed when the handshake (or the plain request) is not received in time, zero - never. */
+		std::chrono::milliseconds handshake {10'000};
+
+		/* Connection is closed when nothing is received for the given time, zero - never.
+		   Disabled by default: IDE sends nothing while the user is reading the code. */
+		std::chrono::milliseconds idle {0};
 
-	virtual ~RemoteController() = default;
+		/* Interval of the 'heartbeat' event (ignored by IDEs), zero - never. Write to the dead connection fails and closes its session. */
+		std::chrono::milliseconds heartbeat {15'000};
 
+		/* Connection of the client that has promised (at handshake) to answer every 'heartbeat' event with the 'heartbeat' request
+		   is closed when nothing is received for the given time, zero - never.
+		   Write to the half-open connection does not fail until the kernel gives up the retransmissions, the missed reply does. */
+		std::chrono::milliseconds heartbeatReply {45'000};
+	};
+
+	Runtime::Async::Task<> Run();
+
+	/**
+		Listens on the given address: 'tcp://host:port' or 'unix:///path/to/socket' (local tools on the same machine).
+		DapFraming::ContentLength: standard DAP clients (i.e. VS Code 'debugServer') connect directly, without the handshake,
+		and are bound to the default location.
+	*/
+	Runtime::Async::Task<> Run(std::string address, Runtime::Debug::DapFraming framing = Runtime::Debug::DapFraming::Http);
+
+	/**
+		Serves clients (one at a time) through the named shared memory channel (see SharedMemoryStream).
+	*/
+	Runtime::Async::Task<> RunSharedMemory(std::string channelName);
+
+	/**
+		Max number of the concurrently connected clients: handshake of the next client is rejected.
+	*/
+	void SetMaxSessions(size_t maxSessions);
+
+	std::vector<SessionInfo> GetSessions() const;
+
+	void SetTimeouts(SessionTimeouts timeouts);
+
+	/**
+		Snapshot mode of the sessions that are started after the call (see StopSnapshotOptions), nullopt - disabled.
+	*/
+	void SetSnapshotOptions(std::optional<Runtime::Debug::StopSnapshotOptions> snapshotOptions);
+
+	/**
+		Disconnects all the clients: stopped lua threads are resumed, debug controllers are disconnected.
+	*/
+	Runtime::Async::Task<> CloseSessions();
+
+	/**
+		Stops the watchdog thread: it is accessing the sessions registry.
+	*/
+	virtual ~RemoteController();
+
+	/**
+		Debug targets (i.e. lua states) registered by the host. Client chooses the location at handshake,
+		every location can be bound to the one client at a time.
+		Empty list means the single target with the 'default' id.
+	*/
 	virtual std::vector<DebugLocation> GetDebugLocations() const = 0;
 
 	virtual Runtime::Async::Task<Runtime::Debug::DebugSessionController::Ptr> CreateDebugSession(std::string id) = 0;
 
 private:
 
-	Runtime::Async::Task<> SpawnClientSession(Runtime::Network::Stream::Ptr client);
+	struct ClientSession;
+
+	struct Watchdog;
+
+	Runtime::Async::Task<> SpawnClientSession(Runtime::ComPtr<Runtime::Io::AsyncReader> client);
+
+	/**
+		Standard DAP client: Content-Length framing, no handshake.
+	*/
+	Runtime::Async::Task<> SpawnDapClientSession(Runtime::ComPtr<Runtime::Io::AsyncReader> client);
+
+	/**
+		Multiplexed connection: every channel ('/dap/<location-id>') is the separate session bound to its location.
+	*/
+	Runtime::Async::Task<> ServeChannels(Runtime::ComPtr<Runtime::Io::AsyncReader> client, Runtime::Debug::DapBodyEncoding payloadEncoding);
+
+	/**
+		Runs the debug session of the registered client, the client leaves the registry when session is ended.
+	*/
+	Runtime::Async::Task<> RunSession(std::shared_ptr<ClientSession> session, Runtime::Debug::DapMessageStream::Ptr messageStream);
+
+	/**
+		Reserves the registry entry for the client. Returns error when location is unknown (or busy) or sessions limit is reached.
+	*/
+	std::optional<std::string> RegisterSession(const std::shared_ptr<ClientSession>& session, const std::optional<std::string>& requestedLocation);
+
+	void UnregisterSession(unsigned sessionId);
+
+	void SendHeartbeats();
+
+	std::shared_ptr<Watchdog> GetWatchdog();
+
+	mutable std::mutex _sessionsMutex;
+	std::map<unsigned, std::shared_ptr<ClientSession>> _sessions;
+	unsigned _nextSessionId = 1;
+	size_t _maxSessions = DefaultMaxSessions;
+	std::optional<Runtime::Debug::StopSnapshotOptions> _snapshotOptions;
+
+	// started with the first connection, stopped by the destructor: its thread is accessing the sessions.
+	std::mutex _watchdogMutex;
+	std::shared_ptr<Watchdog> _watchdog;
 };
 
 
@@ -1,13 +1,26 @@
 //◦ Playrix ◦
 #include "lua-toolkit/remotecontroller.h"
+#include "lua-toolkit/debug/debugmetrics.h"
 #include "lua-toolkit/debug/debugsession.h"
 
 #include <runtime/com/comclass.h>
 #include <runtime/network/server.h>
+#include <runtime/runtime/runtime.h>
 #include <runtime/serialization/runtimevaluebuilder.h>
+#include <runtime/utils/disposable.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
 
+
+#include "remoting/dapchannelmux.h"
 #include "remoting/httpstream.h"
+#include "remoting/localsocketstream.h"
+#include "remoting/sharedmemorystream.h"
+#include "remoting/watchedstream.h"
 
 namespace Lua::Remoting {
 
@@ -15,19 +28,239 @@ using namespace Runtime;
 using namespace Runtime::Async;
 using namespace Runtime::Debug;
 
+constexpr std::string_view MsgPackEncoding {"msgpack"};
+constexpr std::string_view DefaultLocation {"default"};
+constexpr std::string_view MetricsPath {"/metrics"};
+constexpr std::string_view PrometheusContentType {"text/plain; version=0.0.4"};
+
+
+/**
+	Client lists the body encodings it can decode (in addition to JSON), the server answers with the chosen one.
+	Client chooses the debug location (can be omitted when host has the single one),
+	or only requests the list of the locations and active sessions.
+	Multiplexing client opens the channel for every location it debugs (by sending requests to '/dap/<location-id>'),
+	all the channels are served by the one connection.
+	Client that sets 'heartbeat' answers every 'heartbeat' event with the 'heartbeat' request: its connection is closed
+	when the reply is missed (see SessionTimeouts::heartbeatReply).
+*/
+struct HandshakeRequest
+{
+	std::vector<std::string> payloadEncodings;
+	std::optional<std::string> location;
+	bool listLocations = false;
+	bool multiplex = false;
+	bool heartbeat = false;
+
+	CLASS_INFO(
+		CLASS_FIELDS(
+			CLASS_FIELD(payloadEncodings),
+			CLASS_FIELD(location),
+			CLASS_FIELD(listLocations),
+			CLASS_FIELD(multiplex),
+			CLASS_FIELD(heartbeat)
+		)
+	)
+};
+
+
 struct HandshakeResponse
 {
 	bool success = true;
+	std::optional<std::string> error;
+	std::optional<std::string> payloadEncoding;
+	std::optional<unsigned> sessionId;
+	std::optional<std::string> location;
+	std::optional<std::vector<RemoteController::DebugLocation>> locations;
+	std::optional<std::vector<RemoteController::SessionInfo>> sessions;
 
 	CLASS_INFO(
 		CLASS_FIELDS(
-			CLASS_FIELD(success)
+			CLASS_FIELD(success),
+			CLASS_FIELD(error),
+			CLASS_FIELD(payloadEncoding),
+			CLASS_FIELD(sessionId),
+			CLASS_FIELD(location),
+			CLASS_FIELD(locations),
+			CLASS_FIELD(sessions)
 		)
 	)
 };
 
 
-Runtime::Async::Task<> RemoteController::SpawnClientSession(Runtime::Network::Stream::Ptr client) {
+/**
+	Plain GET (i.e. monitoring scrape) is answered instead of the DAP handshake.
+*/
+Task<> ServePlainRequest(const RemoteController& controller, std::string path, Io::AsyncWriter& clientWriter) {
+	if (path != MetricsPath) {
+		co_await HttpStream::SendHttpResponse(404, "Not Found", PrometheusContentType, {}, clientWriter);
+		co_return;
+	}
+
+	std::string metrics = DebugMetrics::FormatPrometheus();
+	metrics.append(Core::Format::format("# HELP lua_toolkit_remote_sessions Connected debug clients.\n# TYPE lua_toolkit_remote_sessions gauge\nlua_toolkit_remote_sessions {}\n", controller.GetSessions().size()));
+
+	co_await HttpStream::SendHttpResponse(200, "OK", PrometheusContentType, metrics, clientWriter);
+}
+
+
+/**
+	Channel is forgotten by the mux when its session is ended, so the client can open it again.
+*/
+Task<> RunChannelSession(Task<> sessionTask, std::shared_ptr<DapChannelMux> mux, std::string channelId) {
+	co_await std::move(sessionTask);
+
+	mux->CloseChannel(channelId);
+}
+
+
+/**
+	Heartbeats are sent from the pool: the watchdog thread must not run (or wait for) the sessions writes.
+	Every heartbeat is detached, so the session with the full outbound queue does not hold back the others.
+*/
+Task<> SendHeartbeatsOnPool(std::vector<DebugSession::Ptr> debugSessions) {
+	co_await RuntimeCore::instance().poolScheduler();
+
+	for (const auto& debugSession : debugSessions) {
+		debugSession->SendHeartbeat().detach();
+	}
+}
+
+
+struct RemoteController::ClientSession
+{
+	unsigned id = 0;
+	std::string location;
+	ComPtr<Io::AsyncReader> client;
+
+	// guarded by the registry mutex.
+	DebugSession::Ptr debugSession;
+	bool isClosed = false;
+};
+
+/**
+	Thread that closes the connections which handshake or idle timeout is expired and sends the heartbeats.
+*/
+struct RemoteController::Watchdog
+{
+	static constexpr auto CheckInterval = std::chrono::milliseconds{500};
+
+	struct Connection
+	{
+		ComPtr<WatchedStream> stream;
+		std::chrono::steady_clock::time_point acceptTime;
+		bool isHandshaked = false;
+		bool isHeartbeatReplyRequired = false;
+	};
+
+	std::mutex mutex;
+	std::condition_variable_any signal;
+	SessionTimeouts timeouts;
+	std::unordered_map<WatchedStream*, Connection> connections;
+	std::jthread thread;
+
+	explicit Watchdog(RemoteController& controller)
+		: thread([this, &controller](std::stop_token stopToken) { Run(controller, stopToken); })
+	{}
+
+	void Watch(ComPtr<WatchedStream> stream) {
+		lock_(mutex);
+		WatchedStream* const key = stream.get();
+		connections.emplace(key, Connection{std::move(stream), std::chrono::steady_clock::now()});
+	}
+
+	void SetHandshaked(WatchedStream& stream) {
+		lock_(mutex);
+		if (const auto iter = connections.find(&stream); iter != connections.end()) {
+			iter->second.isHandshaked = true;
+		}
+	}
+
+	/**
+		Client answers the heartbeats: connection that has received nothing for SessionTimeouts::heartbeatReply is half-open.
+	*/
+	void RequireHeartbeatReply(WatchedStream& stream) {
+		lock_(mutex);
+		if (const auto iter = connections.find(&stream); iter != connections.end()) {
+			iter->second.isHeartbeatReplyRequired = true;
+		}
+	}
+
+	void Unwatch(WatchedStream& stream) {
+		lock_(mutex);
+		connections.erase(&stream);
+	}
+
+	/**
+		Called by the controller destructor: the thread is accessing the controller.
+	*/
+	void Stop() {
+		thread.request_stop();
+		if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) {
+			thread.join();
+		}
+	}
+
+	void Run(RemoteController& controller, std::stop_token stopToken) {
+		auto lastHeartbeat = std::chrono::steady_clock::now();
+
+		while (true) {
+			std::vector<ComPtr<WatchedStream>> expiredStreams;
+			SessionTimeouts currentTimeouts;
+
+			{
+				std::unique_lock lock{mutex};
+				signal.wait_for(lock, stopToken, CheckInterval, [] {
+					return false;
+				});
+
+				if (stopToken.stop_requested()) {
+					break;
+				}
+
+				const auto now = std::chrono::steady_clock::now();
+				currentTimeouts = timeouts;
+
+				for (const auto& [key, connection] : connections) {
+					const bool isHandshakeExpired = !connection.isHandshaked && timeouts.handshake.count() > 0 && now - connection.acceptTime > timeouts.handshake;
+					const auto idleTime = now - connection.stream->GetLastActivity();
+					const bool isIdleExpired = timeouts.idle.count() > 0 && idleTime > timeouts.idle;
+					const bool isHeartbeatMissed = connection.isHeartbeatReplyRequired && timeouts.heartbeat.count() > 0 && timeouts.heartbeatReply.count() > 0 && idleTime > timeouts.heartbeatReply;
+
+					if ((isHandshakeExpired || isIdleExpired || isHeartbeatMissed) && !connection.stream->IsDisposed()) {
+						expiredStreams.push_back(connection.stream);
+					}
+				}
+			}
+
+			// pending read completes: the session ends and disconnects its controller.
+			for (const auto& stream : expiredStreams) {
+				stream->dispose();
+			}
+
+			if (const auto now = std::chrono::steady_clock::now(); currentTimeouts.heartbeat.count() > 0 && now - lastHeartbeat >= currentTimeouts.heartbeat) {
+				lastHeartbeat = now;
+				controller.SendHeartbeats();
+			}
+		}
+	}
+};
+
+/* -------------------------------------------------------------------------- */
+Runtime::Async::Task<> RemoteController::SpawnClientSession(ComPtr<Io::AsyncReader> connection) {
+
+	const std::shared_ptr<Watchdog> watchdog = GetWatchdog();
+
+	auto watchedConnection = Com::createInstance<WatchedStream>(std::move(connection));
+	watchdog->Watch(watchedConnection);
+
+	SCOPE_Leave {
+		watchdog->Unwatch(*watchedConnection);
+	};
+
+	ComPtr<Io::AsyncReader> client = watchedConnection;
+
+	Io::AsyncWriter* const clientWriter = client->as<Io::AsyncWriter*>();
+	Assert(clientWriter);
 
 	HttpStream streamReader;
 
@@ -36,23 +269,333 @@ Runtime::Async::Task<> RemoteController::SpawnClientSession(Runtime::Network::St
 		co_return;
 	}
 
-	co_await HttpStream::SendHttpJsonPacket(runtimeValueCopy(HandshakeResponse{}), "/dap", *client);
+	watchdog->SetHandshaked(*watchedConnection);
+
+	if (packet.method == "GET") {
+		co_await ServePlainRequest(*this, std::string{packet.path}, *clientWriter);
+		co_return;
+	}
+
+	HandshakeRequest handshake;
+	try {
+		if (!packet.body.empty()) {
+			Dap::JsonReader{packet.body}.Read(handshake);
+		}
+	}
+	catch (const std::exception&) {
+		// legacy clients handshake body is not inspected: such client gets JSON only.
+		handshake = {};
+	}
+
+	HandshakeResponse handshakeResponse;
+
+	if (handshake.listLocations) {
+		handshakeResponse.locations = GetDebugLocations();
+		handshakeResponse.sessions = GetSessions();
+
+		co_await HttpStream::SendHttpJsonPacket(runtimeValueCopy(handshakeResponse), "/dap", *clientWriter);
+		co_return;
+	}
+
+	if (std::find(handshake.payloadEncodings.begin(), handshake.payloadEncodings.end(), MsgPackEncoding) != handshake.payloadEncodings.end()) {
+		handshakeResponse.payloadEncoding.emplace(MsgPackEncoding);
+	}
+
+	const DapBodyEncoding payloadEncoding = handshakeResponse.payloadEncoding ? DapBodyEncoding::MsgPack : DapBodyEncoding::Json;
+
+	if (handshake.heartbeat) {
+		watchdog->RequireHeartbeatReply(*watchedConnection);
+	}
+
+	if (handshake.multiplex) {
+		co_await HttpStream::SendHttpJsonPacket(runtimeValueCopy(handshakeResponse), "/dap", *clientWriter);
+		co_await ServeChannels(std::move(client), payloadEncoding);
+		co_return;
+	}
+
+	auto session = std::make_shared<ClientSession>();
+	session->client = client;
+
+	if (auto error = RegisterSession(session, handshake.location)) {
+		HandshakeResponse errorResponse;
+		errorResponse.success = false;
+		errorResponse.error = std::move(error);
+		errorResponse.locations = GetDebugLocations();
+
+		co_await HttpStream::SendHttpJsonPacket(runtimeValueCopy(errorResponse), "/dap", *clientWriter);
+		co_return;
+	}
+
+	handshakeResponse.sessionId = session->id;
+	handshakeResponse.location = session->location;
+
+	co_await HttpStream::SendHttpJsonPacket(runtimeValueCopy(handshakeResponse), "/dap", *clientWriter);
+
+	auto messageStream = DapMessageStream::Create(client);
+	messageStream->SetPayloadEncoding(payloadEncoding);
+
+	co_await RunSession(std::move(session), std::move(messageStream));
+}
+
+
+Task<> RemoteController::SpawnDapClientSession(ComPtr<Io::AsyncReader> connection) {
+
+	const std::shared_ptr<Watchdog> watchdog = GetWatchdog();
+
+	auto watchedConnection = Com::createInstance<WatchedStream>(std::move(connection));
+	watchdog->Watch(watchedConnection);
+	// there is no handshake: the 'initialize' request follows the connection.
+	watchdog->SetHandshaked(*watchedConnection);
+
+	SCOPE_Leave {
+		watchdog->Unwatch(*watchedConnection);
+	};
+
+	ComPtr<Io::AsyncReader> client = watchedConnection;
 
-	auto debugController = co_await this->CreateDebugSession("default");
+	auto session = std::make_shared<ClientSession>();
+	session->client = client;
+
+	if (auto error = RegisterSession(session, std::nullopt)) {
+		LOG_WARN("DAP client is rejected: {}", *error);
+		co_return;
+	}
+
+	co_await RunSession(std::move(session), DapMessageStream::Create(std::move(client), DapFraming::ContentLength));
+}
+
+
+Task<> RemoteController::ServeChannels(ComPtr<Io::AsyncReader> client, DapBodyEncoding payloadEncoding) {
+	auto mux = DapChannelMux::Create(std::move(client));
+
+	co_await mux->Run([this, mux = mux.get(), payloadEncoding](std::string_view channelId, ComPtr<DapChannelStream> channel) {
+		auto session = std::make_shared<ClientSession>();
+		session->client = channel;
+
+		// '/dap' channel (without the id) is bound as the client without the requested location.
+		const std::optional<std::string> location = channelId.empty() ? std::nullopt : std::optional{std::string{channelId}};
+
+		if (auto error = RegisterSession(session, location)) {
+			HandshakeResponse errorResponse;
+			errorResponse.success = false;
+			errorResponse.error = std::move(error);
+
+			HttpStream::SendHttpJsonPacket(runtimeValueCopy(errorResponse), channel->GetPath(), *channel).detach();
+			return false;
+		}
+
+		auto messageStream = DapMessageStream::CreateChannel(channel, channel->GetPath());
+		messageStream->SetPayloadEncoding(payloadEncoding);
+
+		RunChannelSession(RunSession(std::move(session), std::move(messageStream)), mux->shared_from_this(), std::string{channelId}).detach();
+
+		return true;
+	});
+}
+
+
+Task<> RemoteController::RunSession(std::shared_ptr<ClientSession> session, DapMessageStream::Ptr messageStream) {
+	SCOPE_Leave {
+		UnregisterSession(session->id);
+	};
+
+	auto debugController = co_await this->CreateDebugSession(session->location);
 
 	if (!debugController) {
 		co_return;
 	}
 
-	auto debugSession = DebugSession::Create(DapMessageStream::Create(client), std::move(debugController));
+	std::optional<StopSnapshotOptions> snapshotOptions;
+	{
+		lock_(_sessionsMutex);
+		snapshotOptions = _snapshotOptions;
+	}
+
+	auto debugSession = DebugSession::Create(std::move(messageStream), std::move(debugController), std::move(snapshotOptions));
+
+	{
+		lock_(_sessionsMutex);
+		if (session->isClosed) {
+			co_return;
+		}
+
+		session->debugSession = debugSession;
+	}
 
 	co_await debugSession->Run();
 }
 
 
+std::optional<std::string> RemoteController::RegisterSession(const std::shared_ptr<ClientSession>& session, const std::optional<std::string>& requestedLocation) {
+	const std::vector<DebugLocation> locations = GetDebugLocations();
+
+	if (requestedLocation) {
+		const bool isKnown = locations.empty() ?
+			*requestedLocation == DefaultLocation :
+			std::any_of(locations.begin(), locations.end(), [&](const DebugLocation& location) { return location.id == *requestedLocation; });
+
+		if (!isKnown) {
+			return Core::Format::format("Unknown debug location ({})", *requestedLocation);
+		}
+
+		session->location = *requestedLocation;
+	}
+	else if (locations.size() > 1) {
+		return std::string{"Debug location must be chosen"};
+	}
+	else {
+		session->location = locations.empty() ? std::string{DefaultLocation} : locations.front().id;
+	}
+
+	lock_(_sessionsMutex);
+
+	if (_sessions.size() >= _maxSessions) {
+		return Core::Format::format("Sessions limit ({}) is reached", _maxSessions);
+	}
+
+	// the lua state is debugged by the one client at a time: hooks and breakpoints are owned by its controller.
+	const bool isBusy = std::any_of(_sessions.begin(), _sessions.end(), [&](const auto& entry) {
+		return entry.second->location == session->location;
+	});
+
+	if (isBusy) {
+		return Core::Format::format("Debug location ({}) is already in use", session->location);
+	}
+
+	session->id = _nextSessionId++;
+	_sessions.emplace(session->id, session);
+
+	return std::nullopt;
+}
+
+
+void RemoteController::UnregisterSession(unsigned sessionId) {
+	lock_(_sessionsMutex);
+	_sessions.erase(sessionId);
+}
+
+
+void RemoteController::SendHeartbeats() {
+	std::vector<DebugSession::Ptr> debugSessions;
+
+	{
+		lock_(_sessionsMutex);
+		for (const auto& [id, session] : _sessions) {
+			if (session->debugSession && !session->isClosed) {
+				debugSessions.push_back(session->debugSession);
+			}
+		}
+	}
+
+	if (!debugSessions.empty()) {
+		SendHeartbeatsOnPool(std::move(debugSessions)).detach();
+	}
+}
+
+
+std::shared_ptr<RemoteController::Watchdog> RemoteController::GetWatchdog() {
+	lock_(_watchdogMutex);
+
+	if (!_watchdog) {
+		_watchdog = std::make_shared<Watchdog>(*this);
+	}
+
+	return _watchdog;
+}
+
+
+void RemoteController::SetTimeouts(SessionTimeouts timeouts) {
+	const std::shared_ptr<Watchdog> watchdog = GetWatchdog();
+
+	lock_(watchdog->mutex);
+	watchdog->timeouts = timeouts;
+}
+
+
+void RemoteController::SetMaxSessions(size_t maxSessions) {
+	lock_(_sessionsMutex);
+	_maxSessions = maxSessions;
+}
+
+
+void RemoteController::SetSnapshotOptions(std::optional<StopSnapshotOptions> snapshotOptions) {
+	lock_(_sessionsMutex);
+	_snapshotOptions = std::move(snapshotOptions);
+}
+
+
+std::vector<RemoteController::SessionInfo> RemoteController::GetSessions() const {
+	lock_(_sessionsMutex);
+
+	std::vector<SessionInfo> sessions;
+	sessions.reserve(_sessions.size());
+
+	for (const auto& [id, session] : _sessions) {
+		sessions.push_back({id, session->location});
+	}
+
+	return sessions;
+}
+
+
+Task<> RemoteController::CloseSessions() {
+	std::vector<std::pair<ComPtr<Io::AsyncReader>, DebugSession::Ptr>> sessions;
+
+	{
+		lock_(_sessionsMutex);
+		for (const auto& [id, session] : _sessions) {
+			session->isClosed = true;
+			sessions.emplace_back(session->client, session->debugSession);
+		}
+	}
+
+	for (auto& [client, debugSession] : sessions) {
+		if (debugSession) {
+			co_await debugSession->Close();
+		}
+
+		// session completes (and leaves the registry) when its messages stream is closed.
+		if (auto* const disposable = client->as<Disposable*>()) {
+			disposable->dispose();
+		}
+	}
+}
+
+/* -------------------------------------------------------------------------- */
+RemoteController::~RemoteController() {
+	std::shared_ptr<Watchdog> watchdog;
+	{
+		lock_(_watchdogMutex);
+		watchdog = std::move(_watchdog);
+	}
+
+	// alive sessions keep the watchdog, but its thread must not outlive the controller.
+	if (watchdog) {
+		watchdog->Stop();
+	}
+}
+
 
 Task<> RemoteController::Run() {
-	auto server = co_await Network::Server::listen("tcp://:8845");
+	return Run(std::string{DefaultAddress});
+}
+
+
+Task<> RemoteController::Run(std::string address, DapFraming framing) {
+	if (std::string_view{address}.starts_with("unix://")) {
+		LocalSocketServer server{std::move(address)};
+		if (!server.Listen()) {
+			co_return;
+		}
+
+		while (auto client = co_await server.Accept()) {
+			(framing == DapFraming::ContentLength ? SpawnDapClientSession(std::move(client)) : SpawnClientSession(std::move(client))).detach();
+		}
+
+		co_return;
+	}
+
+	auto server = co_await Network::Server::listen(address);
 
 	while (true) {
 		auto client = co_await server->accept();
@@ -61,11 +604,23 @@ Task<> RemoteController::Run() {
 			co_return;
 		}
 
-		auto task = SpawnClientSession(std::move(client));
+		auto task = framing == DapFraming::ContentLength ? SpawnDapClientSession(std::move(client)) : SpawnClientSession(std::move(client));
 		task.detach();
 	}
 }
 
+
+Task<> RemoteController::RunSharedMemory(std::string channelName) {
+	while (true) {
+		auto channel = SharedMemoryStream::Create(channelName, SharedMemoryStream::Side::Server);
+		if (!channel) {
+			co_return;
+		}
+
+		co_await SpawnClientSession(std::move(channel));
+	}
+}
+
 } // namespace Lua::Remoting
 
 
@@ -0,0 +1,81 @@
+//◦ Playrix ◦
+#include "contentlengthstream.h"
+#include "outboundpacket.h"
+#include "lua-toolkit/debug/protocoltrace.h"
+
+
+namespace Runtime {
+
+namespace {
+
+constexpr std::string_view ContentLengthHeader {"Content-Length:"};
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+void ContentLengthStream::AppendBytes(ReadOnlyBuffer bytes) {
+	_inbound.AppendBytes(bytes);
+}
+
+
+std::optional<std::string_view> ContentLengthStream::GetNextPacket() {
+	if (std::optional<InboundPacketBuffer::Packet> packet = _inbound.GetNextPacket()) {
+		return packet->body;
+	}
+
+	return std::nullopt;
+}
+
+
+bool ContentLengthStream::IsInvalid() const {
+	return _inbound.IsInvalid();
+}
+
+
+Async::Task<std::optional<std::string_view>> ContentLengthStream::ReadPacket(ContentLengthStream& stream, Io::AsyncReader& bytesStream) {
+
+	std::optional<std::string_view> packet;
+
+	while (!(packet = stream.GetNextPacket()) && !stream.IsInvalid()) {
+		auto bytes = co_await bytesStream.read();
+		if (!bytes) {
+			break;
+		}
+
+		stream.AppendBytes(bytes.toReadOnly());
+	}
+
+	co_return packet;
+}
+
+
+Async::Task<> ContentLengthStream::SendJsonPacket(std::function<void (BytesBuffer&)> writeBody, Io::AsyncWriter& stream) {
+
+	try {
+		PooledBytesBuffer packetBytes;
+		AppendJsonPacket(*packetBytes, writeBody);
+
+		co_await stream.write(packetBytes->toReadOnly());
+	}
+	catch (const std::exception& exception) {
+		Halt(exception.what());
+	}
+}
+
+
+void ContentLengthStream::AppendJsonPacket(BytesBuffer& buffer, const std::function<void (BytesBuffer&)>& writeBody) {
+
+	OutboundPacket packet{buffer};
+
+	packet.AppendHeaders(ContentLengthHeader);
+	packet.AppendHeaders(" ");
+	packet.AppendContentLength();
+
+	writeBody(packet.BeginBody());
+	packet.EndBody();
+
+	Debug::ProtocolTrace::Trace(Debug::ProtocolTrace::Direction::Outbound, packet.GetBody());
+}
+
+} // namespace Runtime
@@ -0,0 +1,50 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/memory/bytesbuffer.h>
+#include "inboundpacketbuffer.h"
+
+#include <functional>
+#include <optional>
+#include <string_view>
+
+namespace Runtime {
+
+/**
+	Standard DAP base protocol framing: 'Content-Length: <size>' header(s), empty line and the JSON body.
+*/
+class ContentLengthStream
+{
+public:
+
+	void AppendBytes(ReadOnlyBuffer bytes);
+
+	/**
+		Returns body of the next complete packet. Returned view is valid until the next call to AppendBytes/GetNextPacket.
+	*/
+	std::optional<std::string_view> GetNextPacket();
+
+	/**
+		Framing is broken (garbled or missing Content-Length): no more packets can be read, the stream must be closed.
+	*/
+	bool IsInvalid() const;
+
+	/**
+		Returns nullopt when the bytes stream is closed or the framing is invalid.
+	*/
+	static Async::Task<std::optional<std::string_view>> ReadPacket(ContentLengthStream& stream, Io::AsyncReader& bytesStream);
+
+	static Async::Task<> SendJsonPacket(std::function<void (BytesBuffer&)> writeBody, Io::AsyncWriter& stream);
+
+	/**
+		Appends complete packet to the end of the buffer (several packets can be sent with the single write).
+	*/
+	static void AppendJsonPacket(BytesBuffer& buffer, const std::function<void (BytesBuffer&)>& writeBody);
+
+private:
+
+	InboundPacketBuffer _inbound {true};
+};
+
+} // namespace Runtime
@@ -0,0 +1,303 @@
+//◦ Playrix ◦
+#include "dapchannelmux.h"
+#include "outboundpacket.h"
+#include "lua-toolkit/debug/debugmetrics.h"
+#include <runtime/runtime/runtime.h>
+#include <runtime/threading/lock.h>
+
+#include <cstring>
+
+namespace Runtime {
+
+/* -------------------------------------------------------------------------- */
+DapChannelStream::DapChannelStream(std::shared_ptr<DapChannelMux> mux, std::string path)
+	: _mux(std::move(mux))
+	, _path(std::move(path))
+{
+	Assert(_mux);
+}
+
+
+const std::string& DapChannelStream::GetPath() const {
+	return _path;
+}
+
+
+void DapChannelStream::PushInbound(std::string_view packetBytes) {
+	BytesBuffer chunk(packetBytes.size());
+	memcpy(chunk.data(), packetBytes.data(), packetBytes.size());
+
+	{
+		lock_(_inboundMutex);
+		if (_isClosed) {
+			return;
+		}
+
+		_inbound.emplace_back(std::move(chunk));
+	}
+
+	_inboundAvailable.NotifyAll();
+}
+
+
+void DapChannelStream::dispose() {
+	{
+		lock_(_inboundMutex);
+		_isClosed = true;
+	}
+
+	_inboundAvailable.NotifyAll();
+}
+
+
+Async::Task<BytesBuffer> DapChannelStream::read() {
+	BytesBuffer chunk;
+	bool isSuspended = false;
+
+	{
+		std::unique_lock lock{_inboundMutex};
+
+		while (_inbound.empty() && !_isClosed) {
+			co_await _inboundAvailable.Wait(lock);
+			isSuspended = true;
+			lock = std::unique_lock{_inboundMutex};
+		}
+
+		if (!_inbound.empty()) {
+			chunk = std::move(_inbound.front());
+			_inbound.pop_front();
+		}
+	}
+
+	// resumed by the mux reader: the channel session must not delay routing of the other channels.
+	if (isSuspended) {
+		co_await RuntimeCore::instance().poolScheduler();
+	}
+
+	co_return chunk;
+}
+
+
+Async::Task<> DapChannelStream::write(ReadOnlyBuffer bytes) {
+	return _mux->Enqueue(Com::Acquire{this}, bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+std::shared_ptr<DapChannelMux> DapChannelMux::Create(ComPtr<Io::AsyncReader> connection) {
+	return std::make_shared<DapChannelMux>(std::move(connection));
+}
+
+
+DapChannelMux::DapChannelMux(ComPtr<Io::AsyncReader> connection): _connection(std::move(connection))
+{
+	Assert(_connection);
+}
+
+
+Async::Task<> DapChannelMux::Run(ChannelHandler onChannelOpened) {
+	HttpStream inboundStream;
+
+	while (HttpStream::Packet packet = co_await HttpStream::ReadHttpPacket(inboundStream, *_connection)) {
+		if (!packet.path.starts_with(ChannelPath)) {
+			continue;
+		}
+
+		std::string_view channelId = packet.path.substr(ChannelPath.size());
+		if (!channelId.empty()) {
+			if (channelId.front() != '/') {
+				continue;
+			}
+
+			channelId.remove_prefix(1);
+		}
+
+		ComPtr<DapChannelStream> channel;
+		bool isOpened = false;
+
+		{
+			lock_(_channelsMutex);
+
+			auto [iter, emplaced] = _channels.try_emplace(std::string{channelId});
+			if (emplaced) {
+				iter->second = Com::createInstance<DapChannelStream>(shared_from_this(), std::string{packet.path});
+				isOpened = true;
+			}
+
+			channel = iter->second;
+		}
+
+		if (isOpened && !onChannelOpened(channelId, channel)) {
+			channel->dispose();
+			channel = nullptr;
+
+			lock_(_channelsMutex);
+			_channels[std::string{channelId}] = nullptr;
+		}
+
+		if (channel) {
+			channel->PushInbound(packet.bytes);
+		}
+	}
+
+	// connection is closed: channel sessions are ended by the closed streams.
+	std::unordered_map<std::string, ComPtr<DapChannelStream>> channels;
+	{
+		lock_(_channelsMutex);
+		channels = std::move(_channels);
+		_channels.clear();
+	}
+
+	for (auto& [channelId, channel] : channels) {
+		if (channel) {
+			channel->dispose();
+		}
+	}
+}
+
+
+void DapChannelMux::CloseChannel(std::string_view channelId) {
+	ComPtr<DapChannelStream> channel;
+
+	{
+		lock_(_channelsMutex);
+
+		const auto iter = _channels.find(std::string{channelId});
+		if (iter == _channels.end()) {
+			return;
+		}
+
+		channel = std::move(iter->second);
+		_channels.erase(iter);
+	}
+
+	if (channel) {
+		channel->dispose();
+	}
+}
+
+
+Async::Task<> DapChannelMux::Enqueue(ComPtr<DapChannelStream> channel, ReadOnlyBuffer bytes) {
+	BytesBuffer chunk(bytes.size());
+	memcpy(chunk.data(), bytes.data(), bytes.size());
+
+	bool isWriterStarted = false;
+	bool isSuspended = false;
+
+	{
+		// backpressure is per channel: the slow channel does not suspend writes of the others.
+		std::unique_lock lock{_outboundMutex};
+
+		while (channel->_outbound.size() >= MaxQueuedWrites && !_isBroken) {
+			co_await _outboundSpaceAvailable.Wait(lock);
+			isSuspended = true;
+			lock = std::unique_lock{_outboundMutex};
+		}
+
+		if (_isBroken) {
+			co_return;
+		}
+
+		channel->_outbound.emplace_back(std::move(chunk));
+		Debug::DebugMetrics::AddQueuedChannelWrites(1);
+		if (!channel->_isScheduled) {
+			channel->_isScheduled = true;
+			_scheduledChannels.emplace_back(std::move(channel));
+		}
+
+		if (!_isWriting) {
+			_isWriting = true;
+			isWriterStarted = true;
+		}
+	}
+
+	if (isWriterStarted) {
+		WriteScheduledChannels(shared_from_this()).detach();
+	}
+
+	// resumed by the writer: the channel's continuation must not delay the writes.
+	if (isSuspended) {
+		co_await RuntimeCore::instance().poolScheduler();
+	}
+}
+
+
+Async::Task<> DapChannelMux::WriteScheduledChannels(std::shared_ptr<DapChannelMux> self) {
+	// channels are written on the pool, not on the thread of the channel that started the writer.
+	co_await RuntimeCore::instance().poolScheduler();
+
+	Io::AsyncWriter* const asyncWriter = _connection->as<Io::AsyncWriter*>();
+	Assert(asyncWriter);
+
+	while (true) {
+		PooledBytesBuffer packetsBytes;
+
+		{
+			lock_(_outboundMutex);
+
+			// round robin: the channel with more queued writes goes to the end of the queue after every write taken.
+			while (!_scheduledChannels.empty() && packetsBytes->size() < MaxWriteSize) {
+				ComPtr<DapChannelStream> channel = std::move(_scheduledChannels.front());
+				_scheduledChannels.pop_front();
+
+				const BytesBuffer& chunk = channel->_outbound.front();
+				memcpy(packetsBytes->append(chunk.size()), chunk.data(), chunk.size());
+				channel->_outbound.pop_front();
+				Debug::DebugMetrics::AddQueuedChannelWrites(-1);
+
+				if (channel->_outbound.empty()) {
+					channel->_isScheduled = false;
+				}
+				else {
+					_scheduledChannels.emplace_back(std::move(channel));
+				}
+			}
+
+			if (packetsBytes->size() == 0) {
+				_isWriting = false;
+				break;
+			}
+		}
+
+		_outboundSpaceAvailable.NotifyAll();
+
+		bool isFailed = false;
+
+		try {
+			co_await asyncWriter->write(packetsBytes->toReadOnly());
+		}
+		catch (const std::exception&) {
+			isFailed = true;
+		}
+
+		if (isFailed) {
+			OnWriteFailed();
+			break;
+		}
+	}
+}
+
+
+void DapChannelMux::OnWriteFailed() {
+	{
+		lock_(_outboundMutex);
+		_isBroken = true;
+		_isWriting = false;
+
+		for (const ComPtr<DapChannelStream>& channel : _scheduledChannels) {
+			Debug::DebugMetrics::AddQueuedChannelWrites(-static_cast<int64_t>(channel->_outbound.size()));
+			channel->_outbound.clear();
+			channel->_isScheduled = false;
+		}
+
+		_scheduledChannels.clear();
+	}
+
+	_outboundSpaceAvailable.NotifyAll();
+
+	// reader completes and closes all the channels.
+	if (auto* const disposable = _connection->as<Disposable*>()) {
+		disposable->dispose();
+	}
+}
+
+} // namespace Runtime
@@ -0,0 +1,131 @@
+//◦ Playrix ◦
+#pragma once
+#include "httpstream.h"
+#include "debug/asyncwaitlist.h"
+
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/com/comclass.h>
+#include <runtime/com/comptr.h>
+#include <runtime/utils/disposable.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Runtime {
+
+class DapChannelMux;
+
+/**
+	Bytes stream of the one multiplexed channel: inbound packets of the channel are given by the mux reader,
+	written bytes are queued to the mux writer. DapMessageStream is created over it as over the connection.
+	Dispose closes the inbound side: the channel session ends, the connection and other channels are not affected.
+*/
+class DapChannelStream final : public Io::AsyncReader, public Io::AsyncWriter, public Disposable
+{
+	COMCLASS_(Io::AsyncReader, Io::AsyncWriter, Disposable)
+
+public:
+
+	DapChannelStream(std::shared_ptr<DapChannelMux> mux, std::string path);
+
+	const std::string& GetPath() const;
+
+	void PushInbound(std::string_view packetBytes);
+
+	void dispose() override;
+
+private:
+
+	friend class DapChannelMux;
+
+	Async::Task<BytesBuffer> read() override;
+
+	Async::Task<> write(ReadOnlyBuffer) override;
+
+	const std::shared_ptr<DapChannelMux> _mux;
+	const std::string _path;
+
+	std::deque<BytesBuffer> _inbound;
+	std::mutex _inboundMutex;
+	// pending read is suspended, not blocking the pool thread: connection can carry many channels.
+	Debug::AsyncWaitList _inboundAvailable;
+	bool _isClosed = false;
+
+	// guarded by the mux outbound mutex.
+	std::deque<BytesBuffer> _outbound;
+	bool _isScheduled = false;
+};
+
+
+/**
+	Several DAP channels over the single connection (Http framing): inbound packets are routed by the request path '/dap/<channel-id>'
+	('/dap' is the channel with the empty id). Channel is opened by its first packet.
+	Outbound writes of the channels are sent by the writer task (started by the first queued write, ends when all the channels are drained),
+	that takes the channels in turn (one queued write of every channel per round), so the channel that sends large responses does not delay others.
+	Writing channel is suspended (not blocked) while its queue is full.
+*/
+class DapChannelMux : public std::enable_shared_from_this<DapChannelMux>
+{
+public:
+
+	static constexpr std::string_view ChannelPath {"/dap"};
+
+	/**
+		Called on the reader thread before the first packet of the new channel is given to the stream.
+		Returns false when channel is rejected: its packets are dropped.
+	*/
+	using ChannelHandler = std::function<bool (std::string_view channelId, ComPtr<DapChannelStream> channel)>;
+
+	static std::shared_ptr<DapChannelMux> Create(ComPtr<Io::AsyncReader> connection);
+
+	explicit DapChannelMux(ComPtr<Io::AsyncReader> connection);
+
+	/**
+		Reads the connection until it is closed, all the channels are closed after that.
+	*/
+	Async::Task<> Run(ChannelHandler onChannelOpened);
+
+	/**
+		Forgets the channel (i.e. its session is ended): next packet with the same id opens the new channel.
+	*/
+	void CloseChannel(std::string_view channelId);
+
+private:
+
+	friend class DapChannelStream;
+
+	static constexpr size_t MaxQueuedWrites = 64;
+	static constexpr size_t MaxWriteSize = 256 * 1024;
+
+	Async::Task<> Enqueue(ComPtr<DapChannelStream> channel, ReadOnlyBuffer bytes);
+
+	/**
+		Writer task keeps the mux alive until the queues are drained.
+	*/
+	Async::Task<> WriteScheduledChannels(std::shared_ptr<DapChannelMux> self);
+
+	/**
+		Connection is dead: queued and later writes are dropped.
+	*/
+	void OnWriteFailed();
+
+	const ComPtr<Io::AsyncReader> _connection;
+
+	// rejected channels are kept with the null stream.
+	std::unordered_map<std::string, ComPtr<DapChannelStream>> _channels;
+	std::mutex _channelsMutex;
+
+	std::deque<ComPtr<DapChannelStream>> _scheduledChannels;
+	std::mutex _outboundMutex;
+	Debug::AsyncWaitList _outboundSpaceAvailable;
+	bool _isWriting = false;
+	bool _isBroken = false;
+};
+
+} // namespace Runtime
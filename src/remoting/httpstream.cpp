@@ -1,100 +1,117 @@
 //◦ Playrix ◦
 #include "httpstream.h"
+#include "outboundpacket.h"
+#include "lua-toolkit/debug/protocoltrace.h"
 #include <runtime/io/readerwriter.h>
 #include <runtime/serialization/json.h>
+#include <runtime/utils/strings.h>
+
+#include <tuple>
 
 
 namespace Runtime {
 
+namespace {
+
+/**
+	Method and path of the request line: 'POST /dap HTTP/1.1'.
+*/
+std::pair<std::string_view, std::string_view> ParseRequestLine(std::string_view headers) {
+	const std::string_view requestLine = headers.substr(0, headers.find("\r\n"));
+
+	const size_t pathBegin = requestLine.find(' ');
+	if (pathBegin == std::string_view::npos) {
+		return {};
+	}
+
+	const std::string_view path = requestLine.substr(pathBegin + 1);
+
+	return {requestLine.substr(0, pathBegin), path.substr(0, path.find(' '))};
+}
+
+} // namespace
 
 /* -------------------------------------------------------------------------- */
 void HttpStream::AppendBytes(ReadOnlyBuffer bytes) {
-	PopLastPacketBytes();
-	memcpy(_inboundBuffer.append(bytes.size()), bytes.data(), bytes.size());
+	_inbound.AppendBytes(bytes);
 }
 
 HttpStream::Packet HttpStream::GetNextPacket() {
 
-	PopLastPacketBytes();
-
-	const HttpParser headers(asStringView(_inboundBuffer));
-	if (!headers) {
+	const std::optional<InboundPacketBuffer::Packet> inboundPacket = _inbound.GetNextPacket();
+	if (!inboundPacket) {
 		return {};
 	}
 
-	if (headers["Content-Length"].empty()) {
-
-	}
+	// Headers are parsed once, when the packet is complete.
+	Packet packet {HttpParser{inboundPacket->bytes}, inboundPacket->body};
+	std::tie(packet.method, packet.path) = ParseRequestLine(inboundPacket->headers);
+	packet.bytes = inboundPacket->bytes;
 
-	const auto contentType = headers["Content-Type"];
-	const auto contentLen = headers.contentLength();
-	const size_t packetSize = headers.headersLength() + contentLen;
-	if (_inboundBuffer.size() < packetSize) {
-		return {};
-	}
+	return packet;
+}
 
-	_lastPacketSize = packetSize;
+bool HttpStream::IsInvalid() const {
+	return _inbound.IsInvalid();
+}
 
-	std::string_view body (reinterpret_cast<const char*>(_inboundBuffer.data()) + headers.headersLength(), contentLen);
+Async::Task<> HttpStream::SendHttpJsonPacket(RuntimeValue::Ptr bodyValue, std::string_view path, Io::AsyncWriter& stream) {
 
-	return {headers, body};
+	return SendHttpJsonPacket([bodyValue = std::move(bodyValue)](BytesBuffer& buffer) {
+		Io::BufferWriter writer{buffer};
+		Serialization::JsonWrite(writer, bodyValue).rethrowIfException();
+	}, path, stream);
 }
 
-void HttpStream::PopLastPacketBytes() {
-	if (_lastPacketSize == 0) {
-		return;
-	}
-	Assert(_lastPacketSize <= _inboundBuffer.size());
+Async::Task<> HttpStream::SendHttpJsonPacket(JsonBodyWriter writeBody, std::string_view path, Io::AsyncWriter& stream) {
 
-	const size_t newSize = _inboundBuffer.size() - _lastPacketSize;
-	if (newSize > 0) {
-		memcpy(_inboundBuffer.data(), _inboundBuffer.data() + _lastPacketSize, newSize);
+	try {
+		PooledBytesBuffer packetBytes;
+		AppendHttpPacket(*packetBytes, writeBody, path);
+
+		co_await stream.write(packetBytes->toReadOnly());
+	}
+	catch (const std::exception& exception) {
+		Halt(exception.what());
 	}
-	_inboundBuffer.resize(newSize);
-	_lastPacketSize = 0;
 }
 
-Async::Task<> HttpStream::SendHttpJsonPacket(RuntimeValue::Ptr bodyValue, std::string_view path, Io::AsyncWriter& stream) {
 
-	try {
-		BytesBuffer bodyBytes;
-		{
-			Io::BufferWriter writer{bodyBytes};
-			Serialization::JsonWrite(writer, bodyValue).rethrowIfException();
-		}
+void HttpStream::AppendHttpPacket(BytesBuffer& buffer, const JsonBodyWriter& writeBody, std::string_view path, std::string_view contentType) {
 
+	OutboundPacket packet{buffer};
 
-		if (IsDebuggerPresent() == TRUE) {
-			auto bodyView = asStringView(bodyBytes);
-			OutputDebugStringA("\nRESPONSE:\n");
-			OutputDebugStringA(std::string(bodyView).c_str());
-			OutputDebugStringA("\n");
-		}
+	packet.AppendHeaders("POST ");
+	packet.AppendHeaders(path);
+	packet.AppendHeaders(" HTTP/1.1\r\nContent-Type: ");
+	packet.AppendHeaders(contentType);
+	packet.AppendHeaders("\r\nContent-Length: ");
+	packet.AppendContentLength();
 
+	writeBody(packet.BeginBody());
+	packet.EndBody();
 
-		std::string headers = Core::Format::format("POST {} HTTP/1.1\r\n", path);
-		headers = headers + 
-			"Content-Type: application/json\r\n"
-			"Content-Length: " + std::to_string(bodyBytes.size()) + 
-			"\r\n\r\n";
+	Debug::ProtocolTrace::Trace(Debug::ProtocolTrace::Direction::Outbound, packet.GetBody());
+}
 
-		BytesBuffer packetBytes(headers.size() + bodyBytes.size());
-		memcpy(packetBytes.data(), headers.data(), headers.size());
-		memcpy(packetBytes.data() + headers.size(), bodyBytes.data(), bodyBytes.size());
+Async::Task<> HttpStream::SendHttpResponse(unsigned statusCode, std::string_view reason, std::string_view contentType, std::string_view body, Io::AsyncWriter& stream) {
 
-		co_await stream.write(packetBytes.toReadOnly());
-	}
-	catch (const std::exception& exception) {
-		Halt(exception.what());
-	}
+	std::string response = Core::Format::format("HTTP/1.1 {} {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n", statusCode, reason, contentType, body.size());
+	response.append(body);
+
+	BytesBuffer responseBytes(response.size());
+	memcpy(responseBytes.data(), response.data(), response.size());
+
+	co_await stream.write(responseBytes.toReadOnly());
 }
 
+
 Async::Task<HttpStream::Packet> HttpStream::ReadHttpPacket(HttpStream& httpStream, Io::AsyncReader& bytesStream) {
 	Packet packet;
 
-	while (!packet) {
+	while (!packet && !httpStream.IsInvalid()) {
 		packet = httpStream.GetNextPacket();
-		if (!packet) {
+		if (!packet && !httpStream.IsInvalid()) {
 			auto bytes = co_await bytesStream.read();
 			if (!bytes) {
 				break;
@@ -5,6 +5,10 @@
 #include <runtime/memory/bytesbuffer.h>
 #include <runtime/remoting/httpparser.h>
 #include <runtime/serialization/runtimevalue.h>
+#include "inboundpacketbuffer.h"
+
+#include <functional>
+#include <optional>
 
 namespace Runtime {
 
@@ -17,6 +21,13 @@ public:
 		HttpParser headers;
 		std::string_view body;
 
+		/* Request method (i.e. 'POST') and path (i.e. '/dap'). */
+		std::string_view method;
+		std::string_view path;
+
+		/* Whole packet: headers and body. */
+		std::string_view bytes;
+
 		Packet();
 
 		Packet(HttpParser, std::string_view);
@@ -28,16 +39,41 @@ public:
 
 	Packet GetNextPacket();
 
+	/**
+		Framing is broken (garbled Content-Length, too long headers): no more packets can be read, the stream must be closed.
+	*/
+	bool IsInvalid() const;
+
+	/**
+		Returns empty packet when the bytes stream is closed or the framing is invalid.
+	*/
 	static Async::Task<Packet> ReadHttpPacket(HttpStream& httpStream, Io::AsyncReader& bytesStream);
 
+	static constexpr std::string_view JsonContentType {"application/json"};
+	static constexpr std::string_view MsgPackContentType {"application/msgpack"};
+
+	/**
+		Callback that appends the body to the packet buffer.
+	*/
+	using JsonBodyWriter = std::function<void (BytesBuffer&)>;
+
 	static Async::Task<> SendHttpJsonPacket(RuntimeValue::Ptr, std::string_view path, Io::AsyncWriter& stream);
 
-private:
+	static Async::Task<> SendHttpJsonPacket(JsonBodyWriter writeBody, std::string_view path, Io::AsyncWriter& stream);
+
+	/**
+		Appends complete packet to the end of the buffer (several packets can be sent with the single write).
+	*/
+	static void AppendHttpPacket(BytesBuffer& buffer, const JsonBodyWriter& writeBody, std::string_view path, std::string_view contentType = JsonContentType);
 
-	void PopLastPacketBytes();
+	/**
+		Response to the plain HTTP request (i.e. metrics scrape): the connection is not kept alive.
+	*/
+	static Async::Task<> SendHttpResponse(unsigned statusCode, std::string_view reason, std::string_view contentType, std::string_view body, Io::AsyncWriter& stream);
+
+private:
 
-	BytesBuffer _inboundBuffer;
-	size_t _lastPacketSize = 0;
+	InboundPacketBuffer _inbound {false};
 };
 
 
@@ -0,0 +1,136 @@
+//◦ Playrix ◦
+#include "inboundpacketbuffer.h"
+#include <runtime/utils/strings.h>
+
+#include <charconv>
+#include <cstring>
+
+namespace Runtime {
+
+namespace {
+
+constexpr std::string_view HeadersEnd {"\r\n\r\n"};
+constexpr std::string_view ContentLengthHeader {"Content-Length:"};
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+InboundPacketBuffer::InboundPacketBuffer(bool isContentLengthRequired): _isContentLengthRequired(isContentLengthRequired)
+{}
+
+
+void InboundPacketBuffer::AppendBytes(ReadOnlyBuffer bytes) {
+	PopLastPacketBytes();
+	memcpy(_inboundBuffer.append(bytes.size()), bytes.data(), bytes.size());
+}
+
+
+std::optional<InboundPacketBuffer::Packet> InboundPacketBuffer::GetNextPacket() {
+
+	if (_isInvalid) {
+		return std::nullopt;
+	}
+
+	PopLastPacketBytes();
+
+	const std::string_view inbound = asStringView(_inboundBuffer).substr(_readOffset);
+
+	if (!_packetSize) {
+		// Search of the headers end is resumed from where the previous search (on the partial data) has stopped.
+		const size_t scanFrom = _headersScanOffset < HeadersEnd.size() ? 0 : _headersScanOffset - (HeadersEnd.size() - 1);
+		const size_t headersEnd = inbound.find(HeadersEnd, scanFrom);
+		if (headersEnd == std::string_view::npos) {
+			_headersScanOffset = inbound.size();
+			_isInvalid = inbound.size() > MaxHeadersLength;
+			return std::nullopt;
+		}
+
+		const std::optional<size_t> contentLength = ParseContentLength(inbound.substr(0, headersEnd));
+		if (!contentLength || *contentLength > MaxContentLength) {
+			_isInvalid = true;
+			return std::nullopt;
+		}
+
+		_headersScanOffset = 0;
+		_headersLength = headersEnd + HeadersEnd.size();
+		_packetSize = _headersLength + *contentLength;
+	}
+
+	if (inbound.size() < *_packetSize) {
+		return std::nullopt;
+	}
+
+	Packet packet;
+	packet.headers = inbound.substr(0, _headersLength);
+	packet.body = inbound.substr(_headersLength, *_packetSize - _headersLength);
+	packet.bytes = inbound.substr(0, *_packetSize);
+
+	_lastPacketSize = *_packetSize;
+	_packetSize.reset();
+
+	return packet;
+}
+
+
+bool InboundPacketBuffer::IsInvalid() const {
+	return _isInvalid;
+}
+
+
+std::optional<size_t> InboundPacketBuffer::ParseContentLength(std::string_view headers) const {
+
+	while (!headers.empty()) {
+		const size_t lineEnd = headers.find("\r\n");
+		std::string_view line = headers.substr(0, lineEnd);
+		headers = lineEnd == std::string_view::npos ? std::string_view{} : headers.substr(lineEnd + 2);
+
+		if (line.size() < ContentLengthHeader.size() || !Strings::icaseEqual(line.substr(0, ContentLengthHeader.size()), ContentLengthHeader)) {
+			continue;
+		}
+
+		line.remove_prefix(ContentLengthHeader.size());
+		while (!line.empty() && line.front() == ' ') {
+			line.remove_prefix(1);
+		}
+
+		while (!line.empty() && line.back() == ' ') {
+			line.remove_suffix(1);
+		}
+
+		size_t contentLength = 0;
+		const auto [end, error] = std::from_chars(line.data(), line.data() + line.size(), contentLength);
+		if (error != std::errc{} || end != line.data() + line.size()) {
+			return std::nullopt;
+		}
+
+		return contentLength;
+	}
+
+	return _isContentLengthRequired ? std::nullopt : std::optional<size_t>{0};
+}
+
+
+void InboundPacketBuffer::PopLastPacketBytes() {
+	if (_lastPacketSize == 0) {
+		return;
+	}
+	Assert(_readOffset + _lastPacketSize <= _inboundBuffer.size());
+
+	_readOffset += _lastPacketSize;
+	_lastPacketSize = 0;
+
+	const size_t newSize = _inboundBuffer.size() - _readOffset;
+
+	if (newSize == 0) {
+		_inboundBuffer.resize(0);
+		_readOffset = 0;
+	}
+	else if (_readOffset >= CompactionThreshold && _readOffset >= newSize) {
+		memmove(_inboundBuffer.data(), _inboundBuffer.data() + _readOffset, newSize);
+		_inboundBuffer.resize(newSize);
+		_readOffset = 0;
+	}
+}
+
+} // namespace Runtime
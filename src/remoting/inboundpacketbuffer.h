@@ -0,0 +1,71 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/memory/bytesbuffer.h>
+
+#include <optional>
+#include <string_view>
+
+namespace Runtime {
+
+/**
+	Inbound bytes of the stream framed by the headers (ended by the empty line) and the body of 'Content-Length' bytes:
+	shared by the HTTP and the standard DAP framings.
+	Consumed bytes are not moved out of the buffer on every packet: only the read offset is advanced,
+	the buffer is compacted when it is fully consumed or when consumed part is large enough.
+	Only the offsets of the partially received packet are kept (buffer can be reallocated by the next append): headers are scanned once per packet.
+*/
+class InboundPacketBuffer
+{
+public:
+
+	struct Packet
+	{
+		/* Headers including the ending empty line. */
+		std::string_view headers;
+		std::string_view body;
+
+		/* Whole packet: headers and body. */
+		std::string_view bytes;
+	};
+
+	/**
+		isContentLengthRequired: packet without the 'Content-Length' header is invalid, otherwise its body is empty (i.e. HTTP GET).
+	*/
+	explicit InboundPacketBuffer(bool isContentLengthRequired);
+
+	void AppendBytes(ReadOnlyBuffer bytes);
+
+	/**
+		Returns the next complete packet, views are valid until the next call to AppendBytes/GetNextPacket.
+		Returns nullopt when the packet is not received yet, or when the stream is invalid.
+	*/
+	std::optional<Packet> GetNextPacket();
+
+	/**
+		Headers are garbled (no valid Content-Length, too long headers or body): the stream can not be resynchronized and must be closed.
+	*/
+	bool IsInvalid() const;
+
+private:
+
+	static constexpr size_t CompactionThreshold = 64 * 1024;
+	static constexpr size_t MaxHeadersLength = 64 * 1024;
+	static constexpr size_t MaxContentLength = 256 * 1024 * 1024;
+
+	std::optional<size_t> ParseContentLength(std::string_view headers) const;
+
+	void PopLastPacketBytes();
+
+	const bool _isContentLengthRequired;
+
+	BytesBuffer _inboundBuffer;
+	size_t _readOffset = 0;
+	size_t _lastPacketSize = 0;
+
+	size_t _headersScanOffset = 0;
+	size_t _headersLength = 0;
+	std::optional<size_t> _packetSize;
+	bool _isInvalid = false;
+};
+
+} // namespace Runtime
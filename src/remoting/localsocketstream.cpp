@@ -0,0 +1,542 @@
+//◦ Playrix ◦
+#include "localsocketstream.h"
+#include "debug/asyncwaitlist.h"
+#include <runtime/runtime/runtime.h>
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace Runtime {
+
+namespace {
+
+constexpr std::string_view UnixSchemePrefix {"unix://"};
+
+constexpr size_t ReadBlockSize = 64 * 1024;
+
+/**
+	Received bytes are kept up to this size until the stream reader takes them, then the socket is not read until the reader catches up.
+*/
+constexpr size_t MaxReadAheadSize = 1024 * 1024;
+
+
+/**
+	Libuv loop of the local transports, runs on its own thread until the process exits.
+	Handles are created, used and closed only by the loop thread: the other threads post the work to it.
+*/
+class LocalLoop
+{
+public:
+
+	static LocalLoop& Instance() {
+		// never destroyed: handles of the streams that outlive the static destruction are not closed on exit.
+		static LocalLoop* const loop = new LocalLoop;
+		return *loop;
+	}
+
+	void Post(std::function<void (uv_loop_t&)> work) {
+		{
+			lock_(_mutex);
+			_work.emplace_back(std::move(work));
+		}
+
+		uv_async_send(&_wakeup);
+	}
+
+private:
+
+	LocalLoop() {
+		uv_loop_init(&_loop);
+		uv_async_init(&_loop, &_wakeup, [](uv_async_t* handle) {
+			static_cast<LocalLoop*>(handle->data)->ExecuteWork();
+		});
+		_wakeup.data = this;
+
+		std::thread([this] {
+			uv_run(&_loop, UV_RUN_DEFAULT);
+		}).detach();
+	}
+
+	void ExecuteWork() {
+		std::vector<std::function<void (uv_loop_t&)>> work;
+
+		{
+			lock_(_mutex);
+			work.swap(_work);
+		}
+
+		for (auto& item : work) {
+			item(_loop);
+		}
+	}
+
+	uv_loop_t _loop {};
+	uv_async_t _wakeup {};
+	std::mutex _mutex;
+	std::vector<std::function<void (uv_loop_t&)>> _work;
+};
+
+
+/**
+	Result of the loop operation awaited by the coroutine.
+*/
+template<typename T>
+class LoopCompletion
+{
+public:
+
+	void Complete(T value) {
+		{
+			lock_(_mutex);
+			_value = std::move(value);
+		}
+
+		_completed.NotifyAll();
+	}
+
+	Async::Task<T> Wait() {
+		bool isSuspended = false;
+
+		{
+			std::unique_lock lock{_mutex};
+
+			while (!_value) {
+				co_await _completed.Wait(lock);
+				isSuspended = true;
+				lock = std::unique_lock{_mutex};
+			}
+		}
+
+		// resumed by the loop thread: the caller must not delay the other local connections.
+		if (isSuspended) {
+			co_await RuntimeCore::instance().poolScheduler();
+		}
+
+		co_return std::move(*_value);
+	}
+
+private:
+
+	std::mutex _mutex;
+	std::optional<T> _value;
+	Debug::AsyncWaitList _completed;
+};
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+struct LocalSocketStream::Pipe : std::enable_shared_from_this<Pipe>
+{
+	/**
+		Write request alive until its callback: the written bytes are owned by the awaiting write call.
+	*/
+	struct WriteRequest
+	{
+		uv_write_t request {};
+		std::shared_ptr<Pipe> pipe;
+		std::shared_ptr<WriteRequest> self;
+		LoopCompletion<bool> completion;
+	};
+
+	/** Loop thread. */
+	bool Open(uv_loop_t& loop) {
+		if (uv_pipe_init(&loop, &handle, 0) != 0) {
+			return false;
+		}
+
+		handle.data = this;
+		self = shared_from_this();
+
+		return true;
+	}
+
+	/** Loop thread. */
+	void StartReading() {
+		if (uv_is_closing(AsHandle())) {
+			return;
+		}
+
+		const int result = uv_read_start(AsStream(), &Pipe::OnAllocate, &Pipe::OnRead);
+		if (result != 0 && result != UV_EALREADY) {
+			Close();
+		}
+	}
+
+	/** Loop thread. */
+	void Write(const std::shared_ptr<WriteRequest>& request, uv_buf_t buffer) {
+		if (uv_is_closing(AsHandle())) {
+			request->completion.Complete(false);
+			return;
+		}
+
+		request->pipe = shared_from_this();
+		request->self = request;
+		request->request.data = request.get();
+
+		const int result = uv_write(&request->request, AsStream(), &buffer, 1, [](uv_write_t* write, int status) {
+			const std::shared_ptr<WriteRequest> request = std::move(static_cast<WriteRequest*>(write->data)->self);
+
+			// failed write breaks the connection: the reader gets the end of the stream.
+			if (status != 0 && status != UV_ECANCELED) {
+				request->pipe->Close();
+			}
+
+			request->completion.Complete(status == 0);
+		});
+
+		if (result != 0) {
+			request->self.reset();
+			Close();
+			request->completion.Complete(false);
+		}
+	}
+
+	/** Loop thread. Pending writes are canceled, pending read completes with the empty buffer. */
+	void Close() {
+		if (!self || uv_is_closing(AsHandle())) {
+			return;
+		}
+
+		uv_close(AsHandle(), [](uv_handle_t* handle) {
+			// the last reference can be the loop's one.
+			const std::shared_ptr<Pipe> pipe = std::move(static_cast<Pipe*>(handle->data)->self);
+		});
+
+		{
+			lock_(mutex);
+			isClosed = true;
+		}
+
+		readable.NotifyAll();
+	}
+
+	uv_handle_t* AsHandle() {
+		return reinterpret_cast<uv_handle_t*>(&handle);
+	}
+
+	uv_stream_t* AsStream() {
+		return reinterpret_cast<uv_stream_t*>(&handle);
+	}
+
+	uv_pipe_t handle {};
+	// keeps the pipe alive while the loop owns the open handle.
+	std::shared_ptr<Pipe> self;
+	// loop thread only.
+	BytesBuffer readBuffer;
+
+	std::mutex mutex;
+	std::deque<BytesBuffer> received;
+	size_t receivedSize = 0;
+	bool isReadPaused = false;
+	bool isClosed = false;
+	Debug::AsyncWaitList readable;
+
+private:
+
+	static void OnAllocate(uv_handle_t* handle, size_t, uv_buf_t* buffer) {
+		Pipe& pipe = *static_cast<Pipe*>(handle->data);
+		if (pipe.readBuffer.size() != ReadBlockSize) {
+			pipe.readBuffer = BytesBuffer(ReadBlockSize);
+		}
+
+		*buffer = uv_buf_init(reinterpret_cast<char*>(pipe.readBuffer.data()), static_cast<unsigned>(pipe.readBuffer.size()));
+	}
+
+	static void OnRead(uv_stream_t* stream, ssize_t count, const uv_buf_t*) {
+		Pipe& pipe = *static_cast<Pipe*>(stream->data);
+
+		if (count < 0) {
+			// end of the stream or the connection error.
+			pipe.Close();
+			return;
+		}
+
+		if (count == 0) {
+			return;
+		}
+
+		// read block is reused: the queued chunk takes only the received size.
+		BytesBuffer chunk(static_cast<size_t>(count));
+		memcpy(chunk.data(), pipe.readBuffer.data(), chunk.size());
+
+		{
+			lock_(pipe.mutex);
+			pipe.receivedSize += chunk.size();
+			pipe.received.emplace_back(std::move(chunk));
+
+			if (pipe.receivedSize >= MaxReadAheadSize) {
+				pipe.isReadPaused = true;
+				uv_read_stop(stream);
+			}
+		}
+
+		pipe.readable.NotifyAll();
+	}
+};
+
+
+/* -------------------------------------------------------------------------- */
+struct LocalSocketServer::Listener : std::enable_shared_from_this<Listener>
+{
+	/** Loop thread. */
+	bool Listen(uv_loop_t& loop, const std::string& path) {
+		if (uv_pipe_init(&loop, &handle, 0) != 0) {
+			return false;
+		}
+
+		handle.data = this;
+		self = shared_from_this();
+
+		if (uv_pipe_bind(&handle, path.c_str()) != 0 || uv_listen(AsStream(), SOMAXCONN, &Listener::OnConnection) != 0) {
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Loop thread. Libuv removes the socket file of the closed server. */
+	void Close() {
+		if (!self || uv_is_closing(AsHandle())) {
+			return;
+		}
+
+		uv_close(AsHandle(), [](uv_handle_t* handle) {
+			const std::shared_ptr<Listener> listener = std::move(static_cast<Listener*>(handle->data)->self);
+		});
+
+		std::deque<std::shared_ptr<LocalSocketStream::Pipe>> notAccepted;
+
+		{
+			lock_(mutex);
+			isClosed = true;
+			notAccepted.swap(accepted);
+		}
+
+		for (const auto& pipe : notAccepted) {
+			pipe->Close();
+		}
+
+		acceptable.NotifyAll();
+	}
+
+	uv_handle_t* AsHandle() {
+		return reinterpret_cast<uv_handle_t*>(&handle);
+	}
+
+	uv_stream_t* AsStream() {
+		return reinterpret_cast<uv_stream_t*>(&handle);
+	}
+
+	uv_pipe_t handle {};
+	// keeps the listener alive while the loop owns the open handle.
+	std::shared_ptr<Listener> self;
+
+	std::mutex mutex;
+	std::deque<std::shared_ptr<LocalSocketStream::Pipe>> accepted;
+	bool isClosed = false;
+	Debug::AsyncWaitList acceptable;
+
+private:
+
+	static void OnConnection(uv_stream_t* server, int status) {
+		Listener& listener = *static_cast<Listener*>(server->data);
+
+		if (status < 0) {
+			listener.Close();
+			return;
+		}
+
+		auto pipe = std::make_shared<LocalSocketStream::Pipe>();
+		if (!pipe->Open(*server->loop)) {
+			return;
+		}
+
+		if (uv_accept(server, pipe->AsStream()) != 0) {
+			pipe->Close();
+			return;
+		}
+
+		// accepted connection is read ahead until the controller takes it.
+		pipe->StartReading();
+
+		{
+			lock_(listener.mutex);
+			listener.accepted.emplace_back(std::move(pipe));
+		}
+
+		listener.acceptable.NotifyAll();
+	}
+};
+
+
+/* -------------------------------------------------------------------------- */
+LocalSocketStream::LocalSocketStream(std::shared_ptr<Pipe> pipe): _pipe(std::move(pipe))
+{
+	Assert(_pipe);
+}
+
+
+LocalSocketStream::~LocalSocketStream() {
+	dispose();
+}
+
+
+void LocalSocketStream::dispose() {
+	LocalLoop::Instance().Post([pipe = _pipe](uv_loop_t&) {
+		pipe->Close();
+	});
+}
+
+
+Async::Task<BytesBuffer> LocalSocketStream::read() {
+	const std::shared_ptr<Pipe> pipe = _pipe;
+
+	BytesBuffer chunk;
+	bool isSuspended = false;
+	bool isReadResumed = false;
+
+	{
+		std::unique_lock lock{pipe->mutex};
+
+		while (pipe->received.empty() && !pipe->isClosed) {
+			co_await pipe->readable.Wait(lock);
+			isSuspended = true;
+			lock = std::unique_lock{pipe->mutex};
+		}
+
+		if (!pipe->received.empty()) {
+			chunk = std::move(pipe->received.front());
+			pipe->received.pop_front();
+			pipe->receivedSize -= chunk.size();
+
+			if (pipe->isReadPaused && pipe->receivedSize < MaxReadAheadSize) {
+				pipe->isReadPaused = false;
+				isReadResumed = true;
+			}
+		}
+	}
+
+	if (isReadResumed) {
+		LocalLoop::Instance().Post([pipe](uv_loop_t&) {
+			pipe->StartReading();
+		});
+	}
+
+	// resumed by the loop thread: the session must not delay the other local connections.
+	if (isSuspended) {
+		co_await RuntimeCore::instance().poolScheduler();
+	}
+
+	co_return chunk;
+}
+
+
+Async::Task<> LocalSocketStream::write(ReadOnlyBuffer bytes) {
+	if (bytes.size() == 0) {
+		co_return;
+	}
+
+	// bytes are owned by this call until the write completes.
+	const uv_buf_t buffer = uv_buf_init(const_cast<char*>(reinterpret_cast<const char*>(bytes.data())), static_cast<unsigned>(bytes.size()));
+	const auto request = std::make_shared<Pipe::WriteRequest>();
+
+	LocalLoop::Instance().Post([pipe = _pipe, request, buffer](uv_loop_t&) {
+		pipe->Write(request, buffer);
+	});
+
+	co_await request->completion.Wait();
+}
+
+/* -------------------------------------------------------------------------- */
+LocalSocketServer::LocalSocketServer(std::string path)
+	: _path(std::string_view{path}.starts_with(UnixSchemePrefix) ? path.substr(UnixSchemePrefix.size()) : std::move(path))
+{}
+
+
+LocalSocketServer::~LocalSocketServer() {
+	if (_listener) {
+		LocalLoop::Instance().Post([listener = std::move(_listener)](uv_loop_t&) {
+			listener->Close();
+		});
+	}
+}
+
+
+bool LocalSocketServer::Listen() {
+	Assert(!_listener);
+
+	if (_path.empty()) {
+		return false;
+	}
+
+#ifndef _WIN32
+	// socket file left by the previous (crashed) process prevents bind.
+	::unlink(_path.c_str());
+#endif
+
+	auto listener = std::make_shared<Listener>();
+	std::promise<bool> isListening;
+
+	// handles are created by the loop thread: the one-time setup is waited for by the caller.
+	LocalLoop::Instance().Post([&](uv_loop_t& loop) {
+		isListening.set_value(listener->Listen(loop, _path));
+	});
+
+	if (!isListening.get_future().get()) {
+		return false;
+	}
+
+	_listener = std::move(listener);
+	return true;
+}
+
+
+Async::Task<ComPtr<Io::AsyncReader>> LocalSocketServer::Accept() {
+	Assert(_listener);
+
+	const std::shared_ptr<Listener> listener = _listener;
+
+	std::shared_ptr<LocalSocketStream::Pipe> pipe;
+	bool isSuspended = false;
+
+	{
+		std::unique_lock lock{listener->mutex};
+
+		while (listener->accepted.empty() && !listener->isClosed) {
+			co_await listener->acceptable.Wait(lock);
+			isSuspended = true;
+			lock = std::unique_lock{listener->mutex};
+		}
+
+		if (!listener->accepted.empty()) {
+			pipe = std::move(listener->accepted.front());
+			listener->accepted.pop_front();
+		}
+	}
+
+	// resumed by the loop thread: the client session is spawned on the pool.
+	if (isSuspended) {
+		co_await RuntimeCore::instance().poolScheduler();
+	}
+
+	if (!pipe) {
+		co_return nullptr;
+	}
+
+	co_return Com::createInstance<LocalSocketStream, Io::AsyncReader>(std::move(pipe));
+}
+
+} // namespace Runtime
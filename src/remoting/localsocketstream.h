@@ -0,0 +1,81 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/com/comclass.h>
+#include <runtime/com/comptr.h>
+#include <runtime/utils/disposable.h>
+
+#include <memory>
+#include <string>
+
+namespace Runtime {
+
+/**
+	Connected unix domain socket, named pipe on Windows (local tools on the same machine: profilers, test drivers), no TCP loopback overhead.
+	Sockets are served by the libuv loop of the local transports (one thread for all the local connections and servers):
+	reads and writes are completed by the loop callbacks, idle connection does not hold any thread.
+	Inbound data is read ahead (bounded), dispose and the destruction close the socket: pending read completes with the empty buffer.
+*/
+class LocalSocketStream final : public Io::AsyncReader, public Io::AsyncWriter, public Disposable
+{
+	COMCLASS_(Io::AsyncReader, Io::AsyncWriter, Disposable)
+
+public:
+
+	/**
+		Socket handle owned by the loop: it is alive until the loop closes it.
+	*/
+	struct Pipe;
+
+	explicit LocalSocketStream(std::shared_ptr<Pipe>);
+
+	~LocalSocketStream();
+
+	void dispose() override;
+
+private:
+
+	Async::Task<BytesBuffer> read() override;
+
+	Async::Task<> write(ReadOnlyBuffer) override;
+
+	const std::shared_ptr<Pipe> _pipe;
+};
+
+
+/**
+	Listening unix domain socket (named pipe on Windows). Socket file is (re)created on listen and removed when the server is destroyed.
+*/
+class LocalSocketServer
+{
+public:
+
+	/**
+		Path can be given with the 'unix://' prefix. On Windows it is the pipe name: \\.\pipe\<name>.
+	*/
+	explicit LocalSocketServer(std::string path);
+
+	~LocalSocketServer();
+
+	LocalSocketServer(const LocalSocketServer&) = delete;
+
+	LocalSocketServer& operator = (const LocalSocketServer&) = delete;
+
+	bool Listen();
+
+	/**
+		Returns next connected client or nothing, when server can not accept connections anymore.
+		Connections are accepted by the loop, the call is suspended until the next one.
+	*/
+	Async::Task<ComPtr<Io::AsyncReader>> Accept();
+
+private:
+
+	struct Listener;
+
+	const std::string _path;
+	std::shared_ptr<Listener> _listener;
+};
+
+} // namespace Runtime
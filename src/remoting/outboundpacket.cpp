@@ -0,0 +1,132 @@
+//◦ Playrix ◦
+#include "outboundpacket.h"
+#include <runtime/threading/lock.h>
+
+#include <array>
+#include <charconv>
+
+namespace Runtime {
+
+namespace {
+
+constexpr std::string_view ContentLengthPlaceholder {"0000000000"};
+
+
+/**
+	Outbound packets buffers are reused between messages.
+*/
+class PacketBuffersPool
+{
+public:
+
+	BytesBuffer Acquire() {
+		lock_(_mutex);
+
+		if (_buffers.empty()) {
+			return {};
+		}
+
+		BytesBuffer buffer = std::move(_buffers.back());
+		_buffers.pop_back();
+
+		return buffer;
+	}
+
+	void Release(BytesBuffer buffer) {
+		// huge packets (i.e. large variables responses) are rare, such buffers are not kept.
+		if (buffer.size() > MaxPooledBufferSize) {
+			return;
+		}
+
+		buffer.resize(0);
+
+		lock_(_mutex);
+		if (_buffers.size() < MaxPooledBuffers) {
+			_buffers.emplace_back(std::move(buffer));
+		}
+	}
+
+private:
+
+	static constexpr size_t MaxPooledBuffers = 8;
+	static constexpr size_t MaxPooledBufferSize = 1024 * 1024;
+
+	std::vector<BytesBuffer> _buffers;
+	std::mutex _mutex;
+};
+
+
+PacketBuffersPool& GetPacketBuffersPool() {
+	static PacketBuffersPool pool;
+	return pool;
+}
+
+} // namespace
+
+
+/* -------------------------------------------------------------------------- */
+PooledBytesBuffer::PooledBytesBuffer(): _bytes(GetPacketBuffersPool().Acquire())
+{}
+
+
+PooledBytesBuffer::~PooledBytesBuffer() {
+	GetPacketBuffersPool().Release(std::move(_bytes));
+}
+
+
+BytesBuffer& PooledBytesBuffer::operator * () {
+	return _bytes;
+}
+
+
+BytesBuffer* PooledBytesBuffer::operator -> () {
+	return &_bytes;
+}
+
+
+/* -------------------------------------------------------------------------- */
+OutboundPacket::OutboundPacket(BytesBuffer& buffer): _bytes(buffer)
+{}
+
+
+void OutboundPacket::AppendHeaders(std::string_view headers) {
+	memcpy(_bytes.append(headers.size()), headers.data(), headers.size());
+}
+
+
+void OutboundPacket::AppendContentLength() {
+	Assert(!_contentLengthOffset);
+
+	_contentLengthOffset = _bytes.size();
+	AppendHeaders(ContentLengthPlaceholder);
+}
+
+
+BytesBuffer& OutboundPacket::BeginBody() {
+	AppendHeaders("\r\n\r\n");
+	_headersEnd = _bytes.size();
+
+	return _bytes;
+}
+
+
+void OutboundPacket::EndBody() {
+	Assert(_contentLengthOffset);
+
+	const size_t bodySize = _bytes.size() - _headersEnd;
+
+	std::array<char, ContentLengthPlaceholder.size()> digits;
+	const auto [digitsEnd, error] = std::to_chars(digits.data(), digits.data() + digits.size(), bodySize);
+	Assert(error == std::errc{});
+
+	const size_t digitsCount = static_cast<size_t>(digitsEnd - digits.data());
+	char* const contentLength = reinterpret_cast<char*>(_bytes.data()) + *_contentLengthOffset;
+	memcpy(contentLength + ContentLengthPlaceholder.size() - digitsCount, digits.data(), digitsCount);
+}
+
+
+std::string_view OutboundPacket::GetBody() const {
+	return asStringView(_bytes).substr(_headersEnd);
+}
+
+} // namespace Runtime
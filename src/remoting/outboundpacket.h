@@ -0,0 +1,69 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/memory/bytesbuffer.h>
+
+#include <optional>
+#include <string_view>
+
+namespace Runtime {
+
+/**
+	Bytes buffer taken from the pool of the outbound buffers, returned back on destruction.
+*/
+class PooledBytesBuffer
+{
+public:
+
+	PooledBytesBuffer();
+
+	~PooledBytesBuffer();
+
+	PooledBytesBuffer(const PooledBytesBuffer&) = delete;
+
+	PooledBytesBuffer& operator = (const PooledBytesBuffer&) = delete;
+
+	BytesBuffer& operator * ();
+
+	BytesBuffer* operator -> ();
+
+private:
+
+	BytesBuffer _bytes;
+};
+
+
+/**
+	Outbound packet (headers followed by the body) that is appended to the end of the buffer, several packets can be written into the same buffer.
+	Content-Length is written with the fixed width (leading zeros are allowed): headers size is known before the body is serialized,
+	so the body is written right after the headers without copying, and the length digits are patched in place.
+*/
+class OutboundPacket
+{
+public:
+
+	explicit OutboundPacket(BytesBuffer& buffer);
+
+	void AppendHeaders(std::string_view headers);
+
+	/**
+		Appends Content-Length value placeholder, that will be filled by EndBody().
+	*/
+	void AppendContentLength();
+
+	/**
+		Completes the headers (with the empty line) and returns buffer where the body must be appended.
+	*/
+	BytesBuffer& BeginBody();
+
+	void EndBody();
+
+	std::string_view GetBody() const;
+
+private:
+
+	BytesBuffer& _bytes;
+	std::optional<size_t> _contentLengthOffset;
+	size_t _headersEnd = 0;
+};
+
+} // namespace Runtime
@@ -0,0 +1,411 @@
+//◦ Playrix ◦
+#include "sharedmemorystream.h"
+#include <runtime/runtime/runtime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Runtime {
+
+namespace {
+
+constexpr uint32_t ChannelMagic = 0x4C444132; // 'LDA2': doorbells are added to the header
+
+enum RingIndex : size_t
+{
+	ClientToServer = 0,
+	ServerToClient = 1
+};
+
+
+struct alignas(64) RingHeader
+{
+	alignas(64) std::atomic<uint64_t> writePos;
+	alignas(64) std::atomic<uint64_t> readPos;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory positions must be lock free");
+
+
+inline size_t PeerOf(SharedMemoryStream::Side side) {
+	return side == SharedMemoryStream::Side::Server ? static_cast<size_t>(SharedMemoryStream::Side::Client) : static_cast<size_t>(SharedMemoryStream::Side::Server);
+}
+
+} // namespace
+
+
+struct SharedMemoryStream::Mapping
+{
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t ringSize;
+		std::atomic<uint32_t> closed;
+		// indexed by the side: incremented by the side that changes the rings state, waited by the indexed side.
+		std::atomic<uint32_t> doorbells[2];
+		// set while the indexed side waits for its doorbell: the ringing side skips the wake up syscall otherwise.
+		std::atomic<uint32_t> sleeping[2];
+		RingHeader rings[2];
+	};
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Doorbell must be a plain 32 bits word");
+
+	std::string name;
+	Side side;
+	size_t size = 0;
+	void* memory = nullptr;
+
+#ifdef _WIN32
+	HANDLE handle = nullptr;
+	// auto reset events named after the region, one per side.
+	HANDLE doorbellEvents[2] = {};
+#endif
+
+	~Mapping() {
+#ifdef _WIN32
+		for (const HANDLE event : doorbellEvents) {
+			if (event) {
+				CloseHandle(event);
+			}
+		}
+		if (memory) {
+			UnmapViewOfFile(memory);
+		}
+		if (handle) {
+			CloseHandle(handle);
+		}
+#else
+		if (memory) {
+			munmap(memory, size);
+		}
+		if (side == Side::Server) {
+			shm_unlink(name.c_str());
+		}
+#endif
+	}
+
+	bool Map(size_t ringSize) {
+		const bool isServer = side == Side::Server;
+
+#ifdef _WIN32
+		handle = isServer ?
+			CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(sizeof(Header) + 2 * ringSize), name.c_str()) :
+			OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+
+		if (!handle) {
+			return false;
+		}
+
+		memory = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		if (!memory) {
+			return false;
+		}
+
+		if (!isServer) {
+			MEMORY_BASIC_INFORMATION info;
+			VirtualQuery(memory, &info, sizeof(info));
+			size = info.RegionSize;
+		}
+		else {
+			size = sizeof(Header) + 2 * ringSize;
+		}
+
+		// the event is created by the side that comes first, opened by the other one.
+		for (const Side eventSide : {Side::Server, Side::Client}) {
+			const std::string eventName = name + (eventSide == Side::Server ? "_doorbell_server" : "_doorbell_client");
+			HANDLE& event = doorbellEvents[static_cast<size_t>(eventSide)];
+
+			event = CreateEventA(nullptr, FALSE, FALSE, eventName.c_str());
+			if (!event) {
+				return false;
+			}
+		}
+#else
+		if (isServer) {
+			shm_unlink(name.c_str());
+		}
+
+		const int fd = shm_open(name.c_str(), isServer ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+		if (fd < 0) {
+			return false;
+		}
+
+		if (isServer) {
+			size = sizeof(Header) + 2 * ringSize;
+			if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+				close(fd);
+				return false;
+			}
+		}
+		else {
+			// ring size is known only from the header: the header is mapped first.
+			void* const header = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+			if (header == MAP_FAILED) {
+				close(fd);
+				return false;
+			}
+
+			size = sizeof(Header) + 2 * static_cast<const Header*>(header)->ringSize;
+			munmap(header, sizeof(Header));
+		}
+
+		memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (memory == MAP_FAILED) {
+			memory = nullptr;
+			return false;
+		}
+#endif
+
+		Header& header = GetHeader();
+
+		if (isServer) {
+			new (&header) Header{};
+			header.ringSize = static_cast<uint32_t>(ringSize);
+			header.magic = ChannelMagic;
+			return true;
+		}
+
+		return header.magic == ChannelMagic && size >= sizeof(Header) + 2 * static_cast<size_t>(header.ringSize);
+	}
+
+	Header& GetHeader() const {
+		return *static_cast<Header*>(memory);
+	}
+
+	uint8_t* GetRingData(RingIndex ring) const {
+		return static_cast<uint8_t*>(memory) + sizeof(Header) + ring * GetHeader().ringSize;
+	}
+
+	/**
+		Wakes the side waiting for its doorbell: called after the rings state (or the closed flag) is changed.
+	*/
+	void Ring(size_t doorbellSide) const {
+		Header& header = GetHeader();
+		header.doorbells[doorbellSide].fetch_add(1, std::memory_order_seq_cst);
+
+		// pairs with the sleeping flag store of WaitDoorbell: either the waiter sees the new value or the flag is seen here.
+		if (header.sleeping[doorbellSide].load(std::memory_order_seq_cst) == 0) {
+			return;
+		}
+
+#if defined(_WIN32)
+		SetEvent(doorbellEvents[doorbellSide]);
+#elif defined(__linux__)
+		// the region is shared between processes: futex must not be private.
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&header.doorbells[doorbellSide]), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+	}
+
+	/**
+		Returns when the doorbell differs from the observed value (spurious returns are possible).
+	*/
+	void WaitDoorbell(size_t doorbellSide, uint32_t observed) const {
+		Header& header = GetHeader();
+		std::atomic<uint32_t>& doorbell = header.doorbells[doorbellSide];
+
+		header.sleeping[doorbellSide].store(1, std::memory_order_seq_cst);
+
+		if (doorbell.load(std::memory_order_seq_cst) == observed) {
+#if defined(_WIN32)
+			WaitForSingleObject(doorbellEvents[doorbellSide], INFINITE);
+#elif defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&doorbell), FUTEX_WAIT, observed, nullptr, nullptr, 0);
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+#endif
+		}
+
+		header.sleeping[doorbellSide].store(0, std::memory_order_relaxed);
+	}
+};
+
+
+/* -------------------------------------------------------------------------- */
+ComPtr<Io::AsyncReader> SharedMemoryStream::Create(std::string_view name, Side side, size_t ringSize) {
+	// positions are wrapped with the mask.
+	Assert(ringSize > 0 && (ringSize & (ringSize - 1)) == 0);
+
+	auto mapping = std::make_unique<Mapping>();
+#ifdef _WIN32
+	mapping->name = std::string{name};
+#else
+	mapping->name = name.starts_with("/") ? std::string{name} : "/" + std::string{name};
+#endif
+	mapping->side = side;
+
+	if (!mapping->Map(ringSize)) {
+		return nullptr;
+	}
+
+	return Com::createInstance<SharedMemoryStream, Io::AsyncReader>(std::move(mapping), side);
+}
+
+
+SharedMemoryStream::SharedMemoryStream(std::unique_ptr<Mapping> mapping, Side side): _mapping(std::move(mapping)), _side(side)
+{
+	Assert(_mapping);
+
+	_waiter = std::jthread{[this](std::stop_token stop) {
+		RunWaiter(std::move(stop));
+	}};
+}
+
+
+SharedMemoryStream::~SharedMemoryStream() {
+	dispose();
+
+	// the stop is seen by the waiter after the doorbell wakes it.
+	_waiter.request_stop();
+	_mapping->Ring(static_cast<size_t>(_side));
+	_waiter.join();
+}
+
+
+void SharedMemoryStream::dispose() {
+	_mapping->GetHeader().closed.store(1, std::memory_order_release);
+
+	// suspended reads and writes of both sides complete.
+	_mapping->Ring(static_cast<size_t>(Side::Server));
+	_mapping->Ring(static_cast<size_t>(Side::Client));
+}
+
+
+bool SharedMemoryStream::IsClosed() const {
+	return _mapping->GetHeader().closed.load(std::memory_order_acquire) != 0;
+}
+
+
+void SharedMemoryStream::RunWaiter(std::stop_token stop) {
+	const size_t side = static_cast<size_t>(_side);
+	const std::atomic<uint32_t>& doorbell = _mapping->GetHeader().doorbells[side];
+
+	while (!stop.stop_requested()) {
+		const uint32_t observed = doorbell.load(std::memory_order_acquire);
+
+		{
+			// coroutine that checked the condition before the ring is in the wait list once the mutex is released.
+			lock_(_waitMutex);
+		}
+
+		_changed.NotifyAll();
+		_mapping->WaitDoorbell(side, observed);
+	}
+}
+
+
+template<typename F>
+Async::Task<bool> SharedMemoryStream::WaitUntil(F condition) {
+	bool isMet = false;
+	bool isSuspended = false;
+
+	{
+		std::unique_lock lock{_waitMutex};
+
+		while (!(isMet = condition()) && !IsClosed()) {
+			co_await _changed.Wait(lock);
+			isSuspended = true;
+			lock = std::unique_lock{_waitMutex};
+		}
+	}
+
+	// resumed by the waiter thread: it must return to the doorbell.
+	if (isSuspended) {
+		co_await RuntimeCore::instance().poolScheduler();
+	}
+
+	co_return isMet;
+}
+
+
+Async::Task<BytesBuffer> SharedMemoryStream::read() {
+	Mapping::Header& header = _mapping->GetHeader();
+	const RingIndex ringIndex = _side == Side::Server ? ClientToServer : ServerToClient;
+	RingHeader& ring = header.rings[ringIndex];
+	const uint8_t* const data = _mapping->GetRingData(ringIndex);
+	const uint64_t mask = header.ringSize - 1;
+
+	const uint64_t readPos = ring.readPos.load(std::memory_order_relaxed);
+
+	const bool hasData = co_await WaitUntil([&] {
+		return ring.writePos.load(std::memory_order_acquire) != readPos;
+	});
+
+	if (!hasData) {
+		co_return BytesBuffer{};
+	}
+
+	const uint64_t available = ring.writePos.load(std::memory_order_acquire) - readPos;
+	const size_t count = static_cast<size_t>(std::min<uint64_t>(available, ReadBlockSize));
+
+	BytesBuffer buffer(count);
+
+	const size_t offset = static_cast<size_t>(readPos & mask);
+	const size_t firstPart = std::min(count, static_cast<size_t>(header.ringSize) - offset);
+	memcpy(buffer.data(), data + offset, firstPart);
+	memcpy(reinterpret_cast<uint8_t*>(buffer.data()) + firstPart, data, count - firstPart);
+
+	ring.readPos.store(readPos + count, std::memory_order_release);
+	// the writer can wait for the space.
+	_mapping->Ring(PeerOf(_side));
+
+	co_return buffer;
+}
+
+
+Async::Task<> SharedMemoryStream::write(ReadOnlyBuffer bytes) {
+	Mapping::Header& header = _mapping->GetHeader();
+	const RingIndex ringIndex = _side == Side::Server ? ServerToClient : ClientToServer;
+	RingHeader& ring = header.rings[ringIndex];
+	uint8_t* const data = _mapping->GetRingData(ringIndex);
+	const uint64_t mask = header.ringSize - 1;
+
+	const auto* source = reinterpret_cast<const uint8_t*>(bytes.data());
+	size_t size = bytes.size();
+
+	while (size > 0) {
+		const uint64_t writePos = ring.writePos.load(std::memory_order_relaxed);
+
+		const bool hasSpace = co_await WaitUntil([&] {
+			return writePos - ring.readPos.load(std::memory_order_acquire) < header.ringSize;
+		});
+
+		if (!hasSpace || IsClosed()) {
+			co_return;
+		}
+
+		const uint64_t space = header.ringSize - (writePos - ring.readPos.load(std::memory_order_acquire));
+		const size_t count = static_cast<size_t>(std::min<uint64_t>(space, size));
+
+		const size_t offset = static_cast<size_t>(writePos & mask);
+		const size_t firstPart = std::min(count, static_cast<size_t>(header.ringSize) - offset);
+		memcpy(data + offset, source, firstPart);
+		memcpy(data, source + firstPart, count - firstPart);
+
+		ring.writePos.store(writePos + count, std::memory_order_release);
+		_mapping->Ring(PeerOf(_side));
+
+		source += count;
+		size -= count;
+	}
+}
+
+} // namespace Runtime
@@ -0,0 +1,85 @@
+//◦ Playrix ◦
+#pragma once
+#include "debug/asyncwaitlist.h"
+
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/com/comclass.h>
+#include <runtime/com/comptr.h>
+#include <runtime/utils/disposable.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Runtime {
+
+/**
+	Bytes stream between two processes on the same machine through the named shared memory region:
+	two single producer / single consumer byte rings (one per direction), positions are exchanged with atomics.
+	Used for the high rate streams (telemetry, traces) that must avoid socket overhead.
+	Side that changes the ring rings the peer's doorbell (futex on Linux, named event on Windows, the syscall is made only when the peer sleeps):
+	the doorbell is waited by the stream's own thread that resumes the suspended reads and writes, no pool thread is held by the idle stream.
+	Platforms without the cross process wake up poll the doorbell with 1ms interval.
+	Dispose marks the channel closed for both sides (as the destruction does).
+*/
+class SharedMemoryStream final : public Io::AsyncReader, public Io::AsyncWriter, public Disposable
+{
+	COMCLASS_(Io::AsyncReader, Io::AsyncWriter, Disposable)
+
+public:
+
+	enum class Side
+	{
+		/* Creates the region (previous region with the same name is replaced). */
+		Server,
+
+		/* Opens the region created by the server. */
+		Client
+	};
+
+	static constexpr size_t DefaultRingSize = 1024 * 1024;
+
+	/**
+		Returns nothing when the region can not be created (or opened).
+	*/
+	static ComPtr<Io::AsyncReader> Create(std::string_view name, Side side, size_t ringSize = DefaultRingSize);
+
+	struct Mapping;
+
+	SharedMemoryStream(std::unique_ptr<Mapping>, Side);
+
+	~SharedMemoryStream();
+
+	void dispose() override;
+
+private:
+
+	static constexpr size_t ReadBlockSize = 64 * 1024;
+
+	Async::Task<BytesBuffer> read() override;
+
+	Async::Task<> write(ReadOnlyBuffer) override;
+
+	bool IsClosed() const;
+
+	/**
+		Returns false when the channel is closed before the condition (shared memory state) is met.
+	*/
+	template<typename F>
+	Async::Task<bool> WaitUntil(F condition);
+
+	void RunWaiter(std::stop_token);
+
+	std::unique_ptr<Mapping> _mapping;
+	const Side _side;
+
+	// serializes the condition check of the suspending coroutine with the resume by the waiter.
+	std::mutex _waitMutex;
+	Debug::AsyncWaitList _changed;
+	std::jthread _waiter;
+};
+
+} // namespace Runtime
@@ -0,0 +1,83 @@
+//◦ Playrix ◦
+#include "stdiostream.h"
+#include <runtime/runtime/runtime.h>
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Runtime {
+
+namespace {
+
+#ifdef _WIN32
+	inline int ReadStdin(void* data, size_t size) {
+		return _read(_fileno(stdin), data, static_cast<unsigned>(size));
+	}
+
+	inline int WriteStdout(const void* data, size_t size) {
+		return _write(_fileno(stdout), data, static_cast<unsigned>(size));
+	}
+#else
+	inline ssize_t ReadStdin(void* data, size_t size) {
+		return ::read(STDIN_FILENO, data, size);
+	}
+
+	inline ssize_t WriteStdout(const void* data, size_t size) {
+		return ::write(STDOUT_FILENO, data, size);
+	}
+#endif
+
+} // namespace
+
+
+StdioStream::StdioStream() {
+#ifdef _WIN32
+	// Content-Length counts bytes: CRLF translation must be disabled.
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+
+Async::Task<BytesBuffer> StdioStream::read() {
+
+	co_await RuntimeCore::instance().poolScheduler();
+
+	BytesBuffer buffer(ReadBlockSize);
+
+	const auto count = ReadStdin(buffer.data(), buffer.size());
+	if (count <= 0) {
+		co_return BytesBuffer{};
+	}
+
+	buffer.resize(static_cast<size_t>(count));
+
+	co_return buffer;
+}
+
+
+Async::Task<> StdioStream::write(ReadOnlyBuffer bytes) {
+
+	co_await RuntimeCore::instance().poolScheduler();
+
+	const auto* data = reinterpret_cast<const char*>(bytes.data());
+	size_t size = bytes.size();
+
+	while (size > 0) {
+		const auto count = WriteStdout(data, size);
+		if (count <= 0) {
+			break;
+		}
+
+		data += count;
+		size -= static_cast<size_t>(count);
+	}
+}
+
+} // namespace Runtime
@@ -0,0 +1,30 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/com/comclass.h>
+
+namespace Runtime {
+
+/**
+	Process stdin/stdout as the bytes stream (i.e. debug adapter is launched by IDE and talks through the stdio pipes).
+	Blocking reads and writes are performed on the pool threads.
+*/
+class StdioStream final : public Io::AsyncReader, public Io::AsyncWriter
+{
+	COMCLASS_(Io::AsyncReader, Io::AsyncWriter)
+
+public:
+
+	StdioStream();
+
+private:
+
+	static constexpr size_t ReadBlockSize = 64 * 1024;
+
+	Async::Task<BytesBuffer> read() override;
+
+	Async::Task<> write(ReadOnlyBuffer) override;
+};
+
+} // namespace Runtime
@@ -0,0 +1,66 @@
+//◦ Playrix ◦
+#include "watchedstream.h"
+
+namespace Runtime {
+
+/* -------------------------------------------------------------------------- */
+WatchedStream::WatchedStream(ComPtr<Io::AsyncReader> stream): _stream(std::move(stream))
+{
+	Assert(_stream);
+	Assert(_stream->as<Io::AsyncWriter*>());
+
+	Touch();
+}
+
+
+std::chrono::steady_clock::time_point WatchedStream::GetLastActivity() const {
+	return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{_lastActivity.load(std::memory_order_relaxed)}};
+}
+
+
+bool WatchedStream::IsDisposed() const {
+	return _isDisposed.load(std::memory_order_acquire);
+}
+
+
+void WatchedStream::dispose() {
+	if (_isDisposed.exchange(true)) {
+		return;
+	}
+
+	if (auto* const disposable = _stream->as<Disposable*>()) {
+		disposable->dispose();
+	}
+}
+
+
+Async::Task<BytesBuffer> WatchedStream::read() {
+	if (IsDisposed()) {
+		co_return BytesBuffer{};
+	}
+
+	BytesBuffer bytes = co_await _stream->read();
+	if (!bytes || IsDisposed()) {
+		co_return BytesBuffer{};
+	}
+
+	Touch();
+
+	co_return bytes;
+}
+
+
+Async::Task<> WatchedStream::write(ReadOnlyBuffer bytes) {
+	if (IsDisposed()) {
+		return Async::Task<>::makeResolved();
+	}
+
+	return _stream->as<Io::AsyncWriter&>().write(bytes);
+}
+
+
+void WatchedStream::Touch() {
+	_lastActivity.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+} // namespace Runtime
@@ -0,0 +1,45 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/io/asyncwriter.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/com/comclass.h>
+#include <runtime/com/comptr.h>
+#include <runtime/utils/disposable.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace Runtime {
+
+/**
+	Connection wrapper that tracks the time of the last inbound data (the watchdog closes the idle connections).
+	Dispose closes the wrapped stream (when it is disposable): pending read completes with the empty buffer.
+*/
+class WatchedStream final : public Io::AsyncReader, public Io::AsyncWriter, public Disposable
+{
+	COMCLASS_(Io::AsyncReader, Io::AsyncWriter, Disposable)
+
+public:
+
+	explicit WatchedStream(ComPtr<Io::AsyncReader> stream);
+
+	std::chrono::steady_clock::time_point GetLastActivity() const;
+
+	bool IsDisposed() const;
+
+	void dispose() override;
+
+private:
+
+	Async::Task<BytesBuffer> read() override;
+
+	Async::Task<> write(ReadOnlyBuffer) override;
+
+	void Touch();
+
+	const ComPtr<Io::AsyncReader> _stream;
+	std::atomic<std::chrono::steady_clock::rep> _lastActivity;
+	std::atomic<bool> _isDisposed = false;
+};
+
+} // namespace Runtime
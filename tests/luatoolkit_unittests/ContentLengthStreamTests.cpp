@@ -0,0 +1,120 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "remoting/contentlengthstream.h"
+#include "remoting/httpstream.h"
+
+using namespace Runtime;
+
+namespace {
+
+void Append(ContentLengthStream& stream, std::string_view bytes) {
+	BytesBuffer buffer(bytes.size());
+	memcpy(buffer.data(), bytes.data(), bytes.size());
+	stream.AppendBytes(buffer.toReadOnly());
+}
+
+
+std::string MakePacket(std::string_view body) {
+	return "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + std::string{body};
+}
+
+} // namespace
+
+
+TEST(ContentLengthStream, PipelinedPackets) {
+	ContentLengthStream stream;
+	Append(stream, MakePacket(R"({"seq":1})") + MakePacket(R"({"seq":2})"));
+
+	ASSERT_EQ(stream.GetNextPacket(), R"({"seq":1})");
+	ASSERT_EQ(stream.GetNextPacket(), R"({"seq":2})");
+	ASSERT_FALSE(stream.GetNextPacket());
+	ASSERT_FALSE(stream.IsInvalid());
+}
+
+
+TEST(ContentLengthStream, PacketSplitAtEveryByte) {
+	const std::string packets = MakePacket(R"({"seq":1})") + MakePacket(R"({"seq":2})");
+
+	ContentLengthStream stream;
+	std::vector<std::string> bodies;
+
+	for (const char c : packets) {
+		Append(stream, {&c, 1});
+		while (const std::optional<std::string_view> body = stream.GetNextPacket()) {
+			bodies.emplace_back(*body);
+		}
+	}
+
+	ASSERT_EQ(bodies, (std::vector<std::string>{R"({"seq":1})", R"({"seq":2})"}));
+	ASSERT_FALSE(stream.IsInvalid());
+}
+
+
+TEST(ContentLengthStream, HeadersCaseAndExtraHeaders) {
+	ContentLengthStream stream;
+	Append(stream, "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\ncontent-length:  2 \r\n\r\n{}");
+
+	ASSERT_EQ(stream.GetNextPacket(), "{}");
+	ASSERT_FALSE(stream.IsInvalid());
+}
+
+
+TEST(ContentLengthStream, MissingContentLengthIsInvalid) {
+	ContentLengthStream stream;
+	Append(stream, "Content-Type: application/json\r\n\r\n{}");
+
+	ASSERT_FALSE(stream.GetNextPacket());
+	ASSERT_TRUE(stream.IsInvalid());
+}
+
+
+TEST(ContentLengthStream, GarbledContentLengthIsInvalid) {
+	for (const std::string_view headers : {"Content-Length: abc\r\n\r\n", "Content-Length: 12x\r\n\r\n", "Content-Length: -1\r\n\r\n", "Content-Length:\r\n\r\n"}) {
+		ContentLengthStream stream;
+		Append(stream, headers);
+
+		ASSERT_FALSE(stream.GetNextPacket()) << headers;
+		ASSERT_TRUE(stream.IsInvalid()) << headers;
+	}
+}
+
+
+TEST(ContentLengthStream, InvalidStreamYieldsNoMorePackets) {
+	ContentLengthStream stream;
+	Append(stream, "Content-Length: x\r\n\r\n");
+	ASSERT_FALSE(stream.GetNextPacket());
+
+	Append(stream, MakePacket("{}"));
+	ASSERT_FALSE(stream.GetNextPacket());
+	ASSERT_TRUE(stream.IsInvalid());
+}
+
+
+TEST(ContentLengthStream, EndlessHeadersAreInvalid) {
+	ContentLengthStream stream;
+
+	const std::string garbage(16 * 1024, 'x');
+	for (int i = 0; i < 8 && !stream.IsInvalid(); ++i) {
+		Append(stream, garbage);
+		ASSERT_FALSE(stream.GetNextPacket());
+	}
+
+	ASSERT_TRUE(stream.IsInvalid());
+}
+
+
+TEST(HttpStream, RequestWithoutBody) {
+	HttpStream stream;
+
+	const std::string_view request {"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n"};
+	BytesBuffer buffer(request.size());
+	memcpy(buffer.data(), request.data(), request.size());
+	stream.AppendBytes(buffer.toReadOnly());
+
+	const HttpStream::Packet packet = stream.GetNextPacket();
+	ASSERT_TRUE(packet);
+	ASSERT_EQ(packet.method, "GET");
+	ASSERT_EQ(packet.path, "/metrics");
+	ASSERT_TRUE(packet.body.empty());
+	ASSERT_FALSE(stream.IsInvalid());
+}
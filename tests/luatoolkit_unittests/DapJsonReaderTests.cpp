@@ -0,0 +1,93 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "lua-toolkit/debug/adapterprotocol.h"
+#include "lua-toolkit/debug/dapjsonreader.h"
+
+using namespace Runtime;
+
+namespace {
+
+std::string ReadString(std::string_view json) {
+	std::string value;
+	Dap::JsonReader{json}.Read(value);
+
+	return value;
+}
+
+} // namespace
+
+
+TEST(DapJsonReader, InboundMessageEnvelope) {
+	const Dap::InboundMessage message = Dap::InboundMessage::Parse(R"({ "seq" : 7, "type": "request", "unknown": [1, {"a": null}], "command": "next", "arguments": {"threadId": 1} })");
+
+	ASSERT_EQ(message.seq, 7u);
+	ASSERT_EQ(message.type, "request");
+	ASSERT_EQ(message.command, "next");
+	ASSERT_EQ(message.arguments, R"({"threadId": 1})");
+}
+
+
+TEST(DapJsonReader, Arguments) {
+	const Dap::InboundMessage message = Dap::InboundMessage::Parse(R"({"seq":1,"type":"request","command":"setBreakpoints","arguments":{"source":{"path":"scripts/main.lua"},"breakpoints":[{"line":10},{"line":20,"condition":"i > 1"}]}})");
+	const auto args = message.GetArguments<Dap::SetBreakpointsArguments>();
+
+	ASSERT_EQ(args.source.path, "scripts/main.lua");
+	ASSERT_EQ(args.breakpoints.size(), 2u);
+	ASSERT_EQ(args.breakpoints[0].line, 10u);
+	ASSERT_EQ(args.breakpoints[1].line, 20u);
+	ASSERT_EQ(args.breakpoints[1].condition, "i > 1");
+	ASSERT_FALSE(args.sourceModified);
+}
+
+
+TEST(DapJsonReader, NullArgumentsAreEmpty) {
+	const Dap::InboundMessage message = Dap::InboundMessage::Parse(R"({"seq":2,"type":"request","command":"threads","arguments":null})");
+
+	ASSERT_TRUE(message.arguments.empty());
+	ASSERT_EQ(message.GetArguments<Dap::VariablesArguments>().variablesReference, 0u);
+	ASSERT_FALSE(message.GetArgumentsValue());
+}
+
+
+TEST(DapJsonReader, StringEscapes) {
+	ASSERT_EQ(ReadString(R"("a\"b\\c\/d\n\t")"), "a\"b\\c/d\n\t");
+	ASSERT_EQ(ReadString(R"("\u0041\u00e9\u20ac")"), "A\xC3\xA9\xE2\x82\xAC");
+
+	// surrogate pair.
+	ASSERT_EQ(ReadString(R"("\ud83d\ude00")"), "\xF0\x9F\x98\x80");
+}
+
+
+TEST(DapJsonReader, EscapedKey) {
+	const Dap::InboundMessage message = Dap::InboundMessage::Parse(R"({"s\u0065q":3,"comm\u0061nd":"pause"})");
+
+	ASSERT_EQ(message.seq, 3u);
+	ASSERT_EQ(message.command, "pause");
+}
+
+
+TEST(DapJsonReader, SkippedStringWithEscapedQuote) {
+	const Dap::InboundMessage message = Dap::InboundMessage::Parse(R"({"ignored":"a\"}","command":"pause"})");
+
+	ASSERT_EQ(message.command, "pause");
+}
+
+
+TEST(DapJsonReader, MalformedInputThrows) {
+	ASSERT_THROW(Dap::InboundMessage::Parse(""), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse("{"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({"seq":1,"command":"next")"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({"seq":1 "command":"next"})"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({seq:1})"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({"seq":"1"})"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({"command":"next)"), std::runtime_error);
+	ASSERT_THROW(Dap::InboundMessage::Parse(R"({"arguments":{"a":[1,2}})"), std::runtime_error);
+}
+
+
+TEST(DapJsonReader, MalformedEscapesThrow) {
+	ASSERT_THROW(ReadString(R"("\u00g1")"), std::runtime_error);
+	ASSERT_THROW(ReadString(R"("\u00)"), std::runtime_error);
+	ASSERT_THROW(ReadString(R"("\ud83d\u0041")"), std::runtime_error);
+	ASSERT_THROW(ReadString(R"("abc\)"), std::runtime_error);
+}
@@ -0,0 +1,48 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "lua-toolkit/debug/dapjsonwriter.h"
+
+using namespace Runtime;
+
+namespace {
+
+template<typename T>
+std::string WriteJson(const T& value) {
+	BytesBuffer buffer;
+	Dap::JsonWriter writer{buffer};
+	writer.Write(value);
+
+	return std::string{asStringView(buffer)};
+}
+
+} // namespace
+
+
+TEST(DapJsonWriter, NonFiniteNumberIsNull) {
+	ASSERT_EQ(WriteJson(std::nan("")), "null");
+	ASSERT_EQ(WriteJson(std::numeric_limits<double>::infinity()), "null");
+	ASSERT_EQ(WriteJson(-std::numeric_limits<double>::infinity()), "null");
+	ASSERT_EQ(WriteJson(1.5), "1.5");
+}
+
+
+TEST(DapJsonWriter, StringEscapes) {
+	ASSERT_EQ(WriteJson(std::string_view{"a\"b\\c\n\t"}), R"("a\"b\\c\n\t")");
+	ASSERT_EQ(WriteJson(std::string_view{"\x01", 1}), R"("\u0001")");
+}
+
+
+TEST(DapJsonWriter, WellFormedUtf8IsKept) {
+	// 2, 3 and 4 bytes sequences.
+	const std::string_view text {"\xD0\xBF\xE2\x82\xAC\xF0\x9F\x98\x80"};
+	ASSERT_EQ(WriteJson(text), "\"" + std::string{text} + "\"");
+}
+
+
+TEST(DapJsonWriter, IllFormedUtf8IsReplaced) {
+	// stray continuation byte, truncated sequence, overlong form, surrogate.
+	ASSERT_EQ(WriteJson(std::string_view{"a\x80" "b"}), R"("a\ufffdb")");
+	ASSERT_EQ(WriteJson(std::string_view{"a\xE2\x82"}), R"("a\ufffd\ufffd")");
+	ASSERT_EQ(WriteJson(std::string_view{"\xC0\xAF"}), R"("\ufffd\ufffd")");
+	ASSERT_EQ(WriteJson(std::string_view{"\xED\xA0\x80"}), R"("\ufffd\ufffd\ufffd")");
+}
@@ -0,0 +1,43 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "helpers/DapReplay.h"
+#include "helpers/GameStubs.h"
+#include "lua-toolkit/debug/adapterprotocol.h"
+#include "lua-toolkit/debug/dapjsonreader.h"
+
+#include <algorithm>
+
+using namespace Runtime;
+using namespace Lua::Tests;
+
+
+TEST(DapSession, InitializeHandshake) {
+	StubGame game;
+	DapTestSession session{game.GetController()};
+	DapReplayClient& client = session.GetClient();
+
+	const DapReplayClient::Message response = client.Request("initialize", R"({"adapterID":"lua","linesStartAt1":true})");
+	ASSERT_TRUE(response.success) << response.errorMessage;
+
+	Dap::Capabilities capabilities;
+	Dap::JsonReader{response.body}.Read(capabilities);
+
+	ASSERT_TRUE(capabilities.supportsConfigurationDoneRequest);
+	ASSERT_TRUE(capabilities.supportsEvaluateForHovers);
+	ASSERT_TRUE(capabilities.supportsExceptionInfoRequest);
+
+	const auto uncaught = std::find_if(capabilities.exceptionBreakpointFilters.begin(), capabilities.exceptionBreakpointFilters.end(), [](const Dap::ExceptionBreakpointsFilter& filter) {
+		return filter.filter == "uncaught";
+	});
+	ASSERT_NE(uncaught, capabilities.exceptionBreakpointFilters.end());
+
+	// the configuration is sent by the IDE after the 'initialized' event.
+	client.WaitEvent("initialized");
+
+	ASSERT_TRUE(client.Request("attach").success);
+	ASSERT_TRUE(client.Request("setBreakpoints", R"({"source":{"path":"@scripts/game/stubgame.lua"},"breakpoints":[]})").success);
+	ASSERT_TRUE(client.Request("setExceptionBreakpoints", R"({"filters":["uncaught"]})").success);
+	ASSERT_TRUE(client.Request("configurationDone").success);
+
+	session.End();
+}
@@ -0,0 +1,93 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "debug/inplaceexecutionscheduler.h"
+#include <runtime/async/task.h>
+
+using namespace Runtime;
+
+namespace {
+
+void Dispose(const ComPtr<Async::InplaceExecutionScheduler>& scheduler) {
+	scheduler->as<Disposable*>()->dispose();
+}
+
+} // namespace
+
+
+TEST(InplaceExecutionScheduler, RingOverflowKeepsOrder) {
+	// scheduled before the execution: most of the invocations go to the overflow.
+	constexpr int InvocationsCount = 2000;
+
+	auto scheduler = Com::createInstance<Async::InplaceExecutionScheduler>();
+	std::vector<int> executed;
+
+	for (int i = 0; i < InvocationsCount; ++i) {
+		Async::run([&executed, i] {
+			executed.push_back(i);
+		}, scheduler).detach();
+	}
+
+	Dispose(scheduler);
+	scheduler->Execute();
+
+	std::vector<int> expected(InvocationsCount);
+	std::iota(expected.begin(), expected.end(), 0);
+
+	ASSERT_EQ(executed, expected);
+}
+
+
+TEST(InplaceExecutionScheduler, ConcurrentProducersOrder) {
+	constexpr int ProducersCount = 4;
+	constexpr int InvocationsPerProducer = 20'000;
+
+	auto scheduler = Com::createInstance<Async::InplaceExecutionScheduler>();
+
+	// accessed only by the executing thread.
+	std::vector<int> lastExecuted(ProducersCount, -1);
+	int outOfOrderCount = 0;
+	int executedCount = 0;
+
+	std::vector<std::thread> producers;
+	for (int producer = 0; producer < ProducersCount; ++producer) {
+		producers.emplace_back([&, producer] {
+			for (int i = 0; i < InvocationsPerProducer; ++i) {
+				Async::run([&, producer, i] {
+					if (lastExecuted[producer] + 1 != i) {
+						++outOfOrderCount;
+					}
+					lastExecuted[producer] = i;
+
+					if (++executedCount == ProducersCount * InvocationsPerProducer) {
+						Dispose(scheduler);
+					}
+				}, scheduler).detach();
+			}
+		});
+	}
+
+	scheduler->Execute();
+
+	for (std::thread& producer : producers) {
+		producer.join();
+	}
+
+	ASSERT_EQ(executedCount, ProducersCount * InvocationsPerProducer);
+	ASSERT_EQ(outOfOrderCount, 0);
+}
+
+
+TEST(InplaceExecutionScheduler, ExecutePendingAfterDispose) {
+	auto scheduler = Com::createInstance<Async::InplaceExecutionScheduler>();
+	int executedCount = 0;
+
+	Async::run([&executedCount] {
+		++executedCount;
+	}, scheduler).detach();
+
+	ASSERT_TRUE(scheduler->ExecutePending());
+	ASSERT_EQ(executedCount, 1);
+
+	Dispose(scheduler);
+	ASSERT_FALSE(scheduler->ExecutePending());
+}
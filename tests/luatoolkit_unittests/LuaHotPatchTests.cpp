@@ -0,0 +1,296 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "debug/luahotpatch.h"
+#include "helpers/DapReplay.h"
+#include "helpers/GameStubs.h"
+#include "lua-toolkit/debug/dapcommandhandler.h"
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+#if __has_include(<luajit.h>)
+#include <luajit.h>
+#endif
+}
+
+using namespace Runtime;
+using namespace Lua::Debug;
+using namespace Lua::Tests;
+
+namespace {
+
+class LuaHotPatch : public testing::Test
+{
+protected:
+
+	void SetUp() override {
+		_lua = luaL_newstate();
+		ASSERT_TRUE(_lua);
+		luaL_openlibs(_lua);
+	}
+
+	void TearDown() override {
+		lua_close(_lua);
+	}
+
+	void Run(std::string_view script) {
+		ASSERT_EQ(luaL_loadbuffer(_lua, script.data(), script.size(), "@scripts/base.lua"), 0) << lua_tostring(_lua, -1);
+		ASSERT_EQ(lua_pcall(_lua, 0, 0, 0), 0) << lua_tostring(_lua, -1);
+	}
+
+	std::string Evaluate(std::string_view expression) {
+		const std::string script = "return tostring((" + std::string{expression} + "))";
+		if (luaL_loadbuffer(_lua, script.data(), script.size(), "=evaluate") != 0 || lua_pcall(_lua, 0, 1, 0) != 0) {
+			std::string error = lua_tostring(_lua, -1);
+			lua_pop(_lua, 1);
+			return error;
+		}
+
+		std::string result = lua_tostring(_lua, -1);
+		lua_pop(_lua, 1);
+
+		return result;
+	}
+
+	HotPatchResponseBody Patch(std::string_view content, const std::string& module = {}) {
+		return PatchFunctions(_lua, CompileChunk(content, "@scripts/base.lua"), module);
+	}
+
+	lua_State* _lua = nullptr;
+};
+
+} // namespace
+
+
+TEST(LineRemapper, InsertedLinesShiftSuffix) {
+	const LineRemapper remapper{"a\nb\nc\n", "a\nnew1\nnew2\nb\nc\n"};
+
+	ASSERT_EQ(remapper.Map(1), 1u);
+	ASSERT_EQ(remapper.Map(2), 4u);
+	ASSERT_EQ(remapper.Map(3), 5u);
+}
+
+
+TEST(LineRemapper, EditedLineIsNotMapped) {
+	// the number of lines is unchanged.
+	const LineRemapper remapper{"a\nb\nc\n", "a\nB\nc\n"};
+
+	ASSERT_EQ(remapper.Map(1), 1u);
+	ASSERT_FALSE(remapper.Map(2));
+	ASSERT_EQ(remapper.Map(3), 3u);
+}
+
+
+TEST(LineRemapper, UnchangedLineInsideChangedBlock) {
+	const LineRemapper remapper{"a\nb\nc\nd\n", "a\nB\nc\nD\n"};
+
+	ASSERT_EQ(remapper.Map(1), 1u);
+	ASSERT_FALSE(remapper.Map(2));
+	ASSERT_EQ(remapper.Map(3), 3u);
+	ASSERT_FALSE(remapper.Map(4));
+}
+
+
+TEST(LineRemapper, MovedLineIsMappedToNearestEqualLine) {
+	const LineRemapper remapper{"x\nfoo()\ny\n", "x\nz\nfoo()\nw\n"};
+
+	ASSERT_EQ(remapper.Map(2), 3u);
+	ASSERT_FALSE(remapper.Map(3));
+}
+
+
+TEST(LineRemapper, RemovedAndOutOfRangeLines) {
+	const LineRemapper remapper{"a\nb\n\nc\n", "a\nc\n"};
+
+	ASSERT_EQ(remapper.Map(1), 1u);
+	ASSERT_FALSE(remapper.Map(2));
+	ASSERT_FALSE(remapper.Map(3));
+	ASSERT_EQ(remapper.Map(4), 2u);
+	ASSERT_FALSE(remapper.Map(0));
+	ASSERT_FALSE(remapper.Map(5));
+}
+
+
+TEST(LineRemapper, LineEndingsAreIgnored) {
+	const LineRemapper remapper{"a\r\nb\r\n", "a\nb\n"};
+
+	ASSERT_EQ(remapper.Map(1), 1u);
+	ASSERT_EQ(remapper.Map(2), 2u);
+}
+
+
+TEST_F(LuaHotPatch, GlobalFunctionKeepsUpvalueState) {
+	Run(R"(
+		local counter = 0
+		function increment() counter = counter + 1 return counter end
+	)");
+	Evaluate("increment()");
+	ASSERT_EQ(Evaluate("increment()"), "2");
+
+	const HotPatchResponseBody body = Patch(R"(
+		local counter = 0
+		function increment() counter = counter + 10 return counter end
+	)");
+
+	ASSERT_EQ(body.replacedFunctions, std::vector<std::string>{"increment"});
+	ASSERT_TRUE(body.addedFunctions.empty());
+	ASSERT_EQ(Evaluate("increment()"), "12");
+}
+
+
+TEST_F(LuaHotPatch, AddedFunctionGetsUpvaluesOfReplacedOnes) {
+	Run(R"(
+		local prefix = "a"
+		function get() return prefix end
+		function set(value) prefix = value end
+	)");
+	Evaluate("set('b')");
+
+	const HotPatchResponseBody body = Patch(R"(
+		local prefix = "x"
+		function get() return prefix end
+		function getTwice() return prefix .. prefix end
+	)");
+
+	ASSERT_EQ(body.replacedFunctions, std::vector<std::string>{"get"});
+	ASSERT_EQ(body.addedFunctions, std::vector<std::string>{"getTwice"});
+	ASSERT_EQ(Evaluate("get()"), "b");
+	ASSERT_EQ(Evaluate("getTwice()"), "bb");
+}
+
+
+TEST_F(LuaHotPatch, ModuleFunctionsAreReplacedInLoadedTable) {
+	Run(R"(
+		package.loaded.scaler = (function()
+			local M = {}
+			local scale = 2
+			function M.apply(x) return x * scale end
+			function M.setScale(value) scale = value end
+			return M
+		end)()
+
+		function apply() return "global" end
+	)");
+	Evaluate("package.loaded.scaler.setScale(3)");
+
+	const HotPatchResponseBody body = Patch(R"(
+		local M = {}
+		local scale = 1
+		function M.apply(x) return x * scale + 1 end
+		return M
+	)", "scaler");
+
+	ASSERT_EQ(body.replacedFunctions, std::vector<std::string>{"apply"});
+	ASSERT_EQ(Evaluate("package.loaded.scaler.apply(5)"), "16");
+	// functions are replaced in the loaded module table, other module functions and globals are kept.
+	ASSERT_EQ(Evaluate("type(package.loaded.scaler.setScale)"), "function");
+	ASSERT_EQ(Evaluate("apply()"), "global");
+}
+
+
+TEST_F(LuaHotPatch, NestedTableMethodsAreReplaced) {
+	Run(R"(
+		package.loaded.shapes = (function()
+			local M = {}
+			local sides = 4
+			M.Square = {}
+			M.Square.__index = M.Square
+			function M.Square.new() return setmetatable({}, M.Square) end
+			function M.Square:sides() return sides end
+			function M.setSides(value) sides = value end
+			return M
+		end)()
+
+		square = package.loaded.shapes.Square.new()
+	)");
+	Evaluate("package.loaded.shapes.setSides(5)");
+
+	const HotPatchResponseBody body = Patch(R"(
+		local M = {}
+		local sides = 4
+		M.Square = {}
+		M.Square.__index = M.Square
+		function M.Square:sides() return sides * 10 end
+		return M
+	)", "shapes");
+
+	ASSERT_EQ(body.replacedFunctions, std::vector<std::string>{"Square.sides"});
+	// existing instances get the new method through the running class table.
+	ASSERT_EQ(Evaluate("square:sides()"), "50");
+}
+
+
+#ifdef LUAJIT_VERSION
+TEST_F(LuaHotPatch, UpvaluesAreJoinedWithOldClosures) {
+	Run(R"(
+		local counter = 0
+		function increment() counter = counter + 1 return counter end
+		function get() return counter end
+	)");
+
+	Patch(R"(
+		local counter = 0
+		function increment() counter = counter + 10 return counter end
+	)");
+
+	Evaluate("increment()");
+	// the old 'get' sees the assignment of the new 'increment'.
+	ASSERT_EQ(Evaluate("get()"), "10");
+}
+#endif
+
+
+TEST_F(LuaHotPatch, GlobalAssignmentsStayInSandbox) {
+	Run(R"(
+		value = 1
+		function get() return value end
+	)");
+
+	Patch(R"(
+		value = 2
+		function get() return value + 1 end
+	)");
+
+	ASSERT_EQ(Evaluate("value"), "1");
+	ASSERT_EQ(Evaluate("get()"), "2");
+}
+
+
+TEST_F(LuaHotPatch, Errors) {
+	ASSERT_THROW(CompileChunk("function broken(", "@scripts/base.lua"), Runtime::Debug::DapRequestError);
+	ASSERT_THROW(Patch("return {}", "missing"), Runtime::Debug::DapRequestError);
+	ASSERT_THROW(Patch("local M = {}", "string"), Runtime::Debug::DapRequestError);
+	ASSERT_THROW(Patch("error('failed')"), Runtime::Debug::DapRequestError);
+}
+
+
+TEST(LuaHotPatchCommand, PatchOfRunningExecution) {
+	StubGame game;
+	DapTestSession session{game.GetController()};
+	DapReplayClient& client = session.GetClient();
+
+	ASSERT_TRUE(client.Request("initialize", R"({"adapterID":"lua"})").success);
+	ASSERT_TRUE(client.Request("attach").success);
+	ASSERT_TRUE(client.Request("configurationDone").success);
+
+	// the patch is queued by the request and applied by the hook of the running game frame.
+	const std::string_view arguments = R"({"source":{"path":"@scripts/game/stubgame.lua"},"content":"function updateEntity(entity, dt) return 0 end"})";
+
+	// debugging is enabled by the next game frame after the configuration.
+	DapReplayClient::Message response = client.Request("hotPatch", arguments);
+	for (int attempt = 0; !response.success && response.errorMessage == "Debugging is not enabled" && attempt < 100; ++attempt) {
+		std::this_thread::sleep_for(std::chrono::milliseconds{10});
+		response = client.Request("hotPatch", arguments);
+	}
+
+	ASSERT_TRUE(response.success) << response.errorMessage;
+
+	HotPatchResponseBody body;
+	Dap::JsonReader{response.body}.Read(body);
+	ASSERT_EQ(body.replacedFunctions, std::vector<std::string>{"updateEntity"});
+
+	// the session is not held by the applied patch.
+	ASSERT_TRUE(client.Request("threads").success);
+
+	session.End();
+}
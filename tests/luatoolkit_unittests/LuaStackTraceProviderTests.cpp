@@ -0,0 +1,204 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "debug/luastacktraceprovider.h"
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include <algorithm>
+
+using namespace Runtime;
+using namespace Lua::Debug;
+
+namespace {
+
+constexpr const char* FixtureKey = "__lua_TestsInspection";
+
+
+/**
+	Runs the script with the line hook that inspects the frame on the given line, as the debugger stop does.
+*/
+class LuaInspection : public testing::Test
+{
+protected:
+
+	void SetUp() override {
+		_lua = luaL_newstate();
+		ASSERT_TRUE(_lua);
+		luaL_openlibs(_lua);
+	}
+
+	void TearDown() override {
+		lua_close(_lua);
+	}
+
+	/**
+		Returns evaluation results (or the errors prefixed with 'error: ') of the first pass of the given line.
+	*/
+	std::vector<std::string> EvaluateOnLine(std::string_view script, int line, std::vector<std::string> expressions) {
+		std::vector<std::string> results;
+
+		InspectOnLine(script, line, [&results, &expressions](LuaStackTraceProvider& provider) {
+			for (const std::string& expression : expressions) {
+				Dap::EvaluateArguments args;
+				args.expression = expression;
+
+				try {
+					results.push_back(provider.Evaluate(args).result);
+				}
+				catch (const std::exception& exception) {
+					results.push_back(std::string{"error: "} + exception.what());
+				}
+			}
+		});
+
+		return results;
+	}
+
+	/**
+		Calls inspect with the provider of the frame on the first pass of the given line.
+	*/
+	void InspectOnLine(std::string_view script, int line, std::function<void (LuaStackTraceProvider&)> inspect) {
+		_line = line;
+		_inspect = std::move(inspect);
+
+		lua_pushlightuserdata(_lua, this);
+		lua_setfield(_lua, LUA_REGISTRYINDEX, FixtureKey);
+		lua_sethook(_lua, &LuaInspection::OnLine, LUA_MASKLINE, 0);
+
+		EXPECT_EQ(luaL_loadbuffer(_lua, script.data(), script.size(), "@scripts/inspected.lua"), 0);
+		EXPECT_EQ(lua_pcall(_lua, 0, 0, 0), 0) << lua_tostring(_lua, -1);
+
+		lua_sethook(_lua, nullptr, 0, 0);
+	}
+
+	static void OnLine(lua_State* l, lua_Debug* ar) {
+		lua_getfield(l, LUA_REGISTRYINDEX, FixtureKey);
+		auto* const self = static_cast<LuaInspection*>(lua_touserdata(l, -1));
+		lua_pop(l, 1);
+
+		if (ar->currentline != self->_line || self->_isInspected) {
+			return;
+		}
+
+		self->_isInspected = true;
+
+		auto provider = Com::createInstance<LuaStackTraceProvider>(l, ar);
+		self->_inspect(*provider);
+
+		self->_hookAfterEvaluation = lua_gethook(l);
+		provider->ReleaseValues();
+	}
+
+	lua_State* _lua = nullptr;
+	int _line = 0;
+	bool _isInspected = false;
+	std::function<void (LuaStackTraceProvider&)> _inspect;
+	lua_Hook _hookAfterEvaluation = nullptr;
+};
+
+} // namespace
+
+
+TEST_F(LuaInspection, NilLocalShadowsGlobal) {
+	const std::vector<std::string> results = EvaluateOnLine(R"(
+		value = "global"
+		local function inspected()
+			local value = nil
+			local other = "local"
+			return other
+		end
+		inspected()
+	)", 6, {"value", "other", "type(value)"});
+
+	ASSERT_EQ(results, (std::vector<std::string>{"nil", "local", "nil"}));
+}
+
+
+TEST_F(LuaInspection, EvaluationBudgetKeepsDebuggerHook) {
+	const std::vector<std::string> results = EvaluateOnLine(R"(
+		local function inspected()
+			local value = "local"
+			return value
+		end
+		inspected()
+	)", 4, {"(function() while true do end end)()", "value"});
+
+	ASSERT_EQ(results.size(), 2u);
+	ASSERT_NE(results[0].find("Evaluation instructions budget exceeded"), std::string::npos) << results[0];
+	ASSERT_EQ(results[1], "local");
+
+	// the budget hook is set only for the evaluation.
+	ASSERT_EQ(_hookAfterEvaluation, &LuaInspection::OnLine);
+}
+
+
+TEST_F(LuaInspection, UnfilteredPagesOfLazyTable) {
+	std::vector<std::string> names;
+
+	InspectOnLine(R"(
+		local function inspected()
+			local mixed = {}
+			for i = 1, 300 do
+				mixed[i] = i
+				mixed["key" .. i] = i
+			end
+			return mixed
+		end
+		inspected()
+	)", 8, [&names](LuaStackTraceProvider& provider) {
+		Dap::EvaluateArguments evaluateArgs;
+		evaluateArgs.expression = "mixed";
+		const unsigned reference = provider.Evaluate(evaluateArgs).variablesReference;
+		ASSERT_NE(reference, 0u);
+
+		// pages are requested while the lazy enumeration still adds both indexed and named children.
+		for (unsigned start = 0;; start += 50) {
+			Dap::VariablesArguments args;
+			args.variablesReference = reference;
+			args.start = start;
+			args.count = 50;
+
+			const std::vector<Dap::Variable> page = provider.GetVariables(args);
+			if (page.empty()) {
+				break;
+			}
+
+			for (const Dap::Variable& variable : page) {
+				names.push_back(variable.name);
+			}
+		}
+	});
+
+	ASSERT_EQ(names.size(), 600u);
+	std::sort(names.begin(), names.end());
+	ASSERT_EQ(std::adjacent_find(names.begin(), names.end()), names.end());
+}
+
+
+TEST_F(LuaInspection, VariablesPageIsCappedWithoutCount) {
+	size_t pageSize = 0;
+
+	InspectOnLine(R"(
+		local function inspected()
+			local array = {}
+			for i = 1, 5000 do
+				array[i] = i
+			end
+			return array
+		end
+		inspected()
+	)", 7, [&pageSize](LuaStackTraceProvider& provider) {
+		Dap::EvaluateArguments evaluateArgs;
+		evaluateArgs.expression = "array";
+
+		Dap::VariablesArguments args;
+		args.variablesReference = provider.Evaluate(evaluateArgs).variablesReference;
+		pageSize = provider.GetVariables(args).size();
+	});
+
+	ASSERT_GT(pageSize, 0u);
+	ASSERT_LT(pageSize, 5000u);
+}
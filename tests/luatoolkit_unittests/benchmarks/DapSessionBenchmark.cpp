@@ -0,0 +1,102 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "helpers/DapReplay.h"
+#include "helpers/GameStubs.h"
+
+#include <lua-toolkit/debug/debugsession.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace Runtime;
+using namespace Runtime::Debug;
+using namespace Lua::Tests;
+
+namespace {
+
+/**
+	Typical inspection session: stop on the function breakpoint, then the IDE refreshes the stack, scopes and locals after every step.
+*/
+std::vector<DapReplayStep> MakeInspectionSession(unsigned stepsCount) {
+	std::vector<DapReplayStep> steps;
+
+	steps.push_back({"initialize", R"({"adapterID":"lua"})"});
+	steps.push_back({"attach"});
+	steps.push_back({"setFunctionBreakpoints", R"({"breakpoints":[{"name":")" + std::string{StubGame::EntityUpdateFunction} + R"("}]})"});
+	steps.push_back({"configurationDone", "{}", "stopped"});
+
+	for (unsigned i = 0; i < stepsCount; ++i) {
+		steps.push_back({"threads"});
+		steps.push_back({"stackTrace", R"({"threadId":1})"});
+		steps.push_back({"scopes", R"({"frameId":$frameId})"});
+		steps.push_back({"variables", R"({"variablesReference":$variablesReference})"});
+		steps.push_back({"evaluate", R"({"expression":"entity.position.x","frameId":$frameId,"context":"watch"})"});
+		steps.push_back({i % 4 == 3 ? "continue" : "next", "{}", "stopped"});
+	}
+
+	steps.push_back({"setFunctionBreakpoints", R"({"breakpoints":[]})"});
+	steps.push_back({"continue"});
+	steps.push_back({"disconnect"});
+
+	return steps;
+}
+
+
+DapReplayReport ReplaySession(const std::vector<DapReplayStep>& steps, std::optional<StopSnapshotOptions> snapshotOptions = std::nullopt) {
+	StubGame game;
+
+	DapTestSession session{game.GetController(), snapshotOptions};
+	DapReplayReport report = session.GetClient().Run(steps);
+
+	// session ends on the closed connection (disconnecting the controller): the game is stopped only after that.
+	session.End();
+
+	game.Stop();
+
+	const std::vector<std::chrono::nanoseconds> frameTimes = game.GetFrameTimes();
+	if (!frameTimes.empty()) {
+		const auto maxFrameTime = *std::max_element(frameTimes.begin(), frameTimes.end());
+		std::cout << "game frames: " << frameTimes.size() << ", max " << std::chrono::duration_cast<std::chrono::microseconds>(maxFrameTime).count() << "us\n";
+	}
+
+	return report;
+}
+
+} // namespace
+
+
+TEST(Benchmark_DapSession, ScriptedInspection) {
+	const DapReplayReport report = ReplaySession(MakeInspectionSession(100));
+
+	ASSERT_EQ(report.commands.at("variables").count, 100);
+	ASSERT_FALSE(report.frozenPerStop.empty());
+
+	report.Print(std::cout);
+}
+
+
+TEST(Benchmark_DapSession, ScriptedInspectionWithSnapshot) {
+	const DapReplayReport report = ReplaySession(MakeInspectionSession(100), StopSnapshotOptions{});
+
+	ASSERT_EQ(report.commands.at("variables").count, 100);
+
+	report.Print(std::cout);
+}
+
+
+/**
+	Replays the session recorded with ProtocolTrace::DumpToFile (the path is given with LUA_TOOLKIT_DAP_TRACE environment variable).
+*/
+TEST(Benchmark_DapSession, RecordedSession) {
+	const char* const tracePath = std::getenv("LUA_TOOLKIT_DAP_TRACE");
+	if (!tracePath) {
+		GTEST_SKIP() << "LUA_TOOLKIT_DAP_TRACE is not set";
+	}
+
+	const auto frames = ProtocolTrace::ReadFile(tracePath);
+	ASSERT_TRUE(frames);
+
+	const DapReplayReport report = ReplaySession(DapReplayClient::FromTrace(*frames));
+
+	report.Print(std::cout);
+}
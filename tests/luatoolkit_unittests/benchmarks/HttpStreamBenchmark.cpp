@@ -0,0 +1,73 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "remoting/httpstream.h"
+
+using namespace Runtime;
+
+namespace {
+
+constexpr std::string_view PacketBody = R"({"seq":1,"type":"request","command":"setBreakpoints","arguments":{"source":{"path":"scripts/game/main.lua"},"breakpoints":[{"line":10},{"line":20}]}})";
+
+
+/**
+	Burst of the pipelined packets (i.e. setBreakpoints requests at attach), that delivered through the fixed size reads.
+*/
+BytesBuffer MakePacketsBurst(size_t burstSize, size_t& packetsCount) {
+
+	const std::string body {PacketBody};
+	const std::string packet = "POST /dap HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+	packetsCount = burstSize / packet.size();
+
+	BytesBuffer burst(packetsCount * packet.size());
+	for (size_t i = 0; i < packetsCount; ++i) {
+		memcpy(burst.data() + i * packet.size(), packet.data(), packet.size());
+	}
+
+	return burst;
+}
+
+} // namespace
+
+
+TEST(Benchmark_HttpStream, InboundBurst10MB) {
+
+	constexpr size_t BurstSize = 10 * 1024 * 1024;
+	constexpr size_t ReadSize = 64 * 1024;
+
+	size_t expectedPacketsCount = 0;
+	const BytesBuffer burst = MakePacketsBurst(BurstSize, expectedPacketsCount);
+
+	std::vector<BytesBuffer> reads;
+	for (size_t offset = 0; offset < burst.size(); offset += ReadSize) {
+		const size_t size = std::min(ReadSize, burst.size() - offset);
+		BytesBuffer& read = reads.emplace_back(size);
+		memcpy(read.data(), burst.data() + offset, size);
+	}
+
+	HttpStream stream;
+	size_t packetsCount = 0;
+	size_t invalidPacketsCount = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	for (const BytesBuffer& read : reads) {
+		stream.AppendBytes(read.toReadOnly());
+
+		while (const HttpStream::Packet packet = stream.GetNextPacket()) {
+			++packetsCount;
+
+			// reads are cut at the arbitrary offsets: packets split across the reads must be assembled unchanged.
+			if (packet.body != PacketBody || packet.path != "/dap") {
+				++invalidPacketsCount;
+			}
+		}
+	}
+
+	const auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
+
+	ASSERT_EQ(packetsCount, expectedPacketsCount);
+	ASSERT_EQ(invalidPacketsCount, 0u);
+
+	std::cout << "HttpStream inbound: " << packetsCount << " packets, " << (burst.size() / (1024.0 * 1024.0)) / duration.count() << " MB/s\n";
+}
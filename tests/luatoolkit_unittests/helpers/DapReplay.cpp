@@ -0,0 +1,357 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "helpers/DapReplay.h"
+
+#include <lua-toolkit/debug/adapterprotocol.h>
+#include <lua-toolkit/debug/dapjsonreader.h>
+
+#include <algorithm>
+#include <charconv>
+#include <regex>
+#include <stdexcept>
+#include <utility>
+
+using namespace Runtime;
+
+namespace Lua::Tests {
+
+namespace {
+
+constexpr std::string_view ContentLengthHeader {"Content-Length: "};
+
+
+bool IsResumingCommand(std::string_view command) {
+	return command == "continue" || command == "next" || command == "stepIn" || command == "stepOut" || command == "disconnect";
+}
+
+
+std::chrono::microseconds GetPercentile(const std::vector<std::chrono::microseconds>& sortedValues, double percentile) {
+	const size_t index = static_cast<size_t>(std::ceil(percentile * static_cast<double>(sortedValues.size())));
+	return sortedValues[std::clamp<size_t>(index, 1, sortedValues.size()) - 1];
+}
+
+
+/**
+	Recorded ids are not valid in the replayed session: they are replaced with the references to the replayed responses.
+*/
+std::string ReplaceRecordedIds(std::string_view arguments) {
+	static const std::regex IdPattern {R"re("(frameId|variablesReference)"\s*:\s*\d+)re"};
+
+	return std::regex_replace(std::string{arguments}, IdPattern, "\"$1\":$$$1");
+}
+
+
+void ReplaceAll(std::string& str, std::string_view pattern, std::string_view value) {
+	for (size_t pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + value.size())) {
+		str.replace(pos, pattern.size(), value);
+	}
+}
+
+} // namespace
+
+
+DapReplayClient::Message DapReplayClient::Message::Parse(std::string_view json) {
+	Message message;
+
+	Dap::JsonReader reader{json};
+	reader.ReadObject([&](std::string_view key) {
+		if (key == "type") {
+			reader.Read(message.type);
+		}
+		else if (key == "event") {
+			reader.Read(message.event);
+		}
+		else if (key == "command") {
+			reader.Read(message.command);
+		}
+		else if (key == "request_seq") {
+			reader.Read(message.requestSeq);
+		}
+		else if (key == "success") {
+			reader.Read(message.success);
+		}
+		else if (key == "message") {
+			reader.Read(message.errorMessage);
+		}
+		else if (key == "body") {
+			message.body = reader.SkipValue();
+		}
+		else {
+			reader.SkipValue();
+		}
+	});
+
+	return message;
+}
+
+/* -------------------------------------------------------------------------- */
+void DapReplayReport::Print(std::ostream& stream) const {
+	for (const auto& [command, latency] : commands) {
+		stream << command << ": " << latency.count << " requests, p50 " << latency.p50.count() << "us, p99 " << latency.p99.count() << "us, max " << latency.max.count() << "us\n";
+	}
+
+	if (!frozenPerStop.empty()) {
+		const auto total = std::accumulate(frozenPerStop.begin(), frozenPerStop.end(), std::chrono::microseconds{0});
+		stream << "frozen per stop: " << frozenPerStop.size() << " stops, average " << (total / frozenPerStop.size()).count() << "us, total " << total.count() << "us\n";
+	}
+}
+
+/* -------------------------------------------------------------------------- */
+DapReplayClient::DapReplayClient(std::shared_ptr<InMemoryPipe> toServer, std::shared_ptr<InMemoryPipe> fromServer)
+	: _toServer(std::move(toServer))
+	, _fromServer(std::move(fromServer))
+{}
+
+
+DapReplayReport DapReplayClient::Run(const std::vector<DapReplayStep>& steps) {
+	std::map<std::string, std::vector<std::chrono::microseconds>> latencies;
+	DapReplayReport report;
+
+	for (const DapReplayStep& step : steps) {
+		const unsigned seq = ++_seq;
+
+		// stop that is ended by this request (next stop's event can be received before the response).
+		const auto stopTime = IsResumingCommand(step.command) ? std::exchange(_stopTime, std::nullopt) : std::nullopt;
+
+		const auto sendTime = std::chrono::steady_clock::now();
+		SendRequest(seq, step);
+
+		bool isResponseReceived = false;
+		bool isEventReceived = !step.waitEvent;
+
+		while (!isResponseReceived || !isEventReceived) {
+			const Message message = ReadMessage();
+			const auto receiveTime = std::chrono::steady_clock::now();
+
+			if (message.type == "event") {
+				if (message.event == "stopped") {
+					_stopTime = receiveTime;
+				}
+
+				isEventReceived = isEventReceived || (step.waitEvent && *step.waitEvent == message.event);
+				continue;
+			}
+
+			if (message.type != "response" || message.requestSeq != seq) {
+				continue;
+			}
+
+			isResponseReceived = true;
+			latencies[step.command].push_back(std::chrono::duration_cast<std::chrono::microseconds>(receiveTime - sendTime));
+
+			if (stopTime) {
+				report.frozenPerStop.push_back(std::chrono::duration_cast<std::chrono::microseconds>(receiveTime - *stopTime));
+			}
+
+			OnResponse(step.command, message);
+		}
+	}
+
+	for (auto& [command, values] : latencies) {
+		std::sort(values.begin(), values.end());
+
+		DapReplayReport::CommandLatency& latency = report.commands[command];
+		latency.count = values.size();
+		latency.p50 = GetPercentile(values, 0.5);
+		latency.p99 = GetPercentile(values, 0.99);
+		latency.max = values.back();
+	}
+
+	return report;
+}
+
+
+std::vector<DapReplayStep> DapReplayClient::FromTrace(const std::vector<Debug::ProtocolTrace::Frame>& frames) {
+	std::vector<DapReplayStep> steps;
+
+	for (const Debug::ProtocolTrace::Frame& frame : frames) {
+		if (frame.direction == Debug::ProtocolTrace::Direction::Outbound) {
+			// resuming request is replayed with waiting for the stop only if the stop was recorded.
+			if (!steps.empty() && frame.body.find(R"("event":"stopped")") != std::string::npos) {
+				steps.back().waitEvent = "stopped";
+			}
+			continue;
+		}
+
+		if (frame.size != frame.body.size()) {
+			// truncated request can not be replayed.
+			continue;
+		}
+
+		const Dap::InboundMessage message = Dap::InboundMessage::Parse(frame.body);
+		if (message.type != Dap::ProtocolMessage::MessageRequest) {
+			continue;
+		}
+
+		DapReplayStep& step = steps.emplace_back();
+		step.command = message.command;
+		if (!message.arguments.empty()) {
+			step.arguments = ReplaceRecordedIds(message.arguments);
+		}
+	}
+
+	return steps;
+}
+
+
+DapReplayClient::Message DapReplayClient::Request(std::string_view command, std::string_view arguments) {
+	const unsigned seq = ++_seq;
+	SendRequest(seq, {std::string{command}, std::string{arguments}});
+
+	while (true) {
+		Message message = ReadMessage();
+
+		if (message.type == "event") {
+			_events.emplace_back(std::move(message));
+		}
+		else if (message.type == "response" && message.requestSeq == seq) {
+			OnResponse(message.command, message);
+			return message;
+		}
+	}
+}
+
+
+DapReplayClient::Message DapReplayClient::WaitEvent(std::string_view event) {
+	const auto received = std::find_if(_events.begin(), _events.end(), [event](const Message& message) {
+		return message.event == event;
+	});
+
+	if (received != _events.end()) {
+		Message message = std::move(*received);
+		_events.erase(received);
+
+		return message;
+	}
+
+	while (true) {
+		Message message = ReadMessage();
+
+		if (message.type == "event") {
+			if (message.event == event) {
+				return message;
+			}
+
+			_events.emplace_back(std::move(message));
+		}
+	}
+}
+
+
+void DapReplayClient::SendRequest(unsigned seq, const DapReplayStep& step) {
+	const std::string body = R"({"seq":)" + std::to_string(seq) + R"(,"type":"request","command":")" + step.command + R"(","arguments":)" + SubstituteArguments(step.arguments) + "}";
+	const std::string packet = std::string{ContentLengthHeader} + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+	_toServer->Write(packet.data(), packet.size());
+}
+
+
+DapReplayClient::Message DapReplayClient::ReadMessage() {
+	while (true) {
+		if (const size_t headersEnd = _inbound.find("\r\n\r\n"); headersEnd != std::string::npos) {
+			const size_t lengthPos = _inbound.find(ContentLengthHeader);
+			if (lengthPos == std::string::npos || lengthPos > headersEnd) {
+				throw std::runtime_error("Content-Length expected");
+			}
+
+			size_t length = 0;
+			const char* const lengthBegin = _inbound.data() + lengthPos + ContentLengthHeader.size();
+			std::from_chars(lengthBegin, _inbound.data() + headersEnd, length);
+
+			const size_t bodyBegin = headersEnd + 4;
+			if (_inbound.size() >= bodyBegin + length) {
+				Message message = Message::Parse(std::string_view{_inbound}.substr(bodyBegin, length));
+				_inbound.erase(0, bodyBegin + length);
+
+				return message;
+			}
+		}
+
+		const BytesBuffer chunk = _fromServer->Read(std::chrono::duration_cast<std::chrono::milliseconds>(DefaultTimeout));
+		if (chunk.size() == 0) {
+			throw std::runtime_error("DAP message is not received");
+		}
+
+		_inbound.append(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	}
+}
+
+
+std::string DapReplayClient::SubstituteArguments(const std::string& arguments) const {
+	std::string result = arguments;
+	ReplaceAll(result, "$frameId", std::to_string(_frameId.value_or(0)));
+	ReplaceAll(result, "$variablesReference", std::to_string(_variablesReference.value_or(0)));
+
+	return result;
+}
+
+
+void DapReplayClient::OnResponse(const std::string& command, const Message& response) {
+	if (!response.success || response.body.empty()) {
+		return;
+	}
+
+	if (command == "stackTrace") {
+		Dap::StackTraceResponseBody body;
+		Dap::JsonReader{response.body}.Read(body);
+		if (!body.stackFrames.empty()) {
+			_frameId = body.stackFrames.front().id;
+		}
+	}
+	else if (command == "scopes") {
+		Dap::ScopesResponseBody body;
+		Dap::JsonReader{response.body}.Read(body);
+		if (!body.scopes.empty()) {
+			_variablesReference = body.scopes.front().variablesReference;
+		}
+	}
+}
+
+/* -------------------------------------------------------------------------- */
+DapTestSession::DapTestSession(Debug::DebugSessionController::Ptr controller, std::optional<Debug::StopSnapshotOptions> snapshotOptions)
+	: _connection(InMemoryStream::CreateConnection())
+	, _client(_connection.toServer, _connection.fromServer)
+{
+	auto session = Debug::DebugSession::Create(Debug::DapMessageStream::Create(_connection.serverStream, Debug::DapFraming::ContentLength), std::move(controller), snapshotOptions);
+
+	// promise is shared with the session task: the task can outlive the failed test.
+	auto sessionEnded = std::make_shared<std::promise<void>>();
+	_sessionEnded = sessionEnded->get_future();
+
+	[](Debug::DebugSession::Ptr session, std::shared_ptr<std::promise<void>> sessionEnded) -> Async::Task<> {
+		try {
+			co_await session->Run();
+			sessionEnded->set_value();
+		}
+		catch (...) {
+			sessionEnded->set_exception(std::current_exception());
+		}
+	}(std::move(session), std::move(sessionEnded)).detach();
+}
+
+
+DapTestSession::~DapTestSession() {
+	if (!_isEnded) {
+		_connection.toServer->Close();
+		_sessionEnded.wait_for(DapReplayClient::DefaultTimeout);
+	}
+}
+
+
+DapReplayClient& DapTestSession::GetClient() {
+	return _client;
+}
+
+
+void DapTestSession::End() {
+	_isEnded = true;
+	_connection.toServer->Close();
+
+	if (_sessionEnded.wait_for(DapReplayClient::DefaultTimeout) != std::future_status::ready) {
+		throw std::runtime_error("DAP session is not ended");
+	}
+
+	_sessionEnded.get();
+}
+
+} // namespace Lua::Tests
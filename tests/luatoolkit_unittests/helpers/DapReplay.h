@@ -0,0 +1,161 @@
+//◦ Playrix ◦
+#pragma once
+#include "helpers/InMemoryStream.h"
+
+#include <lua-toolkit/debug/debugsession.h>
+#include <lua-toolkit/debug/protocoltrace.h>
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Lua::Tests {
+
+/**
+	Request of the replayed session.
+	Arguments can reference values of the previous responses:
+		$frameId - id of the top frame of the last stackTrace response;
+		$variablesReference - reference of the first scope of the last scopes response.
+*/
+struct DapReplayStep
+{
+	std::string command;
+	std::string arguments = "{}";
+
+	/* Event (i.e. 'stopped') that must be received (after the response) before the next step. */
+	std::optional<std::string> waitEvent;
+};
+
+
+struct DapReplayReport
+{
+	struct CommandLatency
+	{
+		size_t count = 0;
+		std::chrono::microseconds p50;
+		std::chrono::microseconds p99;
+		std::chrono::microseconds max;
+	};
+
+	std::map<std::string, CommandLatency> commands;
+
+	/* Time between the 'stopped' event and the response to the request that resumed execution: the lua thread is frozen meanwhile. */
+	std::vector<std::chrono::microseconds> frozenPerStop;
+
+	void Print(std::ostream& stream) const;
+};
+
+
+/**
+	Client side of the DAP session (standard Content-Length framing) that replays the requests one by one and measures latencies.
+*/
+class DapReplayClient
+{
+public:
+
+	static constexpr auto DefaultTimeout = std::chrono::seconds{10};
+
+	/**
+		Response or event received from the server, body is the raw JSON.
+	*/
+	struct Message
+	{
+		std::string type;
+		std::string event;
+		std::string command;
+		unsigned requestSeq = 0;
+		bool success = true;
+		std::string errorMessage;
+		std::string body;
+
+		static Message Parse(std::string_view json);
+	};
+
+	DapReplayClient(std::shared_ptr<InMemoryPipe> toServer, std::shared_ptr<InMemoryPipe> fromServer);
+
+	/**
+		Throws std::runtime_error when response (or awaited event) is not received in time.
+	*/
+	DapReplayReport Run(const std::vector<DapReplayStep>& steps);
+
+	/**
+		Session recorded with ProtocolTrace: inbound frames are the requests, resuming requests wait for the 'stopped' event when it was recorded.
+		Recorded frameId and variablesReference are replaced with $frameId and $variablesReference (nested variables are requested for the first scope).
+		Sources and breakpoints are replayed as recorded: only the sessions recorded against the StubGame scripts can be replayed,
+		otherwise breakpoints are not hit and the wait for the 'stopped' event times out.
+	*/
+	static std::vector<DapReplayStep> FromTrace(const std::vector<Runtime::Debug::ProtocolTrace::Frame>& frames);
+
+	/**
+		Sends the request and returns its response, events received meanwhile are kept for WaitEvent.
+		Throws std::runtime_error when the response is not received in time.
+	*/
+	Message Request(std::string_view command, std::string_view arguments = "{}");
+
+	/**
+		Returns the first not yet taken event with the given name. Throws std::runtime_error when it is not received in time.
+	*/
+	Message WaitEvent(std::string_view event);
+
+private:
+
+	void SendRequest(unsigned seq, const DapReplayStep& step);
+
+	Message ReadMessage();
+
+	std::string SubstituteArguments(const std::string& arguments) const;
+
+	void OnResponse(const std::string& command, const Message& response);
+
+	const std::shared_ptr<InMemoryPipe> _toServer;
+	const std::shared_ptr<InMemoryPipe> _fromServer;
+	std::string _inbound;
+	unsigned _seq = 0;
+	std::deque<Message> _events;
+
+	std::optional<unsigned> _frameId;
+	std::optional<unsigned> _variablesReference;
+	std::optional<std::chrono::steady_clock::time_point> _stopTime;
+};
+
+
+
+/**
+	DAP session (standard framing) over the in-memory connection, run against the given controller: the test drives the client.
+*/
+class DapTestSession
+{
+public:
+
+	explicit DapTestSession(Runtime::Debug::DebugSessionController::Ptr, std::optional<Runtime::Debug::StopSnapshotOptions> snapshotOptions = std::nullopt);
+
+	~DapTestSession();
+
+	DapTestSession(const DapTestSession&) = delete;
+
+	DapTestSession& operator = (const DapTestSession&) = delete;
+
+	DapReplayClient& GetClient();
+
+	/**
+		Closes the client side of the connection and waits until the session ends (disconnecting the controller).
+		Throws std::runtime_error when the session is not ended in time, rethrows the session failure.
+	*/
+	void End();
+
+private:
+
+	InMemoryStream::Connection _connection;
+	DapReplayClient _client;
+	std::future<void> _sessionEnded;
+	bool _isEnded = false;
+};
+
+} // namespace Lua::Tests
@@ -1,8 +1,163 @@
 //◦ Playrix ◦
 #include "pch.h"
+#include "helpers/GameStubs.h"
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+}
 
 namespace Core::Flash {
 
 Core::FlashRender* render = nullptr;
 
 }
+
+
+namespace Lua::Tests {
+
+using namespace Runtime;
+
+namespace {
+
+constexpr std::string_view GameScript = R"(
+local world = { frame = 0, entities = {} }
+
+function initWorld(count)
+	for i = 1, count do
+		world.entities[i] = { id = i, name = "entity" .. i, position = { x = i, y = i * 2 }, tags = { "unit", "movable" } }
+	end
+end
+
+function updateEntity(entity, dt)
+	local speed = entity.id * dt
+	local position = entity.position
+	position.x = position.x + speed
+	position.y = position.y - speed
+	return speed
+end
+
+function update(dt)
+	world.frame = world.frame + 1
+	local total = 0
+	for _, entity in ipairs(world.entities) do
+		total = total + updateEntity(entity, dt)
+	end
+	return total
+end
+)";
+
+constexpr auto FramePeriod = std::chrono::milliseconds{4};
+
+} // namespace
+
+
+/**
+	Controller that enables debugging on the game thread (hooks are installed by the thread that runs the lua code).
+*/
+class StubGame::Controller final : public Lua::Debug::LuaDebugSessionController
+{
+	CLASS_INFO(
+		CLASS_BASE(Lua::Debug::LuaDebugSessionController)
+	)
+
+public:
+
+	explicit Controller(lua_State* lua): _lua(lua)
+	{}
+
+	/**
+		Must be called on the game thread.
+	*/
+	void Update() {
+		if (_isEnableRequested.exchange(false)) {
+			EnableDebug();
+		}
+	}
+
+private:
+
+	lua_State* GetLua() const override {
+		return _lua;
+	}
+
+	Async::Task<> Start(StartMode) override {
+		_isEnableRequested = true;
+		return Async::Task<>::makeResolved();
+	}
+
+	lua_State* const _lua;
+	std::atomic<bool> _isEnableRequested = false;
+};
+
+
+/* -------------------------------------------------------------------------- */
+StubGame::StubGame(unsigned entitiesCount): _lua(luaL_newstate())
+{
+	Assert(_lua);
+	luaL_openlibs(_lua);
+
+	if (luaL_loadbuffer(_lua, GameScript.data(), GameScript.size(), "@scripts/game/stubgame.lua") != 0 || lua_pcall(_lua, 0, 0, 0) != 0) {
+		Halt(lua_tostring(_lua, -1));
+	}
+
+	lua_getfield(_lua, LUA_GLOBALSINDEX, "initWorld");
+	lua_pushinteger(_lua, static_cast<lua_Integer>(entitiesCount));
+	lua_call(_lua, 1, 0);
+
+	_controller = Com::createInstance<Controller>(_lua);
+	_thread = std::thread([this] { RunLoop(); });
+}
+
+
+StubGame::~StubGame() {
+	Stop();
+	lua_close(_lua);
+}
+
+
+Runtime::Debug::DebugSessionController::Ptr StubGame::GetController() const {
+	return _controller;
+}
+
+
+void StubGame::Stop() {
+	_isStopRequested = true;
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+
+std::vector<std::chrono::nanoseconds> StubGame::GetFrameTimes() const {
+	std::lock_guard lock{_mutex};
+	return _frameTimes;
+}
+
+
+void StubGame::RunLoop() {
+	while (!_isStopRequested) {
+		const auto frameStart = std::chrono::steady_clock::now();
+
+		_controller->Update();
+
+		lua_getfield(_lua, LUA_GLOBALSINDEX, "update");
+		lua_pushnumber(_lua, 0.016);
+		if (lua_pcall(_lua, 1, 0, 0) != 0) {
+			Halt(lua_tostring(_lua, -1));
+		}
+
+		const auto frameTime = std::chrono::steady_clock::now() - frameStart;
+		{
+			std::lock_guard lock{_mutex};
+			_frameTimes.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(frameTime));
+		}
+
+		if (frameTime < FramePeriod) {
+			std::this_thread::sleep_for(FramePeriod - frameTime);
+		}
+	}
+}
+
+} // namespace Lua::Tests
@@ -0,0 +1,56 @@
+//◦ Playrix ◦
+#pragma once
+#include <lua-toolkit/debug/luadebug.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lua::Tests {
+
+/**
+	Game loop stub: real lua state, that runs the 'update' script function every frame on its own thread (the "main" game thread).
+	Script keeps a world of entities (tables with nested tables), so stopped frames have non trivial locals and upvalues.
+	Debugging is enabled on the game thread at the next frame after the session configuration is done.
+*/
+class StubGame
+{
+public:
+
+	/* Function called for the every entity on the every frame (target of the function breakpoints). */
+	static constexpr std::string_view EntityUpdateFunction {"updateEntity"};
+
+	explicit StubGame(unsigned entitiesCount = 200);
+
+	~StubGame();
+
+	StubGame(const StubGame&) = delete;
+
+	StubGame& operator = (const StubGame&) = delete;
+
+	Runtime::Debug::DebugSessionController::Ptr GetController() const;
+
+	void Stop();
+
+	/**
+		Durations of the completed frames (frames with the stops include the time the lua thread was frozen).
+	*/
+	std::vector<std::chrono::nanoseconds> GetFrameTimes() const;
+
+private:
+
+	class Controller;
+
+	void RunLoop();
+
+	lua_State* const _lua;
+	Runtime::ComPtr<Controller> _controller;
+	std::atomic<bool> _isStopRequested = false;
+	std::vector<std::chrono::nanoseconds> _frameTimes;
+	mutable std::mutex _mutex;
+	std::thread _thread;
+};
+
+} // namespace Lua::Tests
@@ -0,0 +1,94 @@
+//◦ Playrix ◦
+#include "pch.h"
+#include "helpers/InMemoryStream.h"
+
+#include <runtime/runtime/runtime.h>
+
+using namespace Runtime;
+
+namespace Lua::Tests {
+
+/* -------------------------------------------------------------------------- */
+void InMemoryPipe::Write(const void* data, size_t size) {
+	if (size == 0) {
+		return;
+	}
+
+	BytesBuffer chunk(size);
+	memcpy(chunk.data(), data, size);
+
+	{
+		std::lock_guard lock{_mutex};
+		_chunks.emplace_back(std::move(chunk));
+	}
+
+	_signal.notify_one();
+}
+
+
+BytesBuffer InMemoryPipe::Read(std::chrono::milliseconds timeout) {
+	std::unique_lock lock{_mutex};
+
+	const auto hasData = [this] {
+		return !_chunks.empty() || _isClosed;
+	};
+
+	if (timeout == std::chrono::milliseconds::max()) {
+		_signal.wait(lock, hasData);
+	}
+	else if (!_signal.wait_for(lock, timeout, hasData)) {
+		return {};
+	}
+
+	if (_chunks.empty()) {
+		return {};
+	}
+
+	BytesBuffer chunk = std::move(_chunks.front());
+	_chunks.pop_front();
+
+	return chunk;
+}
+
+
+void InMemoryPipe::Close() {
+	{
+		std::lock_guard lock{_mutex};
+		_isClosed = true;
+	}
+
+	_signal.notify_all();
+}
+
+/* -------------------------------------------------------------------------- */
+InMemoryStream::Connection InMemoryStream::CreateConnection() {
+	Connection connection;
+	connection.toServer = std::make_shared<InMemoryPipe>();
+	connection.fromServer = std::make_shared<InMemoryPipe>();
+	connection.serverStream = Com::createInstance<InMemoryStream, Io::AsyncReader>(connection.toServer, connection.fromServer);
+
+	return connection;
+}
+
+
+InMemoryStream::InMemoryStream(std::shared_ptr<InMemoryPipe> inbound, std::shared_ptr<InMemoryPipe> outbound)
+	: _inbound(std::move(inbound))
+	, _outbound(std::move(outbound))
+{}
+
+
+Async::Task<BytesBuffer> InMemoryStream::read() {
+	// blocking wait is performed on the pool thread (like the stdio stream does).
+	co_await RuntimeCore::instance().poolScheduler();
+
+	co_return _inbound->Read();
+}
+
+
+Async::Task<> InMemoryStream::write(ReadOnlyBuffer bytes) {
+	_outbound->Write(bytes.data(), bytes.size());
+
+	return Async::Task<>::makeResolved();
+}
+
+} // namespace Lua::Tests
@@ -0,0 +1,70 @@
+//◦ Playrix ◦
+#pragma once
+#include <runtime/com/comclass.h>
+#include <runtime/io/asyncreader.h>
+#include <runtime/io/asyncwriter.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace Lua::Tests {
+
+/**
+	One direction of the in-memory connection: written chunks are read in the same order, blocking read waits for the data.
+*/
+class InMemoryPipe
+{
+public:
+
+	void Write(const void* data, size_t size);
+
+	/**
+		Returns next chunk or empty buffer when the pipe is closed (or timeout is expired).
+	*/
+	Runtime::BytesBuffer Read(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+	void Close();
+
+private:
+
+	std::deque<Runtime::BytesBuffer> _chunks;
+	std::mutex _mutex;
+	std::condition_variable _signal;
+	bool _isClosed = false;
+};
+
+
+/**
+	Server side of the in-memory connection (DapMessageStream is created over it), client side is driven through the pipes directly.
+*/
+class InMemoryStream final : public Runtime::Io::AsyncReader, public Runtime::Io::AsyncWriter
+{
+	COMCLASS_(Runtime::Io::AsyncReader, Runtime::Io::AsyncWriter)
+
+public:
+
+	struct Connection
+	{
+		Runtime::ComPtr<Runtime::Io::AsyncReader> serverStream;
+		std::shared_ptr<InMemoryPipe> toServer;
+		std::shared_ptr<InMemoryPipe> fromServer;
+	};
+
+	static Connection CreateConnection();
+
+	InMemoryStream(std::shared_ptr<InMemoryPipe> inbound, std::shared_ptr<InMemoryPipe> outbound);
+
+private:
+
+	Runtime::Async::Task<Runtime::BytesBuffer> read() override;
+
+	Runtime::Async::Task<> write(Runtime::ReadOnlyBuffer) override;
+
+	const std::shared_ptr<InMemoryPipe> _inbound;
+	const std::shared_ptr<InMemoryPipe> _outbound;
+};
+
+} // namespace Lua::Tests